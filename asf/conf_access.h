@@ -109,6 +109,7 @@
 #define Lun_2_usb_write_10                      sd_mmc_usb_write_10_0
 #define Lun_2_mem_2_ram                         sd_mmc_mem_2_ram_0
 #define Lun_2_ram_2_mem                         sd_mmc_ram_2_mem_0
+#define Lun_2_sync                              sd_mmc_mem_sync_0
 #define LUN_2_NAME                              "\"SD/MMC Card Slot 0\""
 //! @}
 
@@ -126,6 +127,7 @@
 #define Lun_3_usb_write_10                      sd_mmc_usb_write_10_1
 #define Lun_3_mem_2_ram                         sd_mmc_mem_2_ram_1
 #define Lun_3_ram_2_mem                         sd_mmc_ram_2_mem_1
+#define Lun_3_sync                              sd_mmc_mem_sync_1
 #define LUN_3_NAME                              "\"SD/MMC Card Slot 1\""
 //! @}
 
@@ -55,6 +55,18 @@
 #include "hsmci.h"
 #include "conf_sd_mmc.h"
 
+#if 1	// dc42
+#include "Core.h"		// for CoreWaitStart() and CoreWaitPoll()
+#include "../../../../libraries/Storage/sd_mmc.h"		// for sd_mmc_record_latency() and sd_mmc_record_error()
+
+// Maximum time we wait for the card to stop signalling busy. The SD spec allows 250ms (SDSC) or 500ms (SDHC/SDXC) for a write, so allow plenty more.
+#define HSMCI_BUSY_TIMEOUT_MICROS	(2000000)
+
+#ifndef HSMCI_INT_LEVEL
+#  define HSMCI_INT_LEVEL 5 // By default the HSMCI interrupt has low priority
+#endif
+#endif
+
 /**
  * \ingroup sam_drivers_hsmci
  * \defgroup sam_drivers_hsmci_internal High Speed MultiMedia Card Interface
@@ -163,6 +175,24 @@ static void hsmci_reset(void)
 	HSMCI->HSMCI_CR = HSMCI_CR_PWSEN | HSMCI_CR_MCIEN;
 }
 
+#if 1	// dc42
+/** \brief Record the error flagged in the status register value and reset the HSMCI
+ *
+ * \param sr  Status register value that showed the error
+ */
+static void hsmci_error_reset(uint32_t sr)
+{
+	if (sr & (HSMCI_SR_RCRCE | HSMCI_SR_DCRCE)) {
+		sd_mmc_record_error(SD_MMC_ERROR_CRC);
+	} else if (sr & (HSMCI_SR_CSTOE | HSMCI_SR_RTOE | HSMCI_SR_DTOE)) {
+		sd_mmc_record_error(SD_MMC_ERROR_TIMEOUT);
+	} else {
+		sd_mmc_record_error(SD_MMC_ERROR_OTHER);
+	}
+	hsmci_reset();
+}
+#endif
+
 /**
  * \brief Set speed of the HSMCI clock.
  *
@@ -253,6 +283,29 @@ hsmciIdleFunc_t hsmci_set_idle_func(hsmciIdleFunc_t p)
        return ret;
 }
 
+// Enable the interrupt that signals the end of the data transfer or a data error.
+// Call this after the last call to hsmci_start_read_blocks or hsmci_start_write_blocks for the command.
+void hsmci_enable_end_of_transfer_interrupt(bool write)
+{
+#if (SAMV70 || SAMV71 || SAME70 || SAMS70)
+	const uint32_t doneBit = HSMCI_SR_XFRDONE;
+#else
+	const uint32_t doneBit = (write) ? HSMCI_SR_NOTBUSY : HSMCI_SR_XFRDONE;
+#endif
+	HSMCI->HSMCI_IER = doneBit | HSMCI_SR_UNRE | HSMCI_SR_OVRE | HSMCI_SR_DTOE | HSMCI_SR_DCRCE;
+	NVIC_SetPriority(HSMCI_IRQn, HSMCI_INT_LEVEL);
+	NVIC_EnableIRQ(HSMCI_IRQn);
+}
+
+// Disable all HSMCI interrupts and return true if any were enabled.
+// The status register is not read here because that would clear the error flags that the wait functions check.
+bool hsmci_disable_interrupts(void)
+{
+	const bool wasEnabled = (HSMCI->HSMCI_IMR != 0);
+	HSMCI->HSMCI_IDR = 0xFFFFFFFF;
+	return wasEnabled;
+}
+
 #endif
 
 /** \brief Wait the end of busy signal on data line
@@ -261,6 +314,25 @@ hsmciIdleFunc_t hsmci_set_idle_func(hsmciIdleFunc_t p)
  */
 static bool hsmci_wait_busy(void)
 {
+#if 1	// dc42
+	CoreWaitState ws;
+	CoreWaitStart(&ws, HSMCI_BUSY_TIMEOUT_MICROS);
+	uint32_t sr;
+
+	for (;;) {
+		sr = HSMCI->HSMCI_SR;
+		if ((sr & HSMCI_SR_NOTBUSY) && ((sr & HSMCI_SR_DTIP) == 0)) {
+			sd_mmc_record_latency(SD_MMC_OP_BUSY, ws.startCycles);
+			return true;
+		}
+		if (CoreWaitPoll(&ws)) {
+			hsmci_debug("%s: timeout\n\r", __func__);
+			sd_mmc_record_error(SD_MMC_ERROR_TIMEOUT);
+			hsmci_reset();
+			return false;
+		}
+	}
+#else
 	uint32_t busy_wait = 0xFFFFFFFF;
 	uint32_t sr;
 
@@ -273,6 +345,7 @@ static bool hsmci_wait_busy(void)
 		}
 	} while (!((sr & HSMCI_SR_NOTBUSY) && ((sr & HSMCI_SR_DTIP) == 0)));
 	return true;
+#endif
 }
 
 
@@ -318,7 +391,7 @@ static bool hsmci_send_cmd_execute(uint32_t cmdr, sdmmc_cmd_def_t cmd,
 					| HSMCI_SR_RDIRE | HSMCI_SR_RINDE)) {
 				hsmci_debug("%s: CMD 0x%08x sr 0x%08x error\n\r",
 						__func__, cmd, sr);
-				hsmci_reset();
+				hsmci_error_reset(sr);	// dc42
 				return false;
 			}
 		} else {
@@ -327,7 +400,7 @@ static bool hsmci_send_cmd_execute(uint32_t cmdr, sdmmc_cmd_def_t cmd,
 					| HSMCI_SR_RDIRE | HSMCI_SR_RINDE)) {
 				hsmci_debug("%s: CMD 0x%08x sr 0x%08x error\n\r",
 						__func__, cmd, sr);
-				hsmci_reset();
+				hsmci_error_reset(sr);	// dc42
 				return false;
 			}
 		}
@@ -597,7 +670,7 @@ bool hsmci_read_word(uint32_t* value)
 				HSMCI_SR_DTOE | HSMCI_SR_DCRCE)) {
 			hsmci_debug("%s: DMA sr 0x%08x error\n\r",
 					__func__, sr);
-			hsmci_reset();
+			hsmci_error_reset(sr);	// dc42
 			return false;
 		}
 	} while (!(sr & HSMCI_SR_RXRDY));
@@ -623,7 +696,7 @@ bool hsmci_read_word(uint32_t* value)
 				HSMCI_SR_DTOE | HSMCI_SR_DCRCE)) {
 			hsmci_debug("%s: DMA sr 0x%08x error\n\r",
 					__func__, sr);
-			hsmci_reset();
+			hsmci_error_reset(sr);	// dc42
 			return false;
 		}
 	} while (!(sr & HSMCI_SR_XFRDONE));
@@ -643,7 +716,7 @@ bool hsmci_write_word(uint32_t value)
 				HSMCI_SR_DTOE | HSMCI_SR_DCRCE)) {
 			hsmci_debug("%s: DMA sr 0x%08x error\n\r",
 					__func__, sr);
-			hsmci_reset();
+			hsmci_error_reset(sr);	// dc42
 			return false;
 		}
 	} while (!(sr & HSMCI_SR_TXRDY));
@@ -669,7 +742,7 @@ bool hsmci_write_word(uint32_t value)
 				HSMCI_SR_DTOE | HSMCI_SR_DCRCE)) {
 			hsmci_debug("%s: DMA sr 0x%08x error\n\r",
 					__func__, sr);
-			hsmci_reset();
+			hsmci_error_reset(sr);	// dc42
 			return false;
 		}
 	} while (!(sr & HSMCI_SR_NOTBUSY));
@@ -751,7 +824,7 @@ bool hsmci_wait_end_of_read_blocks(void)
 				HSMCI_SR_DTOE | HSMCI_SR_DCRCE)) {
 			hsmci_debug("%s: DMA sr 0x%08x error\n\r",
 					__func__, sr);
-			hsmci_reset();
+			hsmci_error_reset(sr);	// dc42
 			// Disable DMA
 			dmac_channel_disable(DMAC, CONF_HSMCI_DMA_CHANNEL);
 			return false;
@@ -840,7 +913,7 @@ bool hsmci_wait_end_of_write_blocks(void)
 				HSMCI_SR_DTOE | HSMCI_SR_DCRCE)) {
 			hsmci_debug("%s: DMA sr 0x%08x error\n\r",
 					__func__, sr);
-			hsmci_reset();
+			hsmci_error_reset(sr);	// dc42
 			// Disable DMA
 			dmac_channel_disable(DMAC, CONF_HSMCI_DMA_CHANNEL);
 			return false;
@@ -905,7 +978,7 @@ bool hsmci_wait_end_of_read_blocks(void)
 			hsmci_debug("%s: PDC sr 0x%08x error\n\r",
 					__func__, sr);
 			HSMCI->HSMCI_PTCR = HSMCI_PTCR_RXTDIS | HSMCI_PTCR_TXTDIS;
-			hsmci_reset();
+			hsmci_error_reset(sr);	// dc42
 			return false;
 		}
 
@@ -928,7 +1001,7 @@ bool hsmci_wait_end_of_read_blocks(void)
 				HSMCI_SR_DTOE | HSMCI_SR_DCRCE)) {
 			hsmci_debug("%s: PDC sr 0x%08x last transfer error\n\r",
 					__func__, sr);
-			hsmci_reset();
+			hsmci_error_reset(sr);	// dc42
 			return false;
 		}
 	} while (!(sr & HSMCI_SR_XFRDONE));
@@ -980,7 +1053,7 @@ bool hsmci_wait_end_of_write_blocks(void)
 				HSMCI_SR_DTOE | HSMCI_SR_DCRCE)) {
 			hsmci_debug("%s: PDC sr 0x%08x error\n\r",
 					__func__, sr);
-			hsmci_reset();
+			hsmci_error_reset(sr);	// dc42
 			HSMCI->HSMCI_PTCR = HSMCI_PTCR_RXTDIS | HSMCI_PTCR_TXTDIS;
 			return false;
 		}
@@ -1004,7 +1077,7 @@ bool hsmci_wait_end_of_write_blocks(void)
 				HSMCI_SR_DTOE | HSMCI_SR_DCRCE)) {
 			hsmci_debug("%s: PDC sr 0x%08x last transfer error\n\r",
 					__func__, sr);
-			hsmci_reset();
+			hsmci_error_reset(sr);	// dc42
 			return false;
 		}
 	} while (!(sr & HSMCI_SR_NOTBUSY));
@@ -1081,7 +1154,7 @@ bool hsmci_wait_end_of_read_blocks(void)
 				HSMCI_SR_DTOE | HSMCI_SR_DCRCE)) {
 			hsmci_debug("%s: DMA sr 0x%08x error\n\r",
 					__func__, sr);
-			hsmci_reset();
+			hsmci_error_reset(sr);	// dc42
 			// Disable XDMAC
 			xdmac_channel_disable(XDMAC, CONF_HSMCI_XDMAC_CHANNEL);
 			return false;
@@ -1169,7 +1242,7 @@ bool hsmci_wait_end_of_write_blocks(void)
 		HSMCI_SR_DTOE | HSMCI_SR_DCRCE)) {
 			hsmci_debug("%s: DMA sr 0x%08x error\n\r",
 			__func__, sr);
-			hsmci_reset();
+			hsmci_error_reset(sr);	// dc42
 			// Disable XDMAC
 			xdmac_channel_disable(XDMAC, CONF_HSMCI_XDMAC_CHANNEL);
 			return false;
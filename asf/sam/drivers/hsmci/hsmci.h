@@ -213,6 +213,12 @@ typedef void (*hsmciIdleFunc_t)(uint32_t, uint32_t);
 // Set the idle function and return the old one
 hsmciIdleFunc_t hsmci_set_idle_func(hsmciIdleFunc_t);
 
+// Enable the interrupt that signals the end of the data transfer or a data error
+void hsmci_enable_end_of_transfer_interrupt(bool write);
+
+// Disable all HSMCI interrupts and return true if any were enabled
+bool hsmci_disable_interrupts(void);
+
 #endif
 
 //! @}
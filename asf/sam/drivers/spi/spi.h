@@ -69,7 +69,8 @@ typedef enum
 	SPI_ERROR_ARGUMENT,
 	SPI_ERROR_OVERRUN,
 	SPI_ERROR_MODE_FAULT,
-	SPI_ERROR_OVERRUN_AND_MODE_FAULT
+	SPI_ERROR_OVERRUN_AND_MODE_FAULT,
+	SPI_BUSY										// dc42 added: a queued SharedSpi transaction has not completed yet
 } spi_status_t;
 
 /** SPI Chip Select behavior modes while transferring. */
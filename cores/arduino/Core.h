@@ -190,6 +190,9 @@ struct PinDescription
 /* Pins table to be instantiated into variant.cpp */
 extern const PinDescription g_APinDescription[];
 
+// Value in the PinPioBits table of a variant for a pin that is not a single PIO pin
+static const uint8_t NoPioBit = 0xFF;
+
 #include "WCharacter.h"
 #include "HardwareSerial.h"
 #include "WInterrupts.h"
@@ -209,6 +212,8 @@ extern const PinDescription g_APinDescription[];
 #ifdef __cplusplus
 #include "AnalogIn.h"
 #include "AnalogOut.h"
+#include "DeviceSignature.h"
+#include "StepPulseGenerator.h"
 #include "USB/USBSerial.h"
 #endif
 
@@ -0,0 +1,91 @@
+/*
+ * DeviceSignature.cpp
+ *
+ * The EFC read sequences used here map the unique ID or user signature over the start of the flash until they are stopped.
+ * efc_perform_read_sequence runs from RAM but leaves interrupts enabled, so we disable them around it; otherwise an
+ * interrupt taken during the sequence would fetch its vector and code from the wrong place.
+ */
+
+#include "Core.h"
+#include "DeviceSignature.h"
+
+#include "sam/services/flash_efc/flash_efc.h"
+
+static uint32_t uniqueId[UniqueIdWords];
+static bool uniqueIdValid = false;
+
+#if USER_SIGNATURE_SUPPORTED
+static uint32_t userSignature[UserSignatureWords];
+
+// Read the user signature into RAM
+static bool ReadUserSignature()
+{
+	const irqflags_t flags = cpu_irq_save();
+	const bool ok = flash_read_user_signature(userSignature, UserSignatureWords) == FLASH_RC_OK;
+	cpu_irq_restore(flags);
+	if (!ok)
+	{
+		memset(userSignature, 0xFF, sizeof(userSignature));
+	}
+	return ok;
+}
+#endif
+
+void DeviceSignatureInit()
+{
+	const irqflags_t flags = cpu_irq_save();
+	uniqueIdValid = flash_read_unique_id(uniqueId, UniqueIdWords) == FLASH_RC_OK;
+	cpu_irq_restore(flags);
+	if (!uniqueIdValid)
+	{
+		memset(uniqueId, 0, sizeof(uniqueId));
+	}
+
+#if USER_SIGNATURE_SUPPORTED
+	(void)ReadUserSignature();
+#endif
+}
+
+bool IsUniqueIdValid()
+{
+	return uniqueIdValid;
+}
+
+const uint32_t *GetUniqueId()
+{
+	return uniqueId;
+}
+
+#if USER_SIGNATURE_SUPPORTED
+
+const uint32_t *GetUserSignature()
+{
+	return userSignature;
+}
+
+bool WriteUserSignature(const uint32_t *data, size_t numWords)
+{
+	if (numWords > UserSignatureWords)
+	{
+		return false;
+	}
+
+	// Build the whole page so that the words we are not given end up erased
+	uint32_t buffer[UserSignatureWords];
+	memcpy(buffer, data, numWords * sizeof(uint32_t));
+	memset(buffer + numWords, 0xFF, (UserSignatureWords - numWords) * sizeof(uint32_t));
+
+	// The EFC commands run from RAM with interrupts disabled. Keep them disabled between the erase and the write as well,
+	// so that nothing else can use the flash latch buffer in between.
+	const irqflags_t flags = cpu_irq_save();
+	bool ok = flash_erase_user_signature() == FLASH_RC_OK
+			&& flash_write_user_signature(buffer, UserSignatureWords) == FLASH_RC_OK;
+	cpu_irq_restore(flags);
+
+	ok = ReadUserSignature() && ok;
+	return ok && memcmp(userSignature, buffer, sizeof(buffer)) == 0;
+}
+
+#endif
+
+// End
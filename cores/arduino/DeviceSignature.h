@@ -0,0 +1,47 @@
+/*
+ * DeviceSignature.h
+ *
+ * Copies of the processor's unique ID and (where the processor has one) the user signature page, read once at startup.
+ * Reading either of them directly stops the flash from being read while the command runs, so the copies in RAM should be used instead.
+ */
+
+#ifndef DEVICESIGNATURE_H_
+#define DEVICESIGNATURE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+// Size of the unique ID in 32-bit words
+const size_t UniqueIdWords = 4;
+
+#if SAM4E || SAM4S || SAME70
+# define USER_SIGNATURE_SUPPORTED	1
+
+// Size of the user signature in 32-bit words
+const size_t UserSignatureWords = 512/sizeof(uint32_t);
+#else
+# define USER_SIGNATURE_SUPPORTED	0
+#endif
+
+// Read the unique ID and user signature into RAM. Called from init().
+extern void DeviceSignatureInit();
+
+// Return true if the unique ID was read successfully
+extern bool IsUniqueIdValid();
+
+// Return the unique ID. If it could not be read, all words are zero.
+extern const uint32_t *GetUniqueId();
+
+#if USER_SIGNATURE_SUPPORTED
+
+// Return the user signature. Unprogrammed words read as 0xFFFFFFFF.
+extern const uint32_t *GetUserSignature();
+
+// Replace the user signature with 'numWords' words of data. The remainder of the page is set to 0xFFFFFFFF.
+// Interrupts are disabled while the signature is erased and programmed, which takes several milliseconds.
+// Returns true if the signature now holds the data; the copy in RAM is updated from the flash in any case.
+extern bool WriteUserSignature(const uint32_t *data, size_t numWords);
+
+#endif
+
+#endif /* DEVICESIGNATURE_H_ */
@@ -0,0 +1,321 @@
+/*
+ * QuadratureDecoder.cpp
+ */
+
+#include "QuadratureDecoder.h"
+
+#if SAM3XA
+typedef int32_t CounterDelta;			// the TC counters are 32 bits wide
+#else
+typedef int16_t CounterDelta;			// the TC counters are 16 bits wide
+const uint32_t QuarterRange = 0x4000;	// how far the count may move before the interrupt extends it
+#endif
+
+const uint32_t AllEvents = TC_QISR_IDX | TC_QISR_DIRCHG | TC_QISR_QERR;
+
+// TC blocks and the peripheral ID of channel 0 of each. The IDs of channels 1 and 2 follow it.
+#if SAM4S
+static Tc * const tcBlocks[] = { TC0, TC1 };
+static const uint8_t tcBlockIds[] = { ID_TC0, ID_TC3 };
+#elif SAM3XA || SAM4E
+static Tc * const tcBlocks[] = { TC0, TC1, TC2 };
+static const uint8_t tcBlockIds[] = { ID_TC0, ID_TC3, ID_TC6 };
+#elif SAME70
+static Tc * const tcBlocks[] = { TC0, TC1, TC2, TC3 };
+static const uint8_t tcBlockIds[] = { ID_TC0, ID_TC3, ID_TC6, ID_TC9 };
+#endif
+
+const size_t NumTcBlocks = ARRAY_SIZE(tcBlocks);
+
+QuadratureDecoder::QuadratureDecoder()
+	: tc(nullptr), irqn((IRQn_Type)0), hasIndex(false), countsPerRev(0), lastCount(0), extendedCount(0), lastRevs(0), extendedRevs(0), offset(0),
+	  velocityPosition(0), velocityCycles(0), velocity(0.0), callback(nullptr), callbackParam((uint32_t)0), callbackEvents(0), pendingEvents(0)
+{
+}
+
+bool QuadratureDecoder::Init(Pin phaseA, Pin phaseB, Pin index, uint32_t cpr, uint32_t filterClocks)
+{
+	if (phaseA > MaxPinNumber || phaseB > MaxPinNumber || (index != NoPin && (index > MaxPinNumber || cpr == 0)))
+	{
+		return false;
+	}
+#if !SAM3XA
+	if (index != NoPin && cpr > 0x7FFF)
+	{
+		return false;											// the count within a revolution must fit in a signed 16-bit value
+	}
+#endif
+
+	// Phase A must be TIOA of channel 0 of a block, phase B TIOB of the same channel and the index TIOB of channel 1
+	const int tcChanA = (int)g_APinDescription[phaseA].ulTCChannel;
+	if (tcChanA < 0 || (tcChanA % 6) != 0)
+	{
+		return false;
+	}
+	const size_t block = (size_t)tcChanA/6;
+	if (block >= NumTcBlocks
+		|| (int)g_APinDescription[phaseB].ulTCChannel != tcChanA + 1
+		|| (index != NoPin && (int)g_APinDescription[index].ulTCChannel != tcChanA + 3)
+	   )
+	{
+		return false;
+	}
+
+	Stop();
+
+	tc = tcBlocks[block];
+	irqn = (IRQn_Type)tcBlockIds[block];
+	hasIndex = (index != NoPin);
+	countsPerRev = cpr;
+
+	ConfigurePin(g_APinDescription[phaseA]);
+	ConfigurePin(g_APinDescription[phaseB]);
+	pmc_enable_periph_clk(tcBlockIds[block]);
+	if (hasIndex)
+	{
+		ConfigurePin(g_APinDescription[index]);
+		pmc_enable_periph_clk(tcBlockIds[block] + 1);
+	}
+
+	// Count edges on both phases, i.e. 4 counts per encoder line
+	uint32_t bmr = TC_BMR_QDEN | TC_BMR_POSEN | TC_BMR_EDGPHA;
+	if (filterClocks != 0)
+	{
+		bmr |= TC_BMR_MAXFILT(min<uint32_t>(filterClocks, 64) - 1);
+#ifdef TC_BMR_FILTER
+		bmr |= TC_BMR_FILTER;										// the SAME70 also needs the filter enabled by TC_BMR_FILTER
+#endif
+	}
+	tc->TC_BMR = bmr;
+	tc->TC_QIDR = 0xFFFFFFFF;
+	(void)tc->TC_QISR;
+
+	// Both channels in capture mode, clocked by the decoder, and channel 0 cleared by the index
+	tc->TC_CHANNEL[0].TC_CMR = TC_CMR_TCCLKS_XC0 | TC_CMR_ETRGEDG_RISING | TC_CMR_ABETRG;
+	tc->TC_CHANNEL[0].TC_IDR = 0xFFFFFFFF;
+	tc->TC_CHANNEL[0].TC_CCR = TC_CCR_CLKEN | TC_CCR_SWTRG;
+	if (hasIndex)
+	{
+		tc->TC_CHANNEL[1].TC_CMR = TC_CMR_TCCLKS_XC0 | TC_CMR_ETRGEDG_RISING | TC_CMR_ABETRG;
+		tc->TC_CHANNEL[1].TC_IDR = 0xFFFFFFFF;
+		tc->TC_CHANNEL[1].TC_CCR = TC_CCR_CLKEN | TC_CCR_SWTRG;
+	}
+
+	lastCount = tc->TC_CHANNEL[0].TC_CV;
+	lastRevs = tc->TC_CHANNEL[1].TC_CV;
+	extendedCount = extendedRevs = offset = 0;
+	callbackEvents = pendingEvents = 0;
+
+#if !SAM3XA
+	// Extend the counts from the interrupt, so that they can't wrap round between calls to GetPosition
+	(void)tc->TC_CHANNEL[0].TC_SR;
+	NVIC_ClearPendingIRQ(irqn);
+	if (hasIndex)
+	{
+		tc->TC_QIER = TC_QIER_IDX;
+	}
+	else
+	{
+		ExtendCount();												// this sets RC
+		tc->TC_QIER = TC_QIER_DIRCHG;
+		tc->TC_CHANNEL[0].TC_IER = TC_IER_CPCS;
+	}
+	NVIC_EnableIRQ(irqn);
+#endif
+
+	EnableCycleCounter();
+	velocityCycles = DWT->CYCCNT;
+	velocityPosition = 0;
+	velocity = 0.0;
+	return true;
+}
+
+void QuadratureDecoder::Stop()
+{
+	if (tc != nullptr)
+	{
+		NVIC_DisableIRQ(irqn);
+		tc->TC_QIDR = 0xFFFFFFFF;
+		tc->TC_CHANNEL[0].TC_IDR = 0xFFFFFFFF;
+		tc->TC_CHANNEL[0].TC_CCR = TC_CCR_CLKDIS;
+		tc->TC_CHANNEL[1].TC_CCR = TC_CCR_CLKDIS;
+		tc->TC_BMR = 0;
+		tc = nullptr;
+	}
+	callback = nullptr;
+}
+
+// Read QISR. Reading it clears the events, so keep them for the interrupt handler. The interrupt is already pending if any of them is enabled.
+uint32_t QuadratureDecoder::ReadQisr()
+{
+	const uint32_t qisr = tc->TC_QISR;
+	pendingEvents |= qisr & AllEvents;
+	return qisr;
+}
+
+// Add the change in the count since we last did this to the extended count. Must be called with interrupts disabled.
+// On processors with 16-bit counters, also set RC ahead of the count in the direction of travel, so that the RC compare interrupt
+// calls this again before the count has changed by 32768. A change of direction causes an interrupt too.
+void QuadratureDecoder::ExtendCount()
+{
+	const uint32_t now = tc->TC_CHANNEL[0].TC_CV;
+	extendedCount += (int32_t)(CounterDelta)(now - lastCount);
+	lastCount = now;
+#if !SAM3XA
+	tc->TC_CHANNEL[0].TC_RC = ((ReadQisr() & TC_QISR_DIR) != 0) ? (now - QuarterRange) & 0xFFFF : (now + QuarterRange) & 0xFFFF;
+#endif
+}
+
+// Return the number of revolutions extended to 32 bits. Must be called with interrupts disabled.
+int32_t QuadratureDecoder::GetFullRevolutions() const
+{
+	return extendedRevs + (int32_t)(CounterDelta)(tc->TC_CHANNEL[1].TC_CV - lastRevs);
+}
+
+// Read the hardware count. Must be called with interrupts disabled.
+int32_t QuadratureDecoder::ReadCount() const
+{
+	if (hasIndex)
+	{
+		// Read the revolutions either side of the position, in case an index pulse occurs between them
+		int32_t revs;
+		uint32_t count;
+		do
+		{
+			revs = GetFullRevolutions();
+			count = tc->TC_CHANNEL[0].TC_CV;
+		} while (GetFullRevolutions() != revs);
+		return revs * (int32_t)countsPerRev + (int32_t)(CounterDelta)count;
+	}
+
+	return extendedCount + (int32_t)(CounterDelta)(tc->TC_CHANNEL[0].TC_CV - lastCount);
+}
+
+int32_t QuadratureDecoder::GetPosition()
+{
+	if (tc == nullptr)
+	{
+		return 0;
+	}
+
+	const irqflags_t flags = cpu_irq_save();
+	int32_t count;
+	if (hasIndex)
+	{
+		count = ReadCount();
+	}
+	else
+	{
+		ExtendCount();
+		count = extendedCount;
+	}
+	const int32_t pos = count + offset;
+	cpu_irq_restore(flags);
+	return pos;
+}
+
+void QuadratureDecoder::SetPosition(int32_t pos)
+{
+	if (tc != nullptr)
+	{
+		const irqflags_t flags = cpu_irq_save();
+		const int32_t oldOffset = offset;
+		offset = pos - ReadCount();
+		velocityPosition += offset - oldOffset;						// keep the velocity estimate continuous
+		cpu_irq_restore(flags);
+	}
+}
+
+int32_t QuadratureDecoder::GetRevolutions() const
+{
+	if (tc == nullptr || !hasIndex)
+	{
+		return 0;
+	}
+	const irqflags_t flags = cpu_irq_save();
+	const int32_t revs = GetFullRevolutions();
+	cpu_irq_restore(flags);
+	return revs;
+}
+
+bool QuadratureDecoder::IsReverse()
+{
+	if (tc == nullptr)
+	{
+		return false;
+	}
+	const irqflags_t flags = cpu_irq_save();
+	const uint32_t qisr = ReadQisr();
+	cpu_irq_restore(flags);
+	return (qisr & TC_QISR_DIR) != 0;
+}
+
+float QuadratureDecoder::GetVelocity()
+{
+	const int32_t pos = GetPosition();
+	const uint32_t now = DWT->CYCCNT;
+	const uint32_t elapsed = now - velocityCycles;
+	if (elapsed >= SystemCoreClock/1000)
+	{
+		velocity = (float)(pos - velocityPosition) * (float)SystemCoreClock/(float)elapsed;
+		velocityPosition = pos;
+		velocityCycles = now;
+	}
+	return velocity;
+}
+
+void QuadratureDecoder::SetCallback(EventCallback cb, CallbackParameter param, uint32_t events)
+{
+	if (tc == nullptr)
+	{
+		return;
+	}
+
+	const irqflags_t flags = cpu_irq_save();
+	tc->TC_QIDR = callbackEvents;
+	callback = cb;
+	callbackParam = param;
+	callbackEvents = (cb == nullptr) ? 0 : events & AllEvents;
+	(void)ReadQisr();
+	pendingEvents &= ~callbackEvents;						// discard old events
+	tc->TC_QIER = callbackEvents;
+#if !SAM3XA
+	tc->TC_QIER = (hasIndex) ? TC_QIER_IDX : TC_QIER_DIRCHG;		// the count extension needs these
+#endif
+	cpu_irq_restore(flags);
+	if (callbackEvents != 0)
+	{
+		NVIC_EnableIRQ(irqn);
+	}
+}
+
+void QuadratureDecoder::Interrupt()
+{
+	if (tc != nullptr)
+	{
+		(void)ReadQisr();
+		const uint32_t events = pendingEvents;
+		pendingEvents = 0;
+#if !SAM3XA
+		if (hasIndex)
+		{
+			if ((events & TC_QISR_IDX) != 0)
+			{
+				const uint32_t revs = tc->TC_CHANNEL[1].TC_CV;
+				extendedRevs += (int32_t)(CounterDelta)(revs - lastRevs);
+				lastRevs = revs;
+			}
+		}
+		else if ((tc->TC_CHANNEL[0].TC_SR & TC_SR_CPCS) != 0 || (events & TC_QISR_DIRCHG) != 0)
+		{
+			ExtendCount();
+		}
+#endif
+		if ((events & callbackEvents) != 0 && callback != nullptr)
+		{
+			callback(callbackParam, events & callbackEvents);
+		}
+	}
+}
+
+// End
@@ -0,0 +1,91 @@
+/*
+ * QuadratureDecoder.h
+ *
+ * Reads a quadrature encoder using the hardware decoder in a TC block, so that the CPU does no work per encoder edge.
+ * Channel 0 of the block counts position. If an index signal is used, channel 0 is cleared by each index pulse and channel 1 counts revolutions.
+ * The pins come from the variant pin table: phase A must be TIOA0 and phase B TIOB0 of the block, and the index TIOB1.
+ * A block used for quadrature decoding cannot also be used for PWM by AnalogOut.
+ *
+ * On processors with 16-bit counters the count and the number of revolutions are extended to 32 bits in software. The handler of the
+ * channel 0 interrupt must call Interrupt() so that this is done often enough. Without an index, RC is set a quarter of the counter range
+ * ahead of the count in the direction of travel, and the RC compare and direction change interrupts extend the count. With an index,
+ * each index interrupt extends the number of revolutions.
+ * Core.h does not include this header, because it needs CallbackParameter from WInterrupts.h, which itself includes Core.h.
+ */
+
+#ifndef QUADRATUREDECODER_H_
+#define QUADRATUREDECODER_H_
+
+#include "Core.h"
+#include "WInterrupts.h"
+
+class QuadratureDecoder
+{
+public:
+	typedef void (*EventCallback)(CallbackParameter param, uint32_t events);
+
+	// Events that can be passed to the callback
+	static const uint32_t EventIndex = TC_QISR_IDX;
+	static const uint32_t EventDirectionChange = TC_QISR_DIRCHG;
+	static const uint32_t EventError = TC_QISR_QERR;
+
+	QuadratureDecoder();
+
+	// Set up the TC block that phaseA belongs to as a quadrature decoder and start it. Returns false if the pins are not suitable.
+	// If 'index' is not NoPin, countsPerRev is the number of counts (4 per encoder line) between index pulses. It must be less than 32768
+	// on processors with 16-bit counters. The channel 0 interrupt is enabled in the NVIC, so set its priority before calling this.
+	// filterClocks is the length in peripheral clocks of the shortest pulse accepted on the inputs (1 to 64), or 0 for no glitch filter.
+	bool Init(Pin phaseA, Pin phaseB, Pin index = NoPin, uint32_t countsPerRev = 0, uint32_t filterClocks = 0);
+
+	// Stop the decoder and disable its interrupt
+	void Stop();
+
+	// Return the position in counts
+	int32_t GetPosition();
+
+	// Set the position that GetPosition() returns now
+	void SetPosition(int32_t pos);
+
+	// Return the number of index pulses seen, or 0 if there is no index
+	int32_t GetRevolutions() const;
+
+	// Return true if the last count was in the reverse direction
+	bool IsReverse();
+
+	// Return the velocity in counts per second. The estimate is updated if at least 1ms has passed since it was last updated.
+	float GetVelocity();
+
+	// Set the function called from Interrupt() when any of 'events' occurs, and enable the interrupt for them. A null callback disables the interrupt.
+	void SetCallback(EventCallback cb, CallbackParameter param, uint32_t events);
+
+	// Return the interrupt of the block. Its handler (e.g. TC0_Handler for block 0) must call Interrupt().
+	IRQn_Type GetIRQn() const { return irqn; }
+
+	// Interrupt handling, to be called from the handler of the TC channel 0 interrupt of the block
+	void Interrupt();
+
+private:
+	uint32_t ReadQisr();
+	void ExtendCount();
+	int32_t GetFullRevolutions() const;
+	int32_t ReadCount() const;
+
+	Tc *tc;
+	IRQn_Type irqn;
+	bool hasIndex;
+	uint32_t countsPerRev;
+	uint32_t lastCount;							// counter value when we last extended it, when there is no index
+	int32_t extendedCount;						// counter value extended to 32 bits, when there is no index
+	uint32_t lastRevs;							// revolution counter value when we last extended it, when there is an index
+	int32_t extendedRevs;						// revolution counter value extended to 32 bits, when there is an index
+	int32_t offset;								// added to the count to get the position
+	int32_t velocityPosition;					// position when the velocity was last updated
+	uint32_t velocityCycles;					// cycle counter when the velocity was last updated
+	float velocity;
+	EventCallback callback;
+	CallbackParameter callbackParam;
+	uint32_t callbackEvents;					// the events that the callback wants
+	volatile uint32_t pendingEvents;			// events read from QISR outside the interrupt handler
+};
+
+#endif /* QUADRATUREDECODER_H_ */
@@ -0,0 +1,153 @@
+/*
+ * StepPulseGenerator.cpp
+ */
+
+#include "StepPulseGenerator.h"
+
+// TC blocks and the peripheral ID of channel 0 of each. The IDs of channels 1 and 2 follow it.
+#if SAM4S
+static Tc * const tcBlocks[] = { TC0, TC1 };
+static const uint8_t tcBlockIds[] = { ID_TC0, ID_TC3 };
+#elif SAM3XA || SAM4E
+static Tc * const tcBlocks[] = { TC0, TC1, TC2 };
+static const uint8_t tcBlockIds[] = { ID_TC0, ID_TC3, ID_TC6 };
+#elif SAME70
+static Tc * const tcBlocks[] = { TC0, TC1, TC2, TC3 };
+static const uint8_t tcBlockIds[] = { ID_TC0, ID_TC3, ID_TC6, ID_TC9 };
+#endif
+
+#if SAM3XA
+const uint32_t TcClockSelect = TC_CMR_TCCLKS_TIMER_CLOCK2;		// MCK/8
+#else
+const uint32_t TcClockSelect = TC_CMR_TCCLKS_TIMER_CLOCK3;		// MCK/32
+#endif
+
+StepPulseGenerator::StepPulseGenerator()
+	: tc(nullptr), chan(0), irqn((IRQn_Type)0), dirPin(NoPin), cmr(0), pulseTicks(1), dirSetupTicks(1)
+{
+}
+
+uint32_t StepPulseGenerator::NanosecondsToTicks(uint32_t ns)
+{
+	const uint32_t ticks = (uint32_t)(((uint64_t)ns * GetTickRate() + 999999999u)/1000000000u);		// round up
+	return (ticks == 0) ? 1 : ticks;
+}
+
+bool StepPulseGenerator::Init(Pin stepPin, Pin pDirPin, uint32_t pulseWidthNs, uint32_t dirSetupNs)
+{
+	if (stepPin > MaxPinNumber || (pDirPin != NoPin && pDirPin > MaxPinNumber))
+	{
+		return false;
+	}
+
+	// The step pin must be TIOA of a TC channel
+	const int tcChan = (int)g_APinDescription[stepPin].ulTCChannel;
+	if (tcChan < 0 || (tcChan & 1) != 0 || (size_t)tcChan/6 >= ARRAY_SIZE(tcBlocks))
+	{
+		return false;
+	}
+
+	Stop();
+
+	const size_t block = (size_t)tcChan/6;
+	tc = tcBlocks[block];
+	chan = ((uint32_t)tcChan >> 1) % 3;
+	irqn = (IRQn_Type)(tcBlockIds[block] + chan);
+	dirPin = pDirPin;
+
+	pulseTicks = NanosecondsToTicks(pulseWidthNs);
+	dirSetupTicks = NanosecondsToTicks(dirSetupNs);
+	const uint32_t minInterval = max<uint32_t>(2 * pulseTicks, NanosecondsToTicks(MinIntervalNs));
+	if (minInterval > MaxInterval)
+	{
+		tc = nullptr;
+		return false;
+	}
+	sequencer.SetLimits(minInterval, MaxInterval);
+
+	// Count up to RC. RC compare sets TIOA to start a pulse and RA compare clears it. A software trigger clears TIOA.
+	cmr = TcClockSelect | TC_CMR_WAVE | TC_CMR_WAVSEL_UP_RC | TC_CMR_EEVT_XC0
+			| TC_CMR_ACPC_SET | TC_CMR_ACPA_CLEAR | TC_CMR_ASWTRG_CLEAR;
+
+	pmc_enable_periph_clk(tcBlockIds[block] + chan);
+	tc->TC_CHANNEL[chan].TC_CCR = TC_CCR_CLKDIS;
+	tc->TC_CHANNEL[chan].TC_IDR = 0xFFFFFFFF;
+	tc->TC_CHANNEL[chan].TC_CMR = cmr;
+	tc->TC_CHANNEL[chan].TC_RA = pulseTicks - 1;				// the pulse ends RA + 1 ticks after the RC compare
+	tc->TC_CHANNEL[chan].TC_CCR = TC_CCR_CLKEN | TC_CCR_SWTRG;			// make sure TIOA is low
+	tc->TC_CHANNEL[chan].TC_CCR = TC_CCR_CLKDIS;
+
+	ConfigurePin(g_APinDescription[stepPin]);
+	if (dirPin != NoPin)
+	{
+		pinMode(dirPin, OUTPUT_LOW);
+	}
+	return true;
+}
+
+bool StepPulseGenerator::Start(bool forwards)
+{
+	uint32_t rc;
+	if (tc == nullptr || !sequencer.Begin(dirSetupTicks, rc))
+	{
+		return false;
+	}
+
+	if (dirPin != NoPin)
+	{
+		digitalWrite(dirPin, forwards);
+	}
+
+	TcChannel& ch = tc->TC_CHANNEL[chan];
+	ch.TC_CMR = cmr;
+	ch.TC_RC = rc;
+	(void)ch.TC_SR;
+	NVIC_ClearPendingIRQ(irqn);
+	ch.TC_IER = TC_IER_CPCS;
+	NVIC_EnableIRQ(irqn);
+	ch.TC_CCR = TC_CCR_CLKEN | TC_CCR_SWTRG;
+	return true;
+}
+
+void StepPulseGenerator::Stop()
+{
+	if (tc != nullptr)
+	{
+		TcChannel& ch = tc->TC_CHANNEL[chan];
+		ch.TC_IDR = 0xFFFFFFFF;
+		NVIC_DisableIRQ(irqn);
+		ch.TC_CMR = cmr;
+		ch.TC_CCR = TC_CCR_CLKEN | TC_CCR_SWTRG;			// end any pulse in progress
+		ch.TC_CCR = TC_CCR_CLKDIS;
+	}
+	sequencer.Reset();
+}
+
+void StepPulseGenerator::Interrupt()
+{
+	TcChannel& ch = tc->TC_CHANNEL[chan];
+	if ((ch.TC_SR & TC_SR_CPCS) == 0)
+	{
+		return;
+	}
+
+	uint32_t rc;
+	switch (sequencer.OnCompare(rc))
+	{
+	case StepSequencer::Action::reload:
+		ch.TC_RC = rc;
+		break;
+
+	case StepSequencer::Action::finish:
+		// Let this pulse finish, then stop the clock at the next RC compare without starting another pulse
+		ch.TC_CMR = (cmr & ~TC_CMR_ACPC_Msk) | TC_CMR_CPCDIS;
+		break;
+
+	case StepSequencer::Action::stopped:
+		ch.TC_IDR = TC_IDR_CPCS;
+		ch.TC_CMR = cmr;
+		break;
+	}
+}
+
+// End
@@ -0,0 +1,78 @@
+/*
+ * StepPulseGenerator.h
+ *
+ * Generates step pulses on the TIOA output of a TC channel in waveform mode. The counter restarts at each RC compare, which sets TIOA,
+ * and the RA compare clears it again, so both the pulse width and the interval between pulses are timed by the hardware.
+ *
+ * The intervals come from a queue. None of the supported processors can trigger a DMA transfer to the TC compare registers,
+ * so the RC compare interrupt moves the next interval from the queue into RC. That is all the handler does, and its latency
+ * does not affect the timing provided that it runs before the counter reaches the new RC value.
+ * The decisions the handler makes are in StepSequencer, which doesn't depend on the hardware.
+ */
+
+#ifndef STEPPULSEGENERATOR_H_
+#define STEPPULSEGENERATOR_H_
+
+#include "Core.h"
+#include "StepSequencer.h"
+
+class StepPulseGenerator
+{
+public:
+	StepPulseGenerator();
+
+	// Set up the generator. stepPin must be the TIOA pin of a TC channel in the pin table. dirPin is a plain output, or NoPin.
+	// pulseWidthNs is the width of each step pulse and dirSetupNs the minimum time from setting the direction to the first step.
+	bool Init(Pin stepPin, Pin dirPin, uint32_t pulseWidthNs, uint32_t dirSetupNs);
+
+	// Return the rate at which the counter counts, i.e. the number of interval ticks per second
+	static uint32_t GetTickRate() { return SystemPeripheralClock()/TickDivisor; }
+
+	// Queue the interval in ticks from the previous step to the next one. Returns false if the queue is full.
+	// Intervals shorter than the minimum are lengthened, and on processors with 16-bit counters intervals are limited to 65535 ticks.
+	bool AddInterval(uint32_t ticks) { return sequencer.AddInterval(ticks); }
+
+	// Return the number of intervals that can be added without blocking
+	size_t GetSpace() const { return sequencer.GetSpace(); }
+
+	// Set the direction and start stepping. The first step is delayed by at least the direction setup time.
+	// Stepping stops after the last queued interval. Returns false if already running or nothing is queued.
+	bool Start(bool forwards);
+
+	// Stop stepping immediately and discard the queued intervals
+	void Stop();
+
+	bool IsRunning() const { return sequencer.IsRunning(); }
+
+	// Return the number of step pulses generated since Start() was last called
+	uint32_t GetStepsDone() const { return sequencer.GetStepsDone(); }
+
+	// Return the interrupt of the TC channel. Its handler (e.g. TC0_Handler) must call Interrupt().
+	IRQn_Type GetIRQn() const { return irqn; }
+
+	// Interrupt handling, to be called from the handler of the TC channel interrupt
+	void Interrupt();
+
+private:
+#if SAM3XA
+	static const uint32_t MaxInterval = 0xFFFFFFFF;
+	static const uint32_t TickDivisor = 8;
+#else
+	static const uint32_t MaxInterval = 0xFFFF;
+	static const uint32_t TickDivisor = 32;			// to allow longer intervals with the 16-bit counters
+#endif
+	static const uint32_t MinIntervalNs = 2000;		// minimum time between steps, so that the interrupt can reload RC in time
+
+	static uint32_t NanosecondsToTicks(uint32_t ns);
+
+	StepSequencer sequencer;
+	Tc *tc;
+	uint32_t chan;
+	IRQn_Type irqn;
+	Pin dirPin;
+	uint32_t cmr;									// channel mode when stepping
+	uint32_t pulseTicks;
+	uint32_t dirSetupTicks;
+};
+
+#endif /* STEPPULSEGENERATOR_H_ */
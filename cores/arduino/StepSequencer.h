@@ -0,0 +1,142 @@
+/*
+ * StepSequencer.h
+ *
+ * The part of StepPulseGenerator that doesn't touch the hardware: the queue of step intervals, and the decisions that the RC compare
+ * interrupt makes about refilling RC and stopping. Keeping them apart from the TC registers means they can be tested on a host
+ * against a simulated timer.
+ *
+ * This header uses __DMB() but doesn't include the CMSIS headers, so include Core.h (or a host stub that defines __DMB) first.
+ */
+
+#ifndef STEPSEQUENCER_H_
+#define STEPSEQUENCER_H_
+
+#include <cstdint>
+#include <cstddef>
+
+// Queue of step intervals, written by one task and read by one interrupt handler
+class StepIntervalQueue
+{
+public:
+	static const size_t Size = 64;					// must be a power of 2
+
+	StepIntervalQueue() : putIndex(0), getIndex(0) { }
+
+	void Clear() { getIndex = putIndex; }
+	size_t Count() const { return (putIndex - getIndex) & (Size - 1); }
+	size_t Space() const { return Size - 1 - Count(); }
+
+	// Add an interval, returning false if the queue is full. Called by the producer only.
+	bool Put(uint32_t interval)
+	{
+		const size_t next = (putIndex + 1) & (Size - 1);
+		if (next == getIndex)
+		{
+			return false;
+		}
+		intervals[putIndex] = interval;
+		__DMB();									// the interval must be visible before the consumer sees the new putIndex
+		putIndex = next;
+		return true;
+	}
+
+	// Remove the next interval, returning false if the queue is empty. Called by the consumer only.
+	bool Get(uint32_t& interval)
+	{
+		const size_t gi = getIndex;
+		if (gi == putIndex)
+		{
+			return false;
+		}
+		interval = intervals[gi];
+		getIndex = (gi + 1) & (Size - 1);
+		return true;
+	}
+
+private:
+	uint32_t intervals[Size];
+	volatile size_t putIndex;
+	volatile size_t getIndex;
+};
+
+// Decides what the RC compare interrupt of a waveform mode TC channel with WAVSEL_UP_RC must do.
+// In that mode the counter counts from 0 to RC and then back to 0, so the period is RC + 1 ticks. After a software trigger the counter
+// is reset at the next clock edge, so the first period is RC + 1 ticks as well.
+class StepSequencer
+{
+public:
+	enum class Action : uint8_t
+	{
+		reload,										// load the value returned in 'rc' into RC
+		finish,										// there are no more steps: let the pulse that has just started finish, then stop the clock
+		stopped										// the clock has stopped
+	};
+
+	StepSequencer() : minInterval(2), maxInterval(0xFFFF), stepsDone(0), state(State::idle) { }
+
+	// Set the shortest and longest intervals in ticks. Intervals outside this range are limited to it.
+	void SetLimits(uint32_t minTicks, uint32_t maxTicks) { minInterval = minTicks; maxInterval = maxTicks; }
+
+	bool AddInterval(uint32_t ticks) { return queue.Put(ticks); }
+	size_t GetSpace() const { return queue.Space(); }
+	bool IsRunning() const { return state != State::idle; }
+	uint32_t GetStepsDone() const { return stepsDone; }
+
+	// Return the RC value that gives a period of 'ticks'
+	uint32_t IntervalToRc(uint32_t ticks) const
+	{
+		return ((ticks < minInterval) ? minInterval : (ticks > maxInterval) ? maxInterval : ticks) - 1;
+	}
+
+	// Start a sequence. Returns false if it is already running or nothing is queued. Otherwise sets 'rc' for the first interval,
+	// which is lengthened to 'minFirstTicks' if necessary.
+	bool Begin(uint32_t minFirstTicks, uint32_t& rc)
+	{
+		uint32_t first;
+		if (state != State::idle || !queue.Get(first))
+		{
+			return false;
+		}
+		stepsDone = 0;
+		state = State::running;
+		rc = IntervalToRc((first < minFirstTicks) ? minFirstTicks : first);
+		return true;
+	}
+
+	// Handle an RC compare. A step pulse starts at each RC compare while running.
+	Action OnCompare(uint32_t& rc)
+	{
+		if (state == State::running)
+		{
+			++stepsDone;
+			uint32_t next;
+			if (queue.Get(next))
+			{
+				rc = IntervalToRc(next);
+				return Action::reload;
+			}
+			state = State::stopping;
+			return Action::finish;
+		}
+		state = State::idle;
+		return Action::stopped;
+	}
+
+	// Stop immediately and discard the queued intervals
+	void Reset()
+	{
+		queue.Clear();
+		state = State::idle;
+	}
+
+private:
+	enum class State : uint8_t { idle, running, stopping };
+
+	StepIntervalQueue queue;
+	uint32_t minInterval;
+	uint32_t maxInterval;
+	volatile uint32_t stepsDone;
+	volatile State state;
+};
+
+#endif /* STEPSEQUENCER_H_ */
@@ -0,0 +1,63 @@
+/*
+ * TickLatch.h
+ *
+ * A 64-bit count with one writer, which may be an interrupt, and any number of readers, none of which has to disable interrupts.
+ * There are two copies of the count, and 'seq' selects the current one. The writer writes the new count to the other copy and then
+ * switches to it, so a reader never sees a half-written value. A reader that preempts the writer part way through just reads the
+ * old copy, so it never waits. This is what millis() and millis64() use. It doesn't touch the hardware, so it is tested on a host.
+ *
+ * This header uses __DMB() but doesn't include the CMSIS headers, so include Core.h (or a host stub that defines __DMB) first.
+ */
+
+#ifndef TICKLATCH_H_
+#define TICKLATCH_H_
+
+#include <stdint.h>
+
+typedef struct TickLatch
+{
+	volatile uint64_t count[2];
+	volatile uint32_t seq;
+} TickLatch;
+
+// Add one to the count. Only one context may call this.
+static inline void TickLatchIncrement(TickLatch *latch)
+{
+	const uint32_t seq = latch->seq;
+	latch->count[(seq + 1) & 1] = latch->count[seq & 1] + 1;
+	__DMB();
+	latch->seq = seq + 1;
+}
+
+// Read the low 32 bits of the count. This must check for an update too: if the writer runs twice between our reading 'seq'
+// and reading the count, the copy we read holds a count that hasn't been published yet, so the next read could go backwards.
+static inline uint32_t TickLatchReadLow(const TickLatch *latch)
+{
+	uint32_t seq;
+	uint32_t ret;
+	do
+	{
+		seq = latch->seq;
+		__DMB();
+		ret = (uint32_t)latch->count[seq & 1];
+		__DMB();
+	} while (latch->seq != seq);
+	return ret;
+}
+
+// Read the whole count
+static inline uint64_t TickLatchRead(const TickLatch *latch)
+{
+	uint32_t seq;
+	uint64_t ret;
+	do
+	{
+		seq = latch->seq;
+		__DMB();
+		ret = latch->count[seq & 1];
+		__DMB();
+	} while (latch->seq != seq);					// if the writer ran while we were reading, the copy we read may have been overwritten
+	return ret;
+}
+
+#endif /* TICKLATCH_H_ */
@@ -20,27 +20,76 @@
 
 const uint32_t pioInterruptPriority = 5;
 
+// Maximum number of callbacks that can be attached to all pins together
+const size_t MaxPioInterruptCallbacks = 48;
+
+// The PIO controllers are at evenly spaced addresses, so we can find the number of a port from its address and vice versa
+#if defined(ID_PIOE)
+const unsigned int NumPioPorts = 5;
+#elif defined(ID_PIOD)
+const unsigned int NumPioPorts = 4;
+#else
+const unsigned int NumPioPorts = 3;
+#endif
+
+const uint32_t PioSpacing = 0x200;
+
+static inline Pio *GetPio(unsigned int port)
+{
+	return reinterpret_cast<Pio*>(reinterpret_cast<uint32_t>(PIOA) + port * PioSpacing);
+}
+
+static inline unsigned int GetPortNumber(const Pio *pio)
+{
+	return (reinterpret_cast<uint32_t>(pio) - reinterpret_cast<uint32_t>(PIOA))/PioSpacing;
+}
+
 struct InterruptCallback
 {
 	StandardCallbackFunction func;
 	CallbackParameter param;
+	InterruptCallback *next;
+	InterruptCallback *nextDeferred;			// link in the deferred free list
+	uint8_t priority;
 
-	InterruptCallback() : func(nullptr) { }
+	InterruptCallback() : func(nullptr), next(nullptr), nextDeferred(nullptr), priority(0) { }
 };
 
-static InterruptCallback callbacksPioA[32];
-static InterruptCallback callbacksPioB[32];
-static InterruptCallback callbacksPioC[32];
-#ifdef ID_PIOD
-static InterruptCallback callbacksPioD[32];
-#endif
-#ifdef ID_PIOE
-static InterruptCallback callbacksPioE[32];
-#endif
+// For each pin, a list of callbacks in order of priority
+static InterruptCallback *pinCallbacks[NumPioPorts][32];
+
+static InterruptCallback callbackPool[MaxPioInterruptCallbacks];
+static InterruptCallback *freeCallbacks = nullptr;
+
+// Callbacks removed while a handler may be walking the lists. They keep their 'next' links so that the walk can continue,
+// and are only returned to the free list when no handler is dispatching. The pool and these lists are changed with interrupts disabled.
+static InterruptCallback *deferredCallbacks = nullptr;
+static volatile uint32_t dispatchDepth = 0;
+
+// Edge capture. Each port has a ring of events written by its interrupt handler and read by ReadEdgeEvents.
+const size_t EdgeEventRingSize = 32;						// must be a power of 2
+
+struct EdgeEventRing
+{
+	EdgeEvent events[EdgeEventRingSize];
+	volatile uint32_t putIndex;								// written only by the interrupt handler
+	volatile uint32_t getIndex;								// written only by ReadEdgeEvents
+};
+
+static uint32_t captureMask[NumPioPorts];					// pins in each port whose edges are captured
+static uint16_t capturePins[NumPioPorts][32];				// logical pin numbers of those pins
+static EdgeEventRing edgeEventRings[NumPioPorts];
+static volatile uint32_t edgeEventsLost = 0;
 
 /* Configure PIO interrupt sources */
 static void __initialize()
 {
+	for (size_t i = 0; i < MaxPioInterruptCallbacks; ++i)
+	{
+		callbackPool[i].next = freeCallbacks;
+		freeCallbacks = &callbackPool[i];
+	}
+
 	pmc_enable_periph_clk(ID_PIOA);
 	NVIC_DisableIRQ(PIOA_IRQn);
 	NVIC_ClearPendingIRQ(PIOA_IRQn);
@@ -71,36 +120,18 @@ static void __initialize()
 #endif
 }
 
-// Get the number of the highest bit that is set in a 32-bit word. Returns 0 if no bit set (same as if lowest bit is set).
-// This needs to be fast. Hopefully the ARM conditional instructions will be used to advantage here.
-static unsigned int GetHighestBit(uint32_t bits)
+// Get the number of the highest bit that is set in a 32-bit word. The word must not be zero.
+static inline unsigned int GetHighestBit(uint32_t bits)
 {
-	unsigned int bitNum = (bits >= 0x00010000) ? 16 : 0;
-	if ((bits >> bitNum) >= 0x0100u)
-	{
-		bitNum += 8;
-	}
-	if ((bits >> bitNum) >= 0x0010u)
-	{
-		bitNum += 4;
-	}
-	if ((bits >> bitNum) >= 0x0004u)
-	{
-		bitNum += 2;
-	}
-	if ((bits >> bitNum) >= 0x0002u)
-	{
-		bitNum += 1;
-	}
-	return bitNum;
+	return 31 - __CLZ(bits);
 }
 
-// Attach an interrupt to the specified pin returning true if successful
-bool attachInterrupt(uint32_t pin, StandardCallbackFunction callback, enum InterruptMode mode, CallbackParameter param)
+// Return the list head for a pin and its mask, or nullptr if it is not a valid pin
+static InterruptCallback **GetCallbackList(uint32_t pin, Pio *&pio, uint32_t& mask)
 {
 	if (pin > MaxPinNumber)
 	{
-		return false;
+		return nullptr;
 	}
 
 	static bool enabled = false;
@@ -110,43 +141,19 @@ bool attachInterrupt(uint32_t pin, StandardCallbackFunction callback, enum Inter
 		enabled = true;
 	}
 
-	// Retrieve pin information
-	Pio * const pio = g_APinDescription[pin].pPort;
-	const uint32_t mask = g_APinDescription[pin].ulPin;
-	pio->PIO_IDR = mask;			// ensure the interrupt is disabled before we start changing the tables
-	const uint32_t pos = GetHighestBit(mask);
-
-	// Set callback function and parameter
-	if (pio == PIOA)
-	{
-		callbacksPioA[pos].func = callback;
-		callbacksPioA[pos].param = param;
-	}
-	else if (pio == PIOB)
-	{
-		callbacksPioB[pos].func = callback;
-		callbacksPioB[pos].param = param;
-	}
-	else if (pio == PIOC)
+	pio = g_APinDescription[pin].pPort;
+	mask = g_APinDescription[pin].ulPin;
+	const unsigned int port = GetPortNumber(pio);
+	if (mask == 0 || port >= NumPioPorts || GetPio(port) != pio)
 	{
-		callbacksPioC[pos].func = callback;
-		callbacksPioC[pos].param = param;
+		return nullptr;
 	}
-#ifdef ID_PIOD
-	else if (pio == PIOD)
-	{
-		callbacksPioD[pos].func = callback;
-		callbacksPioD[pos].param = param;
-	}
-#endif
-#ifdef ID_PIOE
-	else if (pio == PIOE)
-	{
-		callbacksPioE[pos].func = callback;
-		callbacksPioE[pos].param = param;
-	}
-#endif
+	return &pinCallbacks[port][GetHighestBit(mask)];
+}
 
+// Set the interrupt mode of a pin. Enables the interrupt unless the mode is INTERRUPT_MODE_NONE.
+static void SetInterruptMode(Pio *pio, uint32_t mask, enum InterruptMode mode)
+{
 	// Configure the interrupt mode
 	if (mode == INTERRUPT_MODE_CHANGE)
 	{
@@ -192,71 +199,373 @@ bool attachInterrupt(uint32_t pin, StandardCallbackFunction callback, enum Inter
 		pio->PIO_IFER = mask;		// enable glitch filter on this pin
 		pio->PIO_IER = mask;		// enable interrupt on this pin
 	}
+}
+
+// Re-enable the interrupt of a pin after changing its callbacks, if it is still needed
+static void ReenableInterrupt(Pio *pio, uint32_t mask, InterruptCallback * const *list)
+{
+	if (*list != nullptr || (captureMask[GetPortNumber(pio)] & mask) != 0)
+	{
+		pio->PIO_IER = mask;
+	}
+}
+
+// Return a callback that has been unlinked from its list to the pool. Must be called with interrupts disabled.
+static void ReleaseCallback(InterruptCallback *cb)
+{
+	cb->func = nullptr;
+	if (dispatchDepth != 0)
+	{
+		cb->nextDeferred = deferredCallbacks;			// a handler may still be looking at it
+		deferredCallbacks = cb;
+	}
+	else
+	{
+		cb->next = freeCallbacks;
+		freeCallbacks = cb;
+	}
+}
+
+// Return all the callbacks in a list to the pool. The interrupt for the pin must be disabled.
+static void FreeCallbacks(InterruptCallback **list)
+{
+	const irqflags_t flags = cpu_irq_save();
+	while (*list != nullptr)
+	{
+		InterruptCallback * const cb = *list;
+		*list = cb->next;
+		ReleaseCallback(cb);
+	}
+	cpu_irq_restore(flags);
+}
+
+// Attach an interrupt to the specified pin, replacing any callbacks already attached to it, returning true if successful
+bool attachInterrupt(uint32_t pin, StandardCallbackFunction callback, enum InterruptMode mode, CallbackParameter param)
+{
+	Pio *pio;
+	uint32_t mask;
+	InterruptCallback ** const list = GetCallbackList(pin, pio, mask);
+	if (list == nullptr)
+	{
+		return false;
+	}
+
+	pio->PIO_IDR = mask;			// ensure the interrupt is disabled before we start changing the tables
+	FreeCallbacks(list);
+	if (callback == nullptr)
+	{
+		ReenableInterrupt(pio, mask, list);
+		return true;
+	}
+	return attachInterrupt(pin, callback, mode, param, 0);
+}
+
+// Add a callback to the specified pin, keeping any that are already attached, returning true if successful
+bool attachInterrupt(uint32_t pin, StandardCallbackFunction callback, enum InterruptMode mode, CallbackParameter param, uint8_t priority)
+{
+	Pio *pio;
+	uint32_t mask;
+	InterruptCallback ** const list = GetCallbackList(pin, pio, mask);
+	if (list == nullptr || callback == nullptr)
+	{
+		return false;
+	}
+
+	pio->PIO_IDR = mask;			// ensure the interrupt is disabled before we start changing the tables
+	const irqflags_t flags = cpu_irq_save();
+	InterruptCallback * const cb = freeCallbacks;
+	if (cb != nullptr)
+	{
+		freeCallbacks = cb->next;
+	}
+	cpu_irq_restore(flags);
+	if (cb == nullptr)
+	{
+		ReenableInterrupt(pio, mask, list);		// leave the existing callbacks working
+		return false;
+	}
+	cb->func = callback;
+	cb->param = param;
+	cb->priority = priority;
 
+	// Insert it after any callbacks with the same or a numerically lower priority
+	InterruptCallback **pp = list;
+	while (*pp != nullptr && (*pp)->priority <= priority)
+	{
+		pp = &(*pp)->next;
+	}
+	cb->next = *pp;
+	*pp = cb;
+
+	SetInterruptMode(pio, mask, mode);
 	return true;
 }
 
-void detachInterrupt(uint32_t pin)
+// Remove one callback from the specified pin, returning true if it was found
+bool detachInterrupt(uint32_t pin, StandardCallbackFunction callback, CallbackParameter param)
 {
-	if (pin <= MaxPinNumber)
+	Pio *pio;
+	uint32_t mask;
+	InterruptCallback ** const list = GetCallbackList(pin, pio, mask);
+	if (list == nullptr)
+	{
+		return false;
+	}
+
+	const bool wasEnabled = (pio->PIO_IMR & mask) != 0;
+	pio->PIO_IDR = mask;
+	bool found = false;
+	for (InterruptCallback **pp = list; *pp != nullptr; pp = &(*pp)->next)
 	{
-		// Retrieve pin information
-		Pio * const pio = g_APinDescription[pin].pPort;
-		const uint32_t mask = g_APinDescription[pin].ulPin;
+		InterruptCallback * const cb = *pp;
+		if (cb->func == callback && cb->param.u32 == param.u32)
+		{
+			*pp = cb->next;
+			const irqflags_t flags = cpu_irq_save();
+			ReleaseCallback(cb);
+			cpu_irq_restore(flags);
+			found = true;
+			break;
+		}
+	}
+	if (wasEnabled)
+	{
+		ReenableInterrupt(pio, mask, list);
+	}
+	return found;
+}
 
+void detachInterrupt(uint32_t pin)
+{
+	Pio *pio;
+	uint32_t mask;
+	InterruptCallback ** const list = GetCallbackList(pin, pio, mask);
+	if (list != nullptr)
+	{
 		// Disable interrupt
 		pio->PIO_IDR = mask;
+		FreeCallbacks(list);
+		captureMask[GetPortNumber(pio)] &= ~mask;
 	}
 }
 
+bool attachEdgeCapture(uint32_t pin, enum InterruptMode mode)
+{
+	Pio *pio;
+	uint32_t mask;
+	if (GetCallbackList(pin, pio, mask) == nullptr || mode == INTERRUPT_MODE_NONE)
+	{
+		return false;
+	}
+
+	EnableCycleCounter();
+	const unsigned int port = GetPortNumber(pio);
+	pio->PIO_IDR = mask;
+	capturePins[port][GetHighestBit(mask)] = (uint16_t)pin;
+	captureMask[port] |= mask;
+	SetInterruptMode(pio, mask, mode);
+	return true;
+}
+
+void detachEdgeCapture(uint32_t pin)
+{
+	Pio *pio;
+	uint32_t mask;
+	InterruptCallback ** const list = GetCallbackList(pin, pio, mask);
+	if (list != nullptr)
+	{
+		pio->PIO_IDR = mask;
+		captureMask[GetPortNumber(pio)] &= ~mask;
+		ReenableInterrupt(pio, mask, list);
+	}
+}
+
+size_t ReadEdgeEvents(EdgeEvent *events, size_t maxEvents)
+{
+	size_t numRead = 0;
+	for (unsigned int port = 0; port < NumPioPorts; ++port)
+	{
+		EdgeEventRing& ring = edgeEventRings[port];
+		uint32_t getIndex = ring.getIndex;
+		const uint32_t putIndex = ring.putIndex;
+		__DMB();											// read the indices before the events
+		while (getIndex != putIndex && numRead < maxEvents)
+		{
+			events[numRead++] = ring.events[getIndex % EdgeEventRingSize];
+			++getIndex;
+		}
+		__DMB();											// finish reading the events before releasing their slots
+		ring.getIndex = getIndex;
+	}
+	return numRead;
+}
+
+uint32_t GetEdgeEventsLost(bool clear)
+{
+	const irqflags_t flags = cpu_irq_save();
+	const uint32_t ret = edgeEventsLost;
+	if (clear)
+	{
+		edgeEventsLost = 0;
+	}
+	cpu_irq_restore(flags);
+	return ret;
+}
+
 // Return true if we are in any interrupt service routine
 bool inInterrupt()
 {
 	return (__get_IPSR() & 0x01FF) != 0;
 }
 
-// Common PIO interrupt handler
-void CommonPioHandler(Pio *pio, const InterruptCallback callbacks[])
+// Return the callbacks that were removed during dispatch to the free list
+static void ReleaseDeferredCallbacks()
+{
+	const irqflags_t flags = cpu_irq_save();
+	if (dispatchDepth == 0)
+	{
+		while (deferredCallbacks != nullptr)
+		{
+			InterruptCallback * const cb = deferredCallbacks;
+			deferredCallbacks = cb->nextDeferred;
+			cb->next = freeCallbacks;
+			freeCallbacks = cb;
+		}
+	}
+	cpu_irq_restore(flags);
+}
+
+// Call the callbacks for the pins whose bits are set in 'pending', highest numbered pin first.
+// A callback may attach or detach callbacks, including itself. Removed callbacks have a null function and are skipped,
+// and they are not reused until dispatch has finished, so their 'next' links stay valid.
+static inline void DispatchPioInterrupts(InterruptCallback * const callbacks[], uint32_t pending) __attribute__((always_inline));
+static inline void DispatchPioInterrupts(InterruptCallback * const callbacks[], uint32_t pending)
+{
+	dispatchDepth = dispatchDepth + 1;						// a nested handler always restores this before we resume
+	while (pending != 0)
+	{
+		const unsigned int pos = GetHighestBit(pending);
+		pending &= ~(1u << pos);
+		for (const InterruptCallback *cb = callbacks[pos]; cb != nullptr; cb = cb->next)
+		{
+			const StandardCallbackFunction func = cb->func;
+			if (func != nullptr)
+			{
+				func(cb->param);
+			}
+		}
+	}
+	dispatchDepth = dispatchDepth - 1;
+	if (deferredCallbacks != nullptr)
+	{
+		ReleaseDeferredCallbacks();
+	}
+}
+
+// Record the edges of the pins whose bits are set in 'captured'
+static void RecordEdgeEvents(unsigned int port, uint32_t captured, uint32_t levels, uint32_t cycles)
 {
-	uint32_t isr = pio->PIO_ISR & pio->PIO_IMR;
-	while (isr != 0)
+	EdgeEventRing& ring = edgeEventRings[port];
+	uint32_t putIndex = ring.putIndex;
+	const uint32_t getIndex = ring.getIndex;
+	do
 	{
-		const unsigned int pos = GetHighestBit(isr);
-		if (callbacks[pos].func != nullptr)
+		const unsigned int pos = GetHighestBit(captured);
+		captured &= ~(1u << pos);
+		if (putIndex - getIndex >= EdgeEventRingSize)
+		{
+			edgeEventsLost = edgeEventsLost + 1;
+		}
+		else
 		{
-			callbacks[pos].func(callbacks[pos].param);
+			EdgeEvent& ev = ring.events[putIndex % EdgeEventRingSize];
+			ev.cycles = cycles;
+			ev.pin = capturePins[port][pos];
+			ev.level = (levels & (1u << pos)) != 0;
+			++putIndex;
 		}
-		isr &= ~(1u << pos);
+	} while (captured != 0);
+	__DMB();												// write the events before publishing them
+	ring.putIndex = putIndex;
+}
+
+// Common PIO interrupt handler. Each port gets its own instance, so the port address and table are constants.
+template<unsigned int port> static inline void CommonPioHandler()
+{
+	const uint32_t cycles = DWT->CYCCNT;					// read this first, to timestamp captured edges as early as possible
+	Pio * const pio = GetPio(port);
+	const uint32_t levels = pio->PIO_PDSR;
+	const uint32_t pending = pio->PIO_ISR & pio->PIO_IMR;
+	const uint32_t captured = pending & captureMask[port];
+	if (captured != 0)
+	{
+		RecordEdgeEvents(port, captured, levels, cycles);
 	}
+	DispatchPioInterrupts(pinCallbacks[port], pending);
 }
 
 extern "C" void PIOA_Handler(void)
 {
-	CommonPioHandler(PIOA, callbacksPioA);
+	CommonPioHandler<0>();
 }
 
 extern "C" void PIOB_Handler(void)
 {
-	CommonPioHandler(PIOB, callbacksPioB);
+	CommonPioHandler<1>();
 }
 
 extern "C" void PIOC_Handler(void)
 {
-	CommonPioHandler(PIOC, callbacksPioC);
+	CommonPioHandler<2>();
 }
 
 #ifdef ID_PIOD
 extern "C" void PIOD_Handler(void)
 {
-	CommonPioHandler(PIOD, callbacksPioD);
+	CommonPioHandler<3>();
 }
 #endif
 
 #ifdef ID_PIOE
 extern "C" void PIOE_Handler(void)
 {
-	CommonPioHandler(PIOE, callbacksPioE);
+	CommonPioHandler<4>();
 }
 #endif
 
+static void DummyCallback(CallbackParameter) { }
+
+// Measure the number of CPU cycles taken by the dispatch loop to call an empty callback for each of 'numPending' pending pins.
+// This excludes interrupt entry and exit and reading the PIO registers. It uses its own tables, so it doesn't disturb attached interrupts.
+uint32_t MeasurePioDispatchCycles(unsigned int numPending)
+{
+	if (numPending > 32)
+	{
+		numPending = 32;
+	}
+
+	InterruptCallback cb;
+	cb.func = DummyCallback;
+	InterruptCallback *callbacks[32];
+	for (size_t i = 0; i < 32; ++i)
+	{
+		callbacks[i] = &cb;
+	}
+
+	// Spread the pending pins over the word
+	uint32_t pending = 0;
+	for (unsigned int i = 0; i < numPending; ++i)
+	{
+		pending |= 1u << ((i * 32)/numPending);
+	}
+
+	EnableCycleCounter();
+	const irqflags_t flags = cpu_irq_save();
+	const uint32_t startCycles = DWT->CYCCNT;
+	DispatchPioInterrupts(callbacks, pending);
+	const uint32_t cycles = DWT->CYCCNT - startCycles;
+	cpu_irq_restore(flags);
+	return cycles;
+}
+
 // End
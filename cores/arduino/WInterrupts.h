@@ -35,10 +35,44 @@ union CallbackParameter
 
 typedef void (*StandardCallbackFunction)(CallbackParameter);
 
+// Attach an interrupt to a pin, replacing any callbacks that are already attached to it. If callback is null, the callbacks are removed.
 bool attachInterrupt(uint32_t pin, StandardCallbackFunction callback, enum InterruptMode mode, CallbackParameter param);
 
+// Add a callback to a pin, keeping those already attached. When the interrupt occurs, the callbacks are called in order of priority, lowest value first.
+// All the callbacks on a pin share the same mode, which is the one most recently set.
+bool attachInterrupt(uint32_t pin, StandardCallbackFunction callback, enum InterruptMode mode, CallbackParameter param, uint8_t priority);
+
+// Remove all the callbacks from a pin and disable its interrupt
 void detachInterrupt(uint32_t pin);
 
+// Remove one callback from a pin. The interrupt is disabled when no callbacks remain.
+bool detachInterrupt(uint32_t pin, StandardCallbackFunction callback, CallbackParameter param);
+
+// Edge capture. Instead of (or as well as) calling callbacks, the interrupt handler records the time and level of each edge on the pins in capture mode.
+// The time is the DWT cycle count at entry to the handler. Each port has its own event buffer; if it is full, new events are lost.
+struct EdgeEvent
+{
+	uint32_t cycles;				// DWT cycle count when the interrupt was taken
+	uint16_t pin;					// logical pin number
+	bool level;						// pin level read at the same time
+};
+
+// Put a pin in capture mode, keeping any callbacks attached to it. The mode must not be INTERRUPT_MODE_NONE.
+bool attachEdgeCapture(uint32_t pin, enum InterruptMode mode);
+
+// Take a pin out of capture mode. Its interrupt is disabled if it has no callbacks.
+void detachEdgeCapture(uint32_t pin);
+
+// Copy up to maxEvents captured events and remove them from the buffers, returning the number copied.
+// Events from each port are in order, but events from different ports are not interleaved by time. Must be called by only one task.
+size_t ReadEdgeEvents(EdgeEvent *events, size_t maxEvents);
+
+// Return the number of events lost because a buffer was full
+uint32_t GetEdgeEventsLost(bool clear);
+
+// Measure the CPU cycles taken to dispatch 'numPending' simultaneously pending pin interrupts to empty callbacks, for benchmarking
+uint32_t MeasurePioDispatchCycles(unsigned int numPending);
+
 // Return true if we are in an interrupt service routine
 bool inInterrupt();
 
@@ -0,0 +1,78 @@
+/*
+ * XdmacInterrupts.cpp
+ */
+
+#include "XdmacInterrupts.h"
+
+#if SAME70
+
+const uint32_t xdmacInterruptPriority = 5;
+
+struct XdmacChannelCallback
+{
+	XdmacChannelHandler handler;
+	CallbackParameter param;
+};
+
+static XdmacChannelCallback channelCallbacks[XDMACCHID_NUMBER];
+static bool xdmacInterruptEnabled = false;
+
+bool XdmacAttachHandler(uint32_t channel, XdmacChannelHandler handler, CallbackParameter param)
+{
+	if (channel >= XDMACCHID_NUMBER)
+	{
+		return false;
+	}
+
+	const irqflags_t flags = cpu_irq_save();
+	channelCallbacks[channel].handler = handler;
+	channelCallbacks[channel].param = param;
+	cpu_irq_restore(flags);
+
+	if (!xdmacInterruptEnabled)
+	{
+		pmc_enable_periph_clk(ID_XDMAC);
+		NVIC_SetPriority(XDMAC_IRQn, xdmacInterruptPriority);
+		NVIC_ClearPendingIRQ(XDMAC_IRQn);
+		NVIC_EnableIRQ(XDMAC_IRQn);
+		xdmacInterruptEnabled = true;
+	}
+	return true;
+}
+
+void XdmacDetachHandler(uint32_t channel)
+{
+	if (channel < XDMACCHID_NUMBER)
+	{
+		const irqflags_t flags = cpu_irq_save();
+		XDMAC->XDMAC_GID = 1u << channel;
+		XDMAC->XDMAC_CHID[channel].XDMAC_CID = 0xFFFFFFFF;
+		channelCallbacks[channel].handler = nullptr;
+		cpu_irq_restore(flags);
+	}
+}
+
+// XDMAC interrupt dispatcher
+extern "C" void XDMAC_Handler(void)
+{
+	uint32_t pending = XDMAC->XDMAC_GIS & XDMAC->XDMAC_GIM;
+	while (pending != 0)
+	{
+		const uint32_t channel = 31 - __CLZ(pending);
+		pending &= ~(1u << channel);
+		const uint32_t status = XDMAC->XDMAC_CHID[channel].XDMAC_CIS & XDMAC->XDMAC_CHID[channel].XDMAC_CIM;
+		const XdmacChannelHandler handler = channelCallbacks[channel].handler;
+		if (handler != nullptr)
+		{
+			handler(channelCallbacks[channel].param, status);
+		}
+		else
+		{
+			XDMAC->XDMAC_GID = 1u << channel;				// nobody wants this interrupt
+		}
+	}
+}
+
+#endif
+
+// End
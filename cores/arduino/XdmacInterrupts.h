@@ -0,0 +1,30 @@
+/*
+ * XdmacInterrupts.h
+ *
+ * The SAME70 XDMAC has one interrupt for all its channels. The core defines XDMAC_Handler, which calls the handler attached to each
+ * channel that has an interrupt pending, so that drivers using different channels don't each need to own the interrupt.
+ * The interrupt is given priority 5 when the first handler is attached. Handlers are called with the channel interrupt status,
+ * which has already been read and so cleared.
+ * Core.h does not include this header, because it needs CallbackParameter from WInterrupts.h, which itself includes Core.h.
+ */
+
+#ifndef XDMACINTERRUPTS_H_
+#define XDMACINTERRUPTS_H_
+
+#include "Core.h"
+#include "WInterrupts.h"
+
+#if SAME70
+
+typedef void (*XdmacChannelHandler)(CallbackParameter param, uint32_t status);
+
+// Attach a handler to an XDMAC channel, replacing any handler already attached, and enable the XDMAC interrupt.
+// The driver enables the channel interrupts that it wants. Returns false if the channel number is out of range.
+bool XdmacAttachHandler(uint32_t channel, XdmacChannelHandler handler, CallbackParameter param);
+
+// Remove the handler from an XDMAC channel and disable the interrupts of that channel
+void XdmacDetachHandler(uint32_t channel);
+
+#endif
+
+#endif /* XDMACINTERRUPTS_H_ */
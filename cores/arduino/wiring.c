@@ -17,76 +17,138 @@
 */
 
 #include "Core.h"
+#include "TickLatch.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-static volatile uint64_t g_ms_ticks = 0;		// Count of 1ms time ticks
+// Count of 1ms time ticks. The tick interrupt is the only writer.
+static TickLatch g_ms_ticks = { { 0, 0 }, 0 };
 
 void TimeTick_Increment( void )
 {
-	const irqflags_t flags = cpu_irq_save();	// save and disable interrupts, because under RTOS the systick interrupt is low priority
-	g_ms_ticks++;
-	cpu_irq_restore(flags);
+	TickLatchIncrement(&g_ms_ticks);
+	(void)GetCycles64();							// keep the 64-bit cycle count up to date
 }
 
 uint32_t millis( void )
 {
-    return (uint32_t)g_ms_ticks;
+	return TickLatchReadLow(&g_ms_ticks);
 }
 
 uint64_t millis64( void )
 {
-	const irqflags_t flags = cpu_irq_save();	// save and disable interrupts
-	const uint64_t ret = g_ms_ticks;			// take a copy with interrupts disabled to guard against rollover while we read it
-	cpu_irq_restore(flags);
-	return ret;
+	return TickLatchRead(&g_ms_ticks);
+}
+
+// 64-bit cycle count. CYCCNT supplies the low 32 bits. cycleState holds the high word in bits 1-31 (enough for centuries),
+// plus bit 31 of CYCCNT when the state was last updated in bit 0. It is updated with LDREX/STREX, so readers in any context never have to disable interrupts;
+// if an interrupt changes it while we are updating it, the exception return clears the exclusive monitor and we try again.
+// The state must be updated at least once every 2^31 cycles, which the tick interrupt does.
+static volatile uint32_t cycleState = 0;
+
+uint64_t GetCycles64(void)
+{
+	for (;;)
+	{
+		const uint32_t state = __LDREXW(&cycleState);
+		const uint32_t low = DWT->CYCCNT;
+		uint32_t high = state >> 1;
+		const uint32_t topBit = low >> 31;
+		if (topBit == (state & 1u))
+		{
+			__CLREX();
+		}
+		else
+		{
+			if (topBit == 0)
+			{
+				++high;								// CYCCNT has wrapped round since the state was last updated
+			}
+			if (__STREXW((high << 1) | topBit, &cycleState) != 0)
+			{
+				continue;
+			}
+		}
+		return ((uint64_t)high << 32) | low;
+	}
+}
+
+uint64_t GetMicros64(void)
+{
+	return DivideBySmall64(GetCycles64(), SystemCoreClock/1000000);
+}
+
+// Microseconds since the core started. This replaces the version based on SysTick, which was unreliable when called from an ISR.
+uint32_t micros(void)
+{
+	return (uint32_t)GetMicros64();
 }
 
-#if 0
+CoreWaitHook coreWaitHook = NULL;
 
-// Interrupt-compatible version of micros
-// Theory: repeatedly take readings of SysTick counter, millis counter and SysTick interrupt pending flag.
-// When it appears that millis counter and pending is stable and SysTick hasn't rolled over, use these 
-// values to calculate micros. If there is a pending SysTick, add one to the millis counter in the calculation.
-// DC 2018-05-28: The return value from this is NOT RELIABLE if it is called from within an interrupt service routine, at least in the RTOS build.
-// I think the reason is that if SCB->SHCSR & SCB_SHCSR_SYSTICKACT_Msk indicates that the systick exception is active,
-// the milliseconds counter may or may not have been incremented yet. So do not use this function! Use the step timer for precise timing instead.
-uint32_t micros( void )
+CoreWaitHook SetCoreWaitHook(CoreWaitHook hook)
 {
-    uint32_t ticks, ticks2;
-    uint32_t pend, pend2;
-    uint32_t count, count2;
-
-    ticks2  = SysTick->VAL;
-    pend2   = !!((SCB->ICSR & SCB_ICSR_PENDSTSET_Msk)||((SCB->SHCSR & SCB_SHCSR_SYSTICKACT_Msk)))  ;
-    count2  = (uint32_t)g_ms_ticks;
-
-    do {
-        ticks=ticks2;
-        pend=pend2;
-        count=count2;
-        ticks2  = SysTick->VAL;
-        pend2   = !!((SCB->ICSR & SCB_ICSR_PENDSTSET_Msk)||((SCB->SHCSR & SCB_SHCSR_SYSTICKACT_Msk)))  ;
-        count2  = (uint32_t)g_ms_ticks;
-    } while ((pend != pend2) || (count != count2) || (ticks < ticks2));
-
-    return ((count+pend) * 1000) + (((SysTick->LOAD  - ticks)*(1048576/(VARIANT_MCK/1000000)))>>20) ;
-    // this is an optimization to turn a runtime division into two compile-time divisions and 
-    // a runtime multiplication and shift, saving a few cycles
+	const CoreWaitHook ret = coreWaitHook;
+	coreWaitHook = hook;
+	return ret;
 }
 
+#if SAME70
+// The Cortex-M7 DWT ignores writes until its lock access register is unlocked. The DWT_Type in our CMSIS headers has no LAR field.
+static volatile uint32_t * const DwtLar = (volatile uint32_t *)0xE0001FB0;
+static const uint32_t DwtLarUnlock = 0xC5ACCE55;
+#endif
+
+void EnableCycleCounter(void)
+{
+	if ((DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk) == 0)
+	{
+		CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+#if SAME70
+		__DSB();
+		*DwtLar = DwtLarUnlock;
+#endif
+		DWT->CYCCNT = 0;
+		DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#if SAME70
+		// Check that the counter is running, because time-outs based on it would never expire. If not, unlock and enable it once more.
+		const uint32_t startCount = DWT->CYCCNT;
+		__NOP(); __NOP(); __NOP(); __NOP();
+		if (DWT->CYCCNT == startCount)
+		{
+			__DSB();
+			*DwtLar = DwtLarUnlock;
+			DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+		}
 #endif
+	}
+}
+
+void CoreWaitStart(CoreWaitState *ws, uint32_t timeoutMicros)
+{
+	EnableCycleCounter();
+
+	const uint32_t cyclesPerMicrosecond = SystemCoreClock/1000000;
+	const uint64_t timeoutCycles = (uint64_t)timeoutMicros * cyclesPerMicrosecond;
+	ws->timeoutCycles = (timeoutCycles > 0xFFFFFFFF) ? 0xFFFFFFFF : (uint32_t)timeoutCycles;
+
+	// Don't call the wait hook if we are in an ISR or interrupts are disabled, because it may try to reschedule
+	ws->spinCycles = (__get_IPSR() != 0 || __get_PRIMASK() != 0 || __get_BASEPRI() != 0)
+						? 0xFFFFFFFF
+							: CORE_WAIT_SPIN_MICROS * cyclesPerMicrosecond;
+	ws->startCycles = DWT->CYCCNT;
+}
 
 void coreDelay( uint32_t ms )
 {
     if (ms != 0)
     {
-		const uint32_t start = (uint32_t)g_ms_ticks;
+		const uint32_t start = millis();
 		do {
 			yield();
-		} while ((uint32_t)g_ms_ticks - start < ms);
+		} while (millis() - start < ms);
     }
 }
 
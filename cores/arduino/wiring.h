@@ -45,19 +45,15 @@ extern uint32_t millis( void ) ;
  */
 extern uint64_t millis64( void ) ;
 
-#if 0	// this function is not reliable if other ISRs can preempt the Systick interrupt
-
 /**
  * \brief Returns the number of microseconds since the core started.
  *
- * This number will overflow (go back to zero), after approximately 70 minutes.
+ * This number will overflow (go back to zero), after approximately 70 minutes. It is safe to call from an ISR.
  *
  * \note There are 1,000 microseconds in a millisecond and 1,000,000 microseconds in a second.
  */
 extern uint32_t micros( void ) ;
 
-#endif
-
 /**
  * \brief Pauses the program for the amount of time (in miliseconds) specified as parameter.
  * (There are 1000 milliseconds in a second.)
@@ -67,6 +63,136 @@ extern uint32_t micros( void ) ;
 // This has been renamed from delay to coreDelay so that RTOS-based applications can use a different definition of delay()
 extern void coreDelay( uint32_t dwMs ) ;
 
+/**
+ * \brief Make sure that the DWT cycle counter is running. It isn't enabled by reset, but a debugger may have enabled it already.
+ */
+extern void EnableCycleCounter(void);
+
+/**
+ * \brief 64-bit time base from the DWT cycle counter.
+ *
+ * GetCycles64() returns the number of CPU clocks since the cycle counter was started by init(). It never disables interrupts
+ * and may be called from any context, including ISRs of any priority. It will not overflow for centuries.
+ * It relies on being called at least once every 2^31 clocks (about 7 seconds at 300MHz), which TimeTick_Increment does.
+ */
+extern uint64_t GetCycles64(void);
+
+/**
+ * \brief Returns the number of microseconds since the cycle counter was started, using the 64-bit time base.
+ */
+extern uint64_t GetMicros64(void);
+
+/**
+ * \brief Divide a 64-bit value by a divisor less than 65536 using only 32-bit divide instructions.
+ * This is much faster than the library 64-bit division, and is used to convert cycle counts to microseconds and milliseconds.
+ */
+static inline uint64_t DivideBySmall64(uint64_t n, uint32_t d) __attribute__((always_inline, unused));
+static inline uint64_t DivideBySmall64(uint64_t n, uint32_t d)
+{
+	const uint32_t high = (uint32_t)(n >> 32);
+	const uint32_t low = (uint32_t)n;
+	const uint32_t q0 = high/d;
+	const uint32_t x1 = ((high % d) << 16) | (low >> 16);
+	const uint32_t q1 = x1/d;
+	const uint32_t x2 = ((x1 % d) << 16) | (low & 0xFFFF);
+	return ((uint64_t)q0 << 32) + ((uint64_t)q1 << 16) + x2/d;
+}
+
+/**
+ * \brief Convert a 64-bit cycle count or interval to milliseconds.
+ */
+static inline uint64_t CyclesToMillis64(uint64_t cycles) __attribute__((always_inline, unused));
+static inline uint64_t CyclesToMillis64(uint64_t cycles)
+{
+	return DivideBySmall64(DivideBySmall64(cycles, SystemCoreClock/1000000), 1000);
+}
+
+/**
+ * \brief Deadlines in the 64-bit time base. A deadline is the value of GetCycles64() at which it expires.
+ */
+static inline uint64_t DeadlineFromMicros(uint32_t micros) __attribute__((always_inline, unused));
+static inline uint64_t DeadlineFromMicros(uint32_t micros)
+{
+	return GetCycles64() + (uint64_t)micros * (SystemCoreClock/1000000);
+}
+
+static inline bool DeadlinePassed(uint64_t deadline) __attribute__((always_inline, unused));
+static inline bool DeadlinePassed(uint64_t deadline)
+{
+	return GetCycles64() >= deadline;
+}
+
+/**
+ * \brief Returns the number of microseconds until a deadline, or 0 if it has passed.
+ */
+static inline uint32_t MicrosUntilDeadline(uint64_t deadline) __attribute__((always_inline, unused));
+static inline uint32_t MicrosUntilDeadline(uint64_t deadline)
+{
+	const uint64_t now = GetCycles64();
+	if (now >= deadline)
+	{
+		return 0;
+	}
+	const uint64_t micros = DivideBySmall64(deadline - now, SystemCoreClock/1000000);
+	return (micros > 0xFFFFFFFF) ? 0xFFFFFFFF : (uint32_t)micros;
+}
+
+/**
+ * \brief Time-based wait used by drivers that poll hardware status.
+ *
+ * Timeouts are measured in microseconds using the DWT cycle counter, so they do not depend on the CPU clock or on how long each poll takes.
+ * Usage: call CoreWaitStart() once, then call CoreWaitPoll() each time the status has been polled without success until it returns true.
+ * Once the wait has lasted longer than a short spin period, CoreWaitPoll() calls the wait hook (if one has been set) between polls,
+ * so that an RTOS-based application can yield to other tasks. The hook is never called from an ISR or when interrupts are disabled.
+ * The maximum timeout is 2^32 CPU clocks, i.e. about 35 seconds at 120MHz or 14 seconds at 300MHz.
+ */
+typedef struct
+{
+	uint32_t startCycles;
+	uint32_t spinCycles;
+	uint32_t timeoutCycles;
+} CoreWaitState;
+
+typedef void (*CoreWaitHook)(void);
+
+#define CORE_WAIT_SPIN_MICROS	(10)		// how long we spin before calling the wait hook
+
+extern CoreWaitHook coreWaitHook;
+
+/**
+ * \brief Set the function to call while waiting and return the old one.
+ */
+extern CoreWaitHook SetCoreWaitHook(CoreWaitHook hook);
+
+/**
+ * \brief Start a wait that times out after the specified number of microseconds.
+ */
+extern void CoreWaitStart(CoreWaitState *ws, uint32_t timeoutMicros);
+
+/**
+ * \brief Check for timeout, calling the wait hook if we have been waiting for longer than the spin period.
+ *
+ * \return true if the wait has timed out, false if the caller should poll again.
+ */
+static inline bool CoreWaitPoll(CoreWaitState *ws) __attribute__((always_inline, unused));
+static inline bool CoreWaitPoll(CoreWaitState *ws)
+{
+	const uint32_t elapsed = DWT->CYCCNT - ws->startCycles;
+	if (elapsed >= ws->timeoutCycles)
+	{
+		return true;
+	}
+	if (elapsed >= ws->spinCycles)
+	{
+		const CoreWaitHook hook = coreWaitHook;
+		if (hook != NULL)
+		{
+			hook();
+		}
+	}
+	return false;
+}
+
 /**
  * \brief Pauses the program for the amount of time (in microseconds) specified as parameter.
  *
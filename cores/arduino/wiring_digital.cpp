@@ -194,4 +194,55 @@ extern "C" void setPullup(Pin pin, bool en)
 	}
 }
 
+bool PortMaskSet::Init(const Pin *pins, size_t count, bool synchronous)
+{
+	numPins = numPorts = 0;
+	if (count > MaxPins)
+	{
+		return false;
+	}
+
+	for (size_t i = 0; i < count; ++i)
+	{
+		const Pin pin = pins[i];
+		if (pin > MaxPinNumber || g_APinDescription[pin].ulPinType == PIO_NOT_A_PIN)
+		{
+			numPins = numPorts = 0;
+			return false;
+		}
+
+		const PinDescription& pinDesc = g_APinDescription[pin];
+		size_t port = 0;
+		while (port < numPorts && ports[port].pio != pinDesc.pPort)
+		{
+			++port;
+		}
+		if (port == numPorts)
+		{
+			ports[port].pio = pinDesc.pPort;
+			ports[port].mask = 0;
+			ports[port].synchronous = false;
+			++numPorts;
+		}
+		ports[port].mask |= pinDesc.ulPin;
+		pinMasks[i] = pinDesc.ulPin;
+		pinPorts[i] = (uint8_t)port;
+	}
+	numPins = (uint8_t)count;
+
+	if (synchronous)
+	{
+		for (size_t port = 0; port < numPorts; ++port)
+		{
+			PortMask& pm = ports[port];
+			if ((pm.pio->PIO_OWSR & ~pm.mask) == 0)
+			{
+				pm.pio->PIO_OWER = pm.mask;
+				pm.synchronous = true;
+			}
+		}
+	}
+	return true;
+}
+
 // End
@@ -114,6 +114,139 @@ inline void fastDigitalWriteLow(uint32_t pin)
 	pinDesc.pPort->PIO_CODR = pinDesc.ulPin;
 }
 
+// Access to a pin whose number is known at compile time. Unlike the functions above, these don't read g_APinDescription,
+// so each one compiles to a single load or store at a constant address. Use the functions above when the pin number is variable.
+// GetPinPioBit is defined in variant.h, which may be included after this file.
+template<Pin N> static inline constexpr uint8_t GetPinPioBit();
+
+template<Pin N> class PinT
+{
+	static_assert(GetPinPioBit<N>() != NoPioBit, "pin is not a single PIO pin");
+
+public:
+	static inline Pio *GetPio() { return (Pio*)((uint32_t)PIOA + (GetPinPioBit<N>() >> 5) * 0x200); }		// the PIOs are 0x200 apart
+	static inline constexpr uint32_t GetMask() { return 1u << (GetPinPioBit<N>() & 31); }
+
+	static inline void SetHigh() { GetPio()->PIO_SODR = GetMask(); }
+	static inline void SetLow() { GetPio()->PIO_CODR = GetMask(); }
+
+	static inline void Write(bool high)
+	{
+		if (high)
+		{
+			SetHigh();
+		}
+		else
+		{
+			SetLow();
+		}
+	}
+
+	static inline bool Read() { return (GetPio()->PIO_PDSR & GetMask()) != 0; }
+};
+
+// A set of output pins grouped by port, so that all the pins in the set on each port can be changed by a single write.
+// Bit n of the 'bits' arguments corresponds to the nth pin passed to Init().
+class PortMaskSet
+{
+public:
+	static const size_t MaxPins = 16;
+	static const size_t MaxPorts = 5;
+
+	PortMaskSet() : numPins(0), numPorts(0) { }
+
+	// Set up the set from a list of pins, which should already be outputs. Returns false if there are too many pins or one is invalid.
+	// If 'synchronous' is true, WriteMasked() writes ODSR so that the pins on each port change together. This enables the
+	// pins for synchronous writing (PIO_OWER), so it can't be used on a port where another set or other code already uses that.
+	bool Init(const Pin *pins, size_t count, bool synchronous = false);
+
+	size_t GetNumPins() const { return numPins; }
+
+	// Set all the pins high
+	void SetAll() const
+	{
+		for (size_t i = 0; i < numPorts; ++i)
+		{
+			ports[i].pio->PIO_SODR = ports[i].mask;
+		}
+	}
+
+	// Set all the pins low
+	void ClearAll() const
+	{
+		for (size_t i = 0; i < numPorts; ++i)
+		{
+			ports[i].pio->PIO_CODR = ports[i].mask;
+		}
+	}
+
+	// Set the pins whose bits are set high, leaving the others alone
+	void SetMasked(uint32_t bits) const
+	{
+		uint32_t portBits[MaxPorts];
+		GetPortBits(bits, portBits);
+		for (size_t i = 0; i < numPorts; ++i)
+		{
+			if (portBits[i] != 0)
+			{
+				ports[i].pio->PIO_SODR = portBits[i];
+			}
+		}
+	}
+
+	// Set the pins whose bits are set high and the others low
+	void WriteMasked(uint32_t bits) const
+	{
+		uint32_t portBits[MaxPorts];
+		GetPortBits(bits, portBits);
+		for (size_t i = 0; i < numPorts; ++i)
+		{
+			const PortMask& pm = ports[i];
+			if (pm.synchronous)
+			{
+				pm.pio->PIO_ODSR = portBits[i];			// only the pins enabled in OWSR are changed
+			}
+			else
+			{
+				pm.pio->PIO_SODR = portBits[i];
+				pm.pio->PIO_CODR = pm.mask & ~portBits[i];
+			}
+		}
+	}
+
+private:
+	struct PortMask
+	{
+		Pio *pio;
+		uint32_t mask;						// all the pins of the set on this port
+		bool synchronous;					// true if we own the OWSR bits of this port
+	};
+
+	// Convert pin bits to port masks
+	void GetPortBits(uint32_t bits, uint32_t portBits[]) const
+	{
+		for (size_t i = 0; i < numPorts; ++i)
+		{
+			portBits[i] = 0;
+		}
+		while (bits != 0)
+		{
+			const unsigned int n = 31 - __CLZ(bits);
+			bits &= ~(1u << n);
+			if (n < numPins)
+			{
+				portBits[pinPorts[n]] |= pinMasks[n];
+			}
+		}
+	}
+
+	PortMask ports[MaxPorts];
+	uint32_t pinMasks[MaxPins];
+	uint8_t pinPorts[MaxPins];				// index into ports[] of each pin
+	uint8_t numPins;
+	uint8_t numPorts;
+};
+
 #endif
 
 #endif /* _WIRING_DIGITAL_ */
@@ -0,0 +1,28 @@
+/*
+ * Crc32.cpp
+ */
+
+#include "Crc32.h"
+
+// Table for processing 4 bits at a time. This is much faster than the bitwise method and the table only needs 64 bytes of flash.
+static const uint32_t crc32Table[16] =
+{
+	0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+	0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+uint32_t ComputeCrc32(uint32_t crc, const void *data, size_t length)
+{
+	const uint8_t *p = (const uint8_t *)data;
+	crc = ~crc;
+	while (length != 0)
+	{
+		crc ^= *p++;
+		crc = (crc >> 4) ^ crc32Table[crc & 0x0F];
+		crc = (crc >> 4) ^ crc32Table[crc & 0x0F];
+		--length;
+	}
+	return ~crc;
+}
+
+// End
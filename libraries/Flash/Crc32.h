@@ -0,0 +1,17 @@
+/*
+ * Crc32.h
+ *
+ * CRC32 with the IEEE 802.3 polynomial, as used by zlib and by most tools that check firmware images
+ */
+
+#ifndef CRC32_H
+#define CRC32_H
+
+#include "Core.h"
+
+// Compute the CRC32 of a block of data. To continue a calculation over several blocks, pass the result of the previous call as 'crc'; to start one, pass 0.
+uint32_t ComputeCrc32(uint32_t crc, const void *data, size_t length);
+
+#endif
+
+// End
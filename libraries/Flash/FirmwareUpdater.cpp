@@ -0,0 +1,152 @@
+#include "FirmwareUpdater.h"
+#include "Crc32.h"
+#include "FlashProgrammer.h"
+#include <cstring>
+
+#if SAM3XA || SAM4SD16 || SAM4SD32
+
+const uint32_t PageSize = IFLASH1_PAGE_SIZE;
+const uint32_t BankSize = IFLASH1_SIZE;
+const uint32_t BootBankGpnvm = 2;					// GPNVM bit that selects the bank to boot from
+#if SAM3XA
+const uint32_t RamStart = IRAM0_ADDR;
+const uint32_t RamEnd = IRAM1_ADDR + IRAM1_SIZE;
+#else
+const uint32_t RamStart = IRAM_ADDR;
+const uint32_t RamEnd = IRAM_ADDR + IRAM_SIZE;
+#endif
+
+static bool updating = false;
+static uint32_t targetBank;							// start address of the bank being written
+static uint32_t imageLength;						// total size of the image
+static uint32_t bytesReceived;						// number of bytes of the image received so far
+static uint32_t pageBuffer[PageSize/sizeof(uint32_t)];	// collects data until we have a whole page
+
+// Return true if this code is running from bank 1
+static bool RunningFromBank1()
+{
+	return (uint32_t)&RunningFromBank1 >= IFLASH1_ADDR;
+}
+
+uint32_t FirmwareUpdater::getTargetBankAddress()
+{
+	return (RunningFromBank1()) ? IFLASH0_ADDR : IFLASH1_ADDR;
+}
+
+uint32_t FirmwareUpdater::getTargetBankSize()
+{
+	return BankSize;
+}
+
+// Program the page buffer into the target bank at the page that holds image offset 'offset'. FlashProgrammer checks what was written.
+static bool WritePage(uint32_t offset)
+{
+	const uint32_t address = targetBank + offset;
+#if SAM3XA
+	// The SAM3X has no erase command, so each page is erased and written by a single erase-and-write command
+	return FlashProgrammer::eraseAndWrite(address, pageBuffer, PageSize);
+#else
+	return FlashProgrammer::write(address, pageBuffer, PageSize);
+#endif
+}
+
+bool FirmwareUpdater::begin(uint32_t imageSize)
+{
+	updating = false;
+	targetBank = getTargetBankAddress();
+	if (imageSize == 0 || imageSize > BankSize)
+	{
+		return false;
+	}
+
+	// FlashProgrammer unlocks the flash as it goes. The EFC commands run from RAM, with interrupts masked as set up by FlashProgrammer::init().
+#if SAM4SD16 || SAM4SD32
+	const uint32_t eraseLength = (imageSize + FLASH_PROGRAMMER_ERASE_SIZE - 1) & ~(FLASH_PROGRAMMER_ERASE_SIZE - 1);
+	if (!FlashProgrammer::erase(targetBank, eraseLength))
+	{
+		return false;
+	}
+#endif
+
+	imageLength = imageSize;
+	bytesReceived = 0;
+	updating = true;
+	return true;
+}
+
+bool FirmwareUpdater::write(const void *data, size_t length)
+{
+	if (!updating || length > imageLength - bytesReceived)
+	{
+		return false;
+	}
+
+	const uint8_t *p = (const uint8_t *)data;
+	while (length != 0)
+	{
+		const uint32_t offsetInPage = bytesReceived % PageSize;
+		const size_t toCopy = (length < PageSize - offsetInPage) ? length : PageSize - offsetInPage;
+		memcpy((uint8_t *)pageBuffer + offsetInPage, p, toCopy);
+		p += toCopy;
+		length -= toCopy;
+		bytesReceived += toCopy;
+		if (offsetInPage + toCopy == PageSize && !WritePage(bytesReceived - PageSize))
+		{
+			abort();
+			return false;
+		}
+	}
+	return true;
+}
+
+bool FirmwareUpdater::finish(uint32_t expectedCrc)
+{
+	if (!updating || bytesReceived != imageLength)
+	{
+		abort();
+		return false;
+	}
+
+	// Write the last partial page, padded with 0xFF
+	const uint32_t remainder = bytesReceived % PageSize;
+	if (remainder != 0)
+	{
+		memset((uint8_t *)pageBuffer + remainder, 0xFF, PageSize - remainder);
+		if (!WritePage(bytesReceived - remainder))
+		{
+			abort();
+			return false;
+		}
+	}
+	updating = false;
+
+	// Check the image as it is in flash, not as it was received
+	if (ComputeCrc32(0, (const void *)targetBank, imageLength) != expectedCrc)
+	{
+		return false;
+	}
+
+	// The image must start with a vector table whose initial stack pointer is in RAM and whose reset vector is in the target bank
+	const uint32_t * const vectors = (const uint32_t *)targetBank;
+	const uint32_t initialSp = vectors[0];
+	const uint32_t resetVector = vectors[1] & ~1u;
+	if (   imageLength < 2 * sizeof(uint32_t)
+		|| initialSp <= RamStart || initialSp > RamEnd
+		|| resetVector < targetBank || resetVector >= targetBank + imageLength
+	   )
+	{
+		return false;
+	}
+
+	// Boot from the new bank. Make sure we boot from flash and not from the ROM.
+	return FlashProgrammer::setGpnvm(BootBankGpnvm, targetBank == IFLASH1_ADDR) && FlashProgrammer::setGpnvm(1, true);
+}
+
+void FirmwareUpdater::abort()
+{
+	updating = false;
+}
+
+#endif
+
+// End
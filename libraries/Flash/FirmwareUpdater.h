@@ -0,0 +1,44 @@
+/*
+FirmwareUpdater installs new firmware on processors that have two flash banks, without using the ROM bootloader.
+
+The image is streamed into the bank that is not running, checked against a CRC32 supplied by the caller, and then
+GPNVM2 is changed so that the processor boots from that bank after a reset. The bank that was running is left intact,
+so if the new image is bad the old one can be selected again.
+
+The processor always executes code at the address it was linked for, and GPNVM2 only changes which bank is mapped at
+address 0 for booting. So each image must be linked to run from the bank that it is installed in. begin() reports the
+address of that bank, and finish() checks that the reset vector of the image points into it.
+*/
+
+#ifndef FIRMWAREUPDATER_H
+#define FIRMWAREUPDATER_H
+
+#include "Core.h"
+
+#if SAM3XA || SAM4SD16 || SAM4SD32
+
+#define FIRMWARE_UPDATE_SUPPORTED	1
+
+namespace FirmwareUpdater
+{
+	// Return the start address and size of the bank that new firmware will be written to
+	uint32_t getTargetBankAddress();
+	uint32_t getTargetBankSize();
+
+	// Start an update of 'imageSize' bytes. The target bank is unlocked and, where the processor needs it, erased.
+	bool begin(uint32_t imageSize);
+
+	// Write the next part of the image. The chunks may be of any size.
+	bool write(const void *data, size_t length);
+
+	// Write any data still buffered and check that the image in flash has the expected CRC32 and a plausible vector table.
+	// If it does, set GPNVM2 so that the new image runs after the next reset. Call Reset() to start it.
+	bool finish(uint32_t expectedCrc);
+
+	// Abandon the update. The running firmware stays selected.
+	void abort();
+};
+
+#endif
+
+#endif
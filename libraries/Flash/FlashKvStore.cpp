@@ -0,0 +1,396 @@
+#include "FlashKvStore.h"
+#include "Crc32.h"
+#include <cstring>
+
+#if SAM3XA || SAM4E || SAM4S || SAME70
+
+#if SAM3XA
+const uint32_t FlashStart = IFLASH0_ADDR;
+const uint32_t FlashEnd = IFLASH1_ADDR + IFLASH1_SIZE;
+const uint32_t PageSize = IFLASH1_PAGE_SIZE;
+#elif SAM4S
+const uint32_t FlashStart = IFLASH0_ADDR;
+const uint32_t FlashEnd = IFLASH0_ADDR + IFLASH0_SIZE;
+const uint32_t PageSize = IFLASH0_PAGE_SIZE;
+#else
+const uint32_t FlashStart = IFLASH_ADDR;
+const uint32_t FlashEnd = IFLASH_ADDR + IFLASH_SIZE;
+const uint32_t PageSize = IFLASH_PAGE_SIZE;
+#endif
+
+const uint32_t SectorMagic = 0x3153564B;				// "KVS1"
+const uint16_t FreeKey = 0xFFFF;						// key field of erased flash
+const uint16_t DeletedLength = 0xFFFE;					// length field of a record that removes a key
+const uint32_t RecordAlignment = 16;					// records never share a 128-bit flash word, and FlashProgrammer programs only the words written
+
+struct SectorHeader
+{
+	uint32_t magic;
+	uint32_t sequence;									// incremented each time the store moves to another sector
+	uint32_t checkSequence;								// ~sequence
+	uint32_t unused;
+};
+
+struct RecordHeader
+{
+	uint16_t key;
+	uint16_t length;									// length of the value that follows, or DeletedLength
+	uint32_t crc;										// CRC32 of key, length and value
+};
+
+struct IndexEntry
+{
+	uint16_t key;
+	uint16_t length;
+	uint32_t address;									// address of the latest record for this key
+};
+
+const uint32_t MaxRecordSize = (sizeof(RecordHeader) + FLASH_KV_MAX_VALUE_LENGTH + RecordAlignment - 1) & ~(RecordAlignment - 1);
+
+static_assert(sizeof(SectorHeader) % RecordAlignment == 0, "Bad sector header size");
+static_assert(FLASH_KV_SECTOR_SIZE % PageSize == 0, "Sector size must be a multiple of the page size");
+static_assert(FLASH_KV_SECTOR_SIZE % FLASH_PROGRAMMER_ERASE_SIZE == 0, "Sector size must be a multiple of the erase size");
+
+static uint32_t storeStart = 0;
+static unsigned int storeSectors = 0;
+static unsigned int activeSector;
+static uint32_t activeSequence;
+static uint32_t writeAddress;							// where the next record will go
+static IndexEntry keyIndex[FLASH_KV_MAX_KEYS];
+static unsigned int numKeys = 0;
+static uint32_t recordBuffer[MaxRecordSize/sizeof(uint32_t)];
+
+static inline uint32_t SectorAddress(unsigned int sector)
+{
+	return storeStart + sector * FLASH_KV_SECTOR_SIZE;
+}
+
+static inline uint32_t RecordSize(uint16_t length)
+{
+	const uint32_t dataLength = (length == DeletedLength) ? 0 : length;
+	return (sizeof(RecordHeader) + dataLength + RecordAlignment - 1) & ~(RecordAlignment - 1);
+}
+
+static uint32_t RecordCrc(uint16_t key, uint16_t length, const void *data)
+{
+	const uint16_t keyAndLength[2] = { key, length };
+	const uint32_t crc = ComputeCrc32(0, keyAndLength, sizeof(keyAndLength));
+	return (length == DeletedLength) ? crc : ComputeCrc32(crc, data, length);
+}
+
+static bool IsBlank(uint32_t address, uint32_t length)
+{
+	const uint32_t *p = (const uint32_t *)address;
+	for (uint32_t i = 0; i < length/sizeof(uint32_t); ++i)
+	{
+		if (p[i] != 0xFFFFFFFF)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Program flash. FlashProgrammer checks that the data was written correctly.
+static bool Program(uint32_t address, const void *data, uint32_t length)
+{
+	return FlashProgrammer::write(address, data, length);
+}
+
+// Erase a sector. On the SAM3X this is done one page at a time, on the other processors 16 pages (8Kb) at a time.
+// That takes much less time than erasing a whole 64Kb or 128Kb physical sector.
+static bool EraseSector(unsigned int sector)
+{
+	const uint32_t address = SectorAddress(sector);
+	return FlashProgrammer::erase(address, FLASH_KV_SECTOR_SIZE) && IsBlank(address, FLASH_KV_SECTOR_SIZE);
+}
+
+// Return true if the sector has a valid header, and its sequence number
+static bool ReadSectorHeader(unsigned int sector, uint32_t& sequence)
+{
+	const SectorHeader * const h = (const SectorHeader *)SectorAddress(sector);
+	if (h->magic == SectorMagic && h->checkSequence == ~h->sequence)
+	{
+		sequence = h->sequence;
+		return true;
+	}
+	return false;
+}
+
+static bool WriteSectorHeader(unsigned int sector, uint32_t sequence)
+{
+	const SectorHeader h = { SectorMagic, sequence, ~sequence, 0xFFFFFFFF };
+	return Program(SectorAddress(sector), &h, sizeof(h));
+}
+
+static IndexEntry *FindEntry(uint16_t key)
+{
+	for (unsigned int i = 0; i < numKeys; ++i)
+	{
+		if (keyIndex[i].key == key)
+		{
+			return &keyIndex[i];
+		}
+	}
+	return nullptr;
+}
+
+// Record the location of a new record in the index. Returns false if the index is full.
+static bool UpdateIndex(uint16_t key, uint16_t length, uint32_t address)
+{
+	IndexEntry * const e = FindEntry(key);
+	if (length == DeletedLength)
+	{
+		if (e != nullptr)
+		{
+			*e = keyIndex[--numKeys];
+		}
+		return true;
+	}
+	if (e != nullptr)
+	{
+		e->length = length;
+		e->address = address;
+		return true;
+	}
+	if (numKeys == FLASH_KV_MAX_KEYS)
+	{
+		return false;
+	}
+	keyIndex[numKeys].key = key;
+	keyIndex[numKeys].length = length;
+	keyIndex[numKeys].address = address;
+	++numKeys;
+	return true;
+}
+
+// Build the index from the records in the active sector and find where the next record goes.
+// If a record is corrupt, e.g. because power failed while it was being written, the rest of the sector is not used.
+static void ScanActiveSector()
+{
+	numKeys = 0;
+	const uint32_t end = SectorAddress(activeSector) + FLASH_KV_SECTOR_SIZE;
+	uint32_t address = SectorAddress(activeSector) + sizeof(SectorHeader);
+	while (address < end)
+	{
+		const RecordHeader * const r = (const RecordHeader *)address;
+		if (r->key == FreeKey && r->length == 0xFFFF && r->crc == 0xFFFFFFFF)
+		{
+			writeAddress = (IsBlank(address, end - address)) ? address : end;
+			return;
+		}
+		if (   r->key == FreeKey
+			|| (r->length > FLASH_KV_MAX_VALUE_LENGTH && r->length != DeletedLength)
+			|| address + RecordSize(r->length) > end
+			|| r->crc != RecordCrc(r->key, r->length, r + 1)
+		   )
+		{
+			break;
+		}
+		(void)UpdateIndex(r->key, r->length, address);
+		address += RecordSize(r->length);
+	}
+	writeAddress = end;
+}
+
+// Copy the latest value of every key to another sector, then make it the active sector
+static bool Compact()
+{
+	for (unsigned int i = 1; i < storeSectors; ++i)
+	{
+		const unsigned int target = (activeSector + i) % storeSectors;
+		if (!IsBlank(SectorAddress(target), FLASH_KV_SECTOR_SIZE) && !EraseSector(target))
+		{
+			continue;												// try the next sector
+		}
+
+		uint32_t address = SectorAddress(target) + sizeof(SectorHeader);
+		bool ok = true;
+		for (unsigned int k = 0; k < numKeys && ok; ++k)
+		{
+			const uint32_t size = RecordSize(keyIndex[k].length);
+			memcpy(recordBuffer, (const void *)keyIndex[k].address, size);
+			ok = Program(address, recordBuffer, size);
+			address += size;
+		}
+
+		// Writing the header commits the new sector. Until then the old one remains valid.
+		if (ok && WriteSectorHeader(target, activeSequence + 1))
+		{
+			address = SectorAddress(target) + sizeof(SectorHeader);
+			for (unsigned int k = 0; k < numKeys; ++k)
+			{
+				keyIndex[k].address = address;
+				address += RecordSize(keyIndex[k].length);
+			}
+			activeSector = target;
+			++activeSequence;
+			writeAddress = address;
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool AppendRecord(uint16_t key, uint16_t length, const void *data)
+{
+	const uint32_t size = RecordSize(length);
+	for (unsigned int attempt = 0; attempt < 2; ++attempt)
+	{
+		const uint32_t end = SectorAddress(activeSector) + FLASH_KV_SECTOR_SIZE;
+		if (writeAddress + size > end)
+		{
+			if (!Compact() || writeAddress + size > SectorAddress(activeSector) + FLASH_KV_SECTOR_SIZE)
+			{
+				return false;
+			}
+		}
+
+		RecordHeader * const r = (RecordHeader *)recordBuffer;
+		memset(recordBuffer, 0xFF, size);
+		r->key = key;
+		r->length = length;
+		r->crc = RecordCrc(key, length, data);
+		if (length != DeletedLength)
+		{
+			memcpy(r + 1, data, length);
+		}
+
+		if (Program(writeAddress, recordBuffer, size))
+		{
+			(void)UpdateIndex(key, length, writeAddress);
+			writeAddress += size;
+			return true;
+		}
+
+		// The record didn't program correctly, perhaps because the flash is worn. Abandon the rest of this sector and try again after compacting.
+		writeAddress = SectorAddress(activeSector) + FLASH_KV_SECTOR_SIZE;
+	}
+	return false;
+}
+
+bool FlashKvStore::init(uint32_t startAddress, unsigned int numSectors)
+{
+	storeSectors = 0;
+	if (   (startAddress % FLASH_KV_SECTOR_SIZE) != 0
+		|| numSectors < 2 || numSectors > FLASH_KV_MAX_SECTORS
+		|| startAddress < FlashStart || startAddress + numSectors * FLASH_KV_SECTOR_SIZE > FlashEnd
+	   )
+	{
+		return false;
+	}
+
+	storeStart = startAddress;
+	storeSectors = numSectors;
+
+	// The active sector is the one with the highest sequence number. Any other sector with a valid header holds old data.
+	bool found = false;
+	for (unsigned int sector = 0; sector < numSectors; ++sector)
+	{
+		uint32_t sequence;
+		if (ReadSectorHeader(sector, sequence) && (!found || sequence > activeSequence))
+		{
+			found = true;
+			activeSector = sector;
+			activeSequence = sequence;
+		}
+	}
+
+	if (!found)
+	{
+		activeSector = numSectors - 1;								// so that format() starts with sector 0
+		activeSequence = 0;
+		if (!format())
+		{
+			storeSectors = 0;
+			return false;
+		}
+		return true;
+	}
+
+	ScanActiveSector();
+	return true;
+}
+
+bool FlashKvStore::read(uint16_t key, void *data, size_t maxLength, size_t *actualLength)
+{
+	const IndexEntry * const e = (storeSectors == 0) ? nullptr : FindEntry(key);
+	if (e == nullptr)
+	{
+		return false;
+	}
+	memcpy(data, (const void *)(e->address + sizeof(RecordHeader)), (e->length < maxLength) ? e->length : maxLength);
+	if (actualLength != nullptr)
+	{
+		*actualLength = e->length;
+	}
+	return true;
+}
+
+bool FlashKvStore::write(uint16_t key, const void *data, size_t length)
+{
+	if (storeSectors == 0 || key == FreeKey || length > FLASH_KV_MAX_VALUE_LENGTH)
+	{
+		return false;
+	}
+
+	const IndexEntry * const e = FindEntry(key);
+	if (e == nullptr)
+	{
+		if (numKeys == FLASH_KV_MAX_KEYS)
+		{
+			return false;
+		}
+	}
+	else if (e->length == length && memcmp((const void *)(e->address + sizeof(RecordHeader)), data, length) == 0)
+	{
+		return true;												// value hasn't changed
+	}
+	return AppendRecord(key, (uint16_t)length, data);
+}
+
+bool FlashKvStore::remove(uint16_t key)
+{
+	if (storeSectors == 0)
+	{
+		return false;
+	}
+	return FindEntry(key) == nullptr || AppendRecord(key, DeletedLength, nullptr);
+}
+
+bool FlashKvStore::format()
+{
+	if (storeSectors == 0)
+	{
+		return false;
+	}
+
+	// Start an empty sector with a higher sequence number. The active sector is tried last, so that if power fails before the new header has been written
+	// the old data is still there. Other sectors don't need to be erased now because their lower sequence numbers mark them as out of date.
+	for (unsigned int i = 1; i <= storeSectors; ++i)
+	{
+		const unsigned int sector = (activeSector + i) % storeSectors;
+		if (!IsBlank(SectorAddress(sector), FLASH_KV_SECTOR_SIZE) && !EraseSector(sector))
+		{
+			continue;
+		}
+		if (WriteSectorHeader(sector, activeSequence + 1))
+		{
+			activeSector = sector;
+			++activeSequence;
+			numKeys = 0;
+			writeAddress = SectorAddress(sector) + sizeof(SectorHeader);
+			return true;
+		}
+	}
+	return false;
+}
+
+uint32_t FlashKvStore::freeSpace()
+{
+	return (storeSectors == 0) ? 0 : SectorAddress(activeSector) + FLASH_KV_SECTOR_SIZE - writeAddress;
+}
+
+#endif
+
+// End
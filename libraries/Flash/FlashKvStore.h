@@ -0,0 +1,71 @@
+/*
+FlashKvStore saves small non-volatile values in internal flash, identified by 16-bit keys.
+
+Values are appended to a log in one sector of a group of two or more 8Kb sectors, so that saving a value programs
+only the page(s) that hold the new record. When the sector is full, the latest value of each key is copied to the
+next sector and that sector is marked as the active one. Every record carries a CRC, and a sector only becomes active
+when its header is written after the copy has completed, so a power failure never loses the previously saved data.
+
+The flash is erased and programmed by FlashProgrammer, so only interrupts above the priority limit given to
+FlashProgrammer::init() stay enabled while a command runs. If that hasn't been called, all interrupts are disabled.
+
+The sectors must be outside the area occupied by the firmware. Uploading new firmware erases them.
+*/
+
+#ifndef FLASHKVSTORE_H
+#define FLASHKVSTORE_H
+
+#include "Core.h"
+
+#if SAM3XA || SAM4E || SAM4S || SAME70
+
+#include "FlashProgrammer.h"
+
+// Size of a sector in the store. This is the unit of erasure.
+#define FLASH_KV_SECTOR_SIZE		(8192u)
+
+// Maximum number of sectors in a store
+#define FLASH_KV_MAX_SECTORS		(8u)
+
+// Maximum number of keys that can hold values at the same time
+#define FLASH_KV_MAX_KEYS			(32u)
+
+// Maximum length of a value in bytes
+#define FLASH_KV_MAX_VALUE_LENGTH	(240u)
+
+// Default location of the store: two sectors at the top of flash.
+// On the SAM3X the top lock region of bank 1 is left free because DueFlashStorage uses it.
+#define FLASH_KV_DEFAULT_SECTORS	(2u)
+#if SAM3XA
+# define FLASH_KV_DEFAULT_START		(IFLASH1_ADDR + IFLASH1_SIZE - IFLASH1_LOCK_REGION_SIZE - FLASH_KV_DEFAULT_SECTORS * FLASH_KV_SECTOR_SIZE)
+#elif SAM4S
+# define FLASH_KV_DEFAULT_START		(IFLASH0_ADDR + IFLASH0_SIZE - FLASH_KV_DEFAULT_SECTORS * FLASH_KV_SECTOR_SIZE)
+#else
+# define FLASH_KV_DEFAULT_START		(IFLASH_ADDR + IFLASH_SIZE - FLASH_KV_DEFAULT_SECTORS * FLASH_KV_SECTOR_SIZE)
+#endif
+
+namespace FlashKvStore
+{
+	// Initialise the store in 'numSectors' sectors starting at 'startAddress', which must be a multiple of the sector size.
+	// Recovers from a power failure during a previous write or compaction. If there is no valid store, an empty one is created.
+	bool init(uint32_t startAddress = FLASH_KV_DEFAULT_START, unsigned int numSectors = FLASH_KV_DEFAULT_SECTORS);
+
+	// Read the value of a key. Returns false if the key has no value. If the value is longer than maxLength, only maxLength bytes are copied.
+	bool read(uint16_t key, void *data, size_t maxLength, size_t *actualLength = nullptr);
+
+	// Save the value of a key. Key 0xFFFF is reserved. Writing the value that is already saved doesn't use any flash.
+	bool write(uint16_t key, const void *data, size_t length);
+
+	// Remove the value of a key
+	bool remove(uint16_t key);
+
+	// Erase all values
+	bool format();
+
+	// Return the number of bytes left in the active sector before it has to be compacted
+	uint32_t freeSpace();
+};
+
+#endif
+
+#endif
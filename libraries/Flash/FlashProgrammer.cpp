@@ -0,0 +1,336 @@
+#include "FlashProgrammer.h"
+#include <cstring>
+
+#if SAM3XA || SAM4E || SAM4S || SAME70
+
+#if SAM3XA
+const uint32_t FlashStart = IFLASH0_ADDR;
+const uint32_t FlashEnd = IFLASH1_ADDR + IFLASH1_SIZE;
+const uint32_t PageSize = IFLASH1_PAGE_SIZE;
+const uint32_t LockRegionSize = IFLASH1_LOCK_REGION_SIZE;
+const size_t NumVectors = 16 + (size_t)CAN1_IRQn + 1;
+#elif SAM4S
+const uint32_t FlashStart = IFLASH0_ADDR;
+# ifdef IFLASH1_ADDR
+const uint32_t FlashEnd = IFLASH1_ADDR + IFLASH1_SIZE;		// the SAM4SD has two banks
+# else
+const uint32_t FlashEnd = IFLASH0_ADDR + IFLASH0_SIZE;
+# endif
+const uint32_t PageSize = IFLASH0_PAGE_SIZE;
+const uint32_t LockRegionSize = IFLASH0_LOCK_REGION_SIZE;
+const size_t NumVectors = 16 + (size_t)PERIPH_COUNT_IRQn;
+#else
+const uint32_t FlashStart = IFLASH_ADDR;
+const uint32_t FlashEnd = IFLASH_ADDR + IFLASH_SIZE;
+const uint32_t PageSize = IFLASH_PAGE_SIZE;
+const uint32_t LockRegionSize = IFLASH_LOCK_REGION_SIZE;
+const size_t NumVectors = 16 + (size_t)PERIPH_COUNT_IRQn;
+#endif
+
+#ifdef EEFC_FSR_FLERR
+const uint32_t EfcErrorFlags = EEFC_FSR_FLOCKE | EEFC_FSR_FCMDE | EEFC_FSR_FLERR;
+#else
+const uint32_t EfcErrorFlags = EEFC_FSR_FLOCKE | EEFC_FSR_FCMDE;
+#endif
+
+enum class Phase : uint8_t { none, unlock, erase, write };
+
+static FlashProgrammer::Status status = FlashProgrammer::idle;
+static Phase phase = Phase::none;
+static Phase nextPhase;								// phase to enter after unlocking
+static uint32_t opStart;							// start address of the operation
+static uint32_t opEnd;								// end address of the operation
+static uint32_t currentAddress;						// address that the next step works on
+static const uint8_t *writeData;					// data for a write operation
+static uint32_t writeCommand;						// EFC command that programs each page of a write operation
+static uint32_t pageBuffer[PageSize/sizeof(uint32_t)];
+
+// The vector table must be in RAM so that interrupts can be taken while the flash is busy. Its alignment must be a power of 2 no smaller than its size.
+alignas((NumVectors <= 64) ? 256 : 512) static uint32_t ramVectors[NumVectors];
+
+// BASEPRI value while an EFC command runs, or 0 to disable interrupts completely. This is in RAM like everything else used by RunEfcCommand.
+static uint32_t commandBasepri = 0;
+
+// Issue an EFC command and wait for it to finish. This runs from RAM. Only interrupts allowed by commandBasepri can occur while it waits.
+__no_inline RAMFUNC static uint32_t RunEfcCommand(Efc *efc, uint32_t command, uint32_t argument)
+{
+	const uint32_t oldBasepri = __get_BASEPRI();
+	const uint32_t oldPrimask = __get_PRIMASK();
+	if (commandBasepri == 0)
+	{
+		__disable_irq();
+	}
+	else
+	{
+		__set_BASEPRI(commandBasepri);
+	}
+	__DSB();
+	__ISB();
+
+	efc->EEFC_FCR = (0x5Au << EEFC_FCR_FKEY_Pos) | EEFC_FCR_FARG(argument) | (command << EEFC_FCR_FCMD_Pos);
+	uint32_t fsr;
+	do
+	{
+		fsr = efc->EEFC_FSR;
+	} while ((fsr & EEFC_FSR_FRDY) == 0);
+
+	__set_BASEPRI(oldBasepri);
+	__set_PRIMASK(oldPrimask);
+	return fsr & EfcErrorFlags;
+}
+
+// Get the flash controller for an address and the page number within its bank
+static Efc *GetEfc(uint32_t address, uint32_t& page)
+{
+#if SAM3XA
+	if (address >= IFLASH1_ADDR)
+	{
+		page = (address - IFLASH1_ADDR)/PageSize;
+		return EFC1;
+	}
+	page = (address - IFLASH0_ADDR)/PageSize;
+	return EFC0;
+#elif SAM4S
+# ifdef IFLASH1_ADDR
+	if (address >= IFLASH1_ADDR)
+	{
+		page = (address - IFLASH1_ADDR)/PageSize;
+		return EFC1;
+	}
+# endif
+	page = (address - IFLASH0_ADDR)/PageSize;
+	return EFC0;
+#else
+	page = (address - IFLASH_ADDR)/PageSize;
+	return EFC;
+#endif
+}
+
+// Run a command that programs the page latch buffer into flash
+static bool ProgramPage(uint32_t pageAddress, uint32_t command)
+{
+	uint32_t page;
+	Efc * const efc = GetEfc(pageAddress, page);
+#if SAM3XA
+	// According to the errata, the wait state must be set to 6 while programming
+	const uint32_t fws = efc_get_wait_state(efc);
+	efc_set_wait_state(efc, 6);
+#endif
+	const uint32_t rc = RunEfcCommand(efc, command, page);
+#if SAM3XA
+	efc_set_wait_state(efc, fws);
+#endif
+	return rc == 0;
+}
+
+void FlashProgrammer::init(uint32_t ramIrqPriorityLimit)
+{
+	commandBasepri = (ramIrqPriorityLimit == 0) ? 0 : (ramIrqPriorityLimit << (8 - __NVIC_PRIO_BITS)) & 0xFF;
+
+	const irqflags_t flags = cpu_irq_save();
+	if (SCB->VTOR != (uint32_t)ramVectors)
+	{
+		memcpy(ramVectors, (const void *)SCB->VTOR, sizeof(ramVectors));
+		__DSB();
+		SCB->VTOR = (uint32_t)ramVectors;
+		__DSB();
+		__ISB();
+	}
+	cpu_irq_restore(flags);
+}
+
+// Set up a new operation. It starts by unlocking the lock regions it covers.
+static bool StartOperation(uint32_t address, uint32_t length, Phase mainPhase)
+{
+	if (status == FlashProgrammer::busy || length == 0 || address < FlashStart || address + length > FlashEnd || address + length < address)
+	{
+		return false;
+	}
+	opStart = address;
+	opEnd = address + length;
+	currentAddress = address - (address % LockRegionSize);
+	nextPhase = mainPhase;
+	phase = Phase::unlock;
+	status = FlashProgrammer::busy;
+	return true;
+}
+
+bool FlashProgrammer::startErase(uint32_t address, uint32_t length)
+{
+	if ((address % FLASH_PROGRAMMER_ERASE_SIZE) != 0 || (length % FLASH_PROGRAMMER_ERASE_SIZE) != 0)
+	{
+		return false;
+	}
+	return StartOperation(address, length, Phase::erase);
+}
+
+bool FlashProgrammer::startWrite(uint32_t address, const void *data, uint32_t length)
+{
+	if (data == nullptr || !StartOperation(address, length, Phase::write))
+	{
+		return false;
+	}
+	writeData = (const uint8_t *)data;
+	writeCommand = EFC_FCMD_WP;
+	return true;
+}
+
+#if SAM3XA
+
+bool FlashProgrammer::startEraseAndWrite(uint32_t address, const void *data, uint32_t length)
+{
+	if ((address % PageSize) != 0 || !startWrite(address, data, length))
+	{
+		return false;
+	}
+	writeCommand = EFC_FCMD_EWP;
+	return true;
+}
+
+#endif
+
+FlashProgrammer::Status FlashProgrammer::spin()
+{
+	bool ok = true;
+	switch (phase)
+	{
+	case Phase::none:
+		return status;
+
+	case Phase::unlock:
+		{
+			uint32_t page;
+			Efc * const efc = GetEfc(currentAddress, page);
+			ok = RunEfcCommand(efc, EFC_FCMD_CLB, page) == 0;
+			currentAddress += LockRegionSize;
+			if (currentAddress >= opEnd)
+			{
+				phase = nextPhase;
+				currentAddress = (phase == Phase::write) ? opStart - (opStart % PageSize) : opStart;
+			}
+		}
+		break;
+
+	case Phase::erase:
+		{
+#if SAM3XA
+			// Fill the latch buffer with 0xFF and use the erase-and-write command
+			volatile uint32_t * const latch = (volatile uint32_t *)currentAddress;
+			for (size_t i = 0; i < PageSize/sizeof(uint32_t); ++i)
+			{
+				latch[i] = 0xFFFFFFFF;
+			}
+			__DSB();
+			ok = ProgramPage(currentAddress, EFC_FCMD_EWP);
+#else
+			uint32_t page;
+			Efc * const efc = GetEfc(currentAddress, page);
+			ok = RunEfcCommand(efc, EFC_FCMD_EPA, page | 2) == 0;		// FARG[1:0] = 2 means erase 16 pages
+#endif
+			currentAddress += FLASH_PROGRAMMER_ERASE_SIZE;
+			if (currentAddress >= opEnd)
+			{
+				phase = Phase::none;
+			}
+		}
+		break;
+
+	case Phase::write:
+		{
+			// Assemble the page in RAM first, because the latch buffer is written at the same addresses as the flash it replaces.
+			// Bytes outside the area being written are left as 0xFF, so the flash there is not programmed again and keeps its contents,
+			// unless the command is EWP, which erases them.
+			const uint32_t pageAddress = currentAddress;
+			const uint32_t copyStart = (pageAddress > opStart) ? pageAddress : opStart;
+			const uint32_t copyEnd = (pageAddress + PageSize < opEnd) ? pageAddress + PageSize : opEnd;
+			memset(pageBuffer, 0xFF, PageSize);
+			memcpy((uint8_t *)pageBuffer + (copyStart - pageAddress), writeData + (copyStart - opStart), copyEnd - copyStart);
+
+			// Writing 8-bit and 16-bit data to the latch buffer is not allowed
+			volatile uint32_t * const latch = (volatile uint32_t *)pageAddress;
+			for (size_t i = 0; i < PageSize/sizeof(uint32_t); ++i)
+			{
+				latch[i] = pageBuffer[i];
+			}
+			__DSB();
+			ok = ProgramPage(pageAddress, writeCommand);
+
+			// Check what was written
+			if (ok && memcmp((const void *)copyStart, writeData + (copyStart - opStart), copyEnd - copyStart) != 0)
+			{
+				ok = false;
+			}
+
+			currentAddress = pageAddress + PageSize;
+			if (currentAddress >= opEnd)
+			{
+				phase = Phase::none;
+			}
+		}
+		break;
+	}
+
+	if (!ok)
+	{
+		phase = Phase::none;
+		status = failed;
+	}
+	else if (phase == Phase::none)
+	{
+		status = idle;
+	}
+	return status;
+}
+
+FlashProgrammer::Status FlashProgrammer::getStatus()
+{
+	return status;
+}
+
+// Run the operation that has just been started until it finishes
+static bool Complete()
+{
+	FlashProgrammer::Status st;
+	do
+	{
+		st = FlashProgrammer::spin();
+	} while (st == FlashProgrammer::busy);
+	return st == FlashProgrammer::idle;
+}
+
+bool FlashProgrammer::erase(uint32_t address, uint32_t length)
+{
+	return startErase(address, length) && Complete();
+}
+
+bool FlashProgrammer::write(uint32_t address, const void *data, uint32_t length)
+{
+	return startWrite(address, data, length) && Complete();
+}
+
+#if SAM3XA
+
+bool FlashProgrammer::eraseAndWrite(uint32_t address, const void *data, uint32_t length)
+{
+	return startEraseAndWrite(address, data, length) && Complete();
+}
+
+#endif
+
+bool FlashProgrammer::setGpnvm(unsigned int bit, bool value)
+{
+	if (status == busy)
+	{
+		return false;
+	}
+#if SAM3XA || SAM4S
+	Efc * const efc = EFC0;								// the GPNVM bits are accessed through the first flash controller
+#else
+	Efc * const efc = EFC;
+#endif
+	return RunEfcCommand(efc, (value) ? EFC_FCMD_SGPB : EFC_FCMD_CGPB, bit) == 0;
+}
+
+#endif
+
+// End
@@ -0,0 +1,82 @@
+/*
+FlashProgrammer erases and programs internal flash in the background, one EFC command per call to spin().
+
+The loop that issues each EFC command and waits for it to complete runs from RAM. While the flash is busy, interrupts
+with a priority higher than a limit set by the application stay enabled, so that (for example) step generation continues.
+The handlers of those interrupts, and all the code and constant data they use, must be placed in RAM using RAMFUNC,
+because nothing can be fetched from the flash while it is being programmed.
+Lower priority interrupts are held off only while a single command runs, not for the whole operation.
+
+Writes load only the bytes being written into the page latch buffer and leave the rest of it erased, so data already
+programmed in the same page is not programmed again. Callers that append to a page must keep each write within its
+own 128-bit flash words.
+*/
+
+#ifndef FLASHPROGRAMMER_H
+#define FLASHPROGRAMMER_H
+
+#include "Core.h"
+
+#if SAM3XA || SAM4E || SAM4S || SAME70
+
+#include "efc/efc.h"
+
+// Unit of erasure. The SAM3X has no erase command, so pages are erased individually by programming them with 0xFF.
+// On the other processors 16 pages are erased by each command.
+#if SAM3XA
+# define FLASH_PROGRAMMER_ERASE_SIZE	(IFLASH1_PAGE_SIZE)
+#elif SAM4S
+# define FLASH_PROGRAMMER_ERASE_SIZE	(16 * IFLASH0_PAGE_SIZE)
+#else
+# define FLASH_PROGRAMMER_ERASE_SIZE	(16 * IFLASH_PAGE_SIZE)
+#endif
+
+namespace FlashProgrammer
+{
+	enum Status : uint8_t
+	{
+		idle,				// no operation in progress and the last one succeeded
+		busy,				// an operation is in progress
+		failed				// the last operation failed
+	};
+
+	// Set up the service. While an EFC command runs, only interrupts with a priority numerically lower than ramIrqPriorityLimit are enabled.
+	// If ramIrqPriorityLimit is 0, all interrupts are disabled while a command runs. That is also what happens if init() is never called.
+	// If ramIrqPriorityLimit is not 0, init() copies the vector table to RAM and points SCB->VTOR at the copy, because the vectors are
+	// fetched from the table when an interrupt is taken. From then on, handlers must be installed by writing to the table at SCB->VTOR,
+	// and nothing else may change SCB->VTOR. The copy uses 4 bytes of RAM per vector.
+	void init(uint32_t ramIrqPriorityLimit);
+
+	// Start erasing 'length' bytes from 'address'. Both must be multiples of FLASH_PROGRAMMER_ERASE_SIZE. Returns false if busy or the arguments are bad.
+	bool startErase(uint32_t address, uint32_t length);
+
+	// Start writing data to flash that has already been erased. The data must remain valid until the write has finished.
+	// Parts of the first and last pages outside the area written keep their contents. Returns false if busy or the arguments are bad.
+	bool startWrite(uint32_t address, const void *data, uint32_t length);
+
+#if SAM3XA
+	// Start erasing and writing whole pages, using one erase-and-write command per page instead of an erase followed by a write.
+	// 'address' must be the start of a page. The rest of the last page is erased. Returns false if busy or the arguments are bad.
+	bool startEraseAndWrite(uint32_t address, const void *data, uint32_t length);
+#endif
+
+	// Perform the next step of the current operation: unlock one lock region, erase one unit or program one page. Call this repeatedly, e.g. from the main loop.
+	Status spin();
+
+	// Get the status without doing anything
+	Status getStatus();
+
+	// Erase or write and wait until the operation has finished. Returns false if another operation is in progress or this one failed.
+	bool erase(uint32_t address, uint32_t length);
+	bool write(uint32_t address, const void *data, uint32_t length);
+#if SAM3XA
+	bool eraseAndWrite(uint32_t address, const void *data, uint32_t length);
+#endif
+
+	// Set or clear a GPNVM bit. Returns false if an operation is in progress or the command failed.
+	bool setGpnvm(unsigned int bit, bool value);
+};
+
+#endif
+
+#endif
@@ -12,6 +12,7 @@
 
 #include "Core.h"
 #include "SharedSpi.h"
+#include "SharedSpiQueue.h"
 #include "variant.h"
 
 #if SAM4E
@@ -57,62 +58,76 @@
 #endif
 
 
-/** Time-out value (number of attempts). */
-#define SPI_TIMEOUT       15000
-
 // Which SPI channel we use
 # define SSPI		SPI0
 # define ID_SSPI	ID_SPI0
 
 #endif
 
-// Wait for transmitter ready returning true if timed out
-static inline bool waitForTxReady()
+// Time-out value in microseconds
+#define SPI_TIMEOUT_MICROS	2000
+
+// On the SAM4E and SAM4S the USART has a peripheral DMA controller, which we use for longer transfers
+#if USART_SPI && (SAM4E || SAM4S)
+# define SSPI_USE_PDC		1
+const size_t PdcMinTransferLength = 16;		// shorter transfers are quicker to do by programmed I/O
+#else
+# define SSPI_USE_PDC		0
+#endif
+
+// Configuration of the last device set up, so that we can avoid reprogramming the SPI when consecutive transactions use the same settings
+static uint32_t lastClockFrequency;
+static uint8_t lastSpiMode;
+static uint8_t lastBitsPerTransferControl;
+static bool deviceConfigValid = false;
+
+// Asynchronous transaction queue
+const uint32_t sspiInterruptPriority = 5;
+static bool queueIrqEnabled = false;
+
+// Return true if the transmitter is ready
+static inline bool isTxReady()
 {
-	uint32_t timeout = SPI_TIMEOUT;
 #if USART_SPI
-	while (!usart_is_tx_ready(USART_SSPI))
+	return usart_is_tx_ready(USART_SSPI);
 #else
-	while (!spi_is_tx_ready(SSPI))
+	return spi_is_tx_ready(SSPI);
 #endif
-	{
-		if (--timeout == 0)
-		{
-			return true;
-		}
-	}
-	return false;
 }
 
-// Wait for transmitter empty returning true if timed out
-static inline bool waitForTxEmpty()
+// Return true if the transmitter is empty
+static inline bool isTxEmpty()
 {
-	uint32_t timeout = SPI_TIMEOUT;
 #if USART_SPI
-	while (!usart_is_tx_empty(USART_SSPI))
+	return usart_is_tx_empty(USART_SSPI);
 #else
-		while (!spi_is_tx_empty(SSPI))
+	return spi_is_tx_empty(SSPI);
 #endif
-	{
-		if (!timeout--)
-		{
-			return true;
-		}
-	}
-	return false;
 }
 
-// Wait for receive data available returning true if timed out
-static inline bool waitForRxReady()
+// Return true if receive data is available
+static inline bool isRxReady()
 {
-	uint32_t timeout = SPI_TIMEOUT;
 #if USART_SPI
-	while (!usart_is_rx_ready(USART_SSPI))
+	return usart_is_rx_ready(USART_SSPI);
 #else
-	while (!spi_is_rx_ready(SSPI))
+	return spi_is_rx_ready(SSPI);
 #endif
+}
+
+// Wait for the specified condition returning true if timed out. We check it before starting the wait, because usually it is already true.
+static inline bool waitFor(bool (*condition)())
+{
+	if (condition())
 	{
-		if (--timeout == 0)
+		return false;
+	}
+
+	CoreWaitState ws;
+	CoreWaitStart(&ws, SPI_TIMEOUT_MICROS);
+	while (!condition())
+	{
+		if (CoreWaitPoll(&ws))
 		{
 			return true;
 		}
@@ -120,6 +135,24 @@ static inline bool waitForRxReady()
 	return false;
 }
 
+// Wait for transmitter ready returning true if timed out
+static inline bool waitForTxReady()
+{
+	return waitFor(isTxReady);
+}
+
+// Wait for transmitter empty returning true if timed out
+static inline bool waitForTxEmpty()
+{
+	return waitFor(isTxEmpty);
+}
+
+// Wait for receive data available returning true if timed out
+static inline bool waitForRxReady()
+{
+	return waitFor(isRxReady);
+}
+
 // Set up the Shared SPI subsystem
 void sspi_master_init(struct sspi_device *device, uint32_t bits)
 {
@@ -163,6 +196,7 @@ void sspi_master_init(struct sspi_device *device, uint32_t bits)
 # endif
 
 #endif
+		deviceConfigValid = false;
 		commsInitDone = true;
 	}
 
@@ -194,6 +228,26 @@ void sspi_master_init(struct sspi_device *device, uint32_t bits)
  */
 void sspi_master_setup_device(const struct sspi_device *device)
 {
+	// Skip the reconfiguration if the settings are unchanged from the last device
+	if (   deviceConfigValid
+		&& device->clockFrequency == lastClockFrequency
+		&& device->spiMode == lastSpiMode
+		&& device->bitsPerTransferControl == lastBitsPerTransferControl
+	   )
+	{
+#if USART_SPI
+		// Still reset the receiver and transmitter, so that an overrun left by the last device doesn't affect this one
+		USART_SSPI->US_CR = US_CR_RSTRX | US_CR_RSTTX | US_CR_RSTSTA;
+		USART_SSPI->US_CR = US_CR_RXEN | US_CR_TXEN;
+#endif
+		return;
+	}
+
+	lastClockFrequency = device->clockFrequency;
+	lastSpiMode = device->spiMode;
+	lastBitsPerTransferControl = device->bitsPerTransferControl;
+	deviceConfigValid = true;
+
 #if USART_SPI
 	USART_SSPI->US_CR = US_CR_RXDIS | US_CR_TXDIS;			// disable transmitter and receiver
 	USART_SSPI->US_BRGR = SystemPeripheralClock()/device->clockFrequency;
@@ -211,7 +265,7 @@ void sspi_master_setup_device(const struct sspi_device *device)
 		mr |= US_MR_CPHA;
 	}
 	USART_SSPI->US_MR = mr;
-	USART_SSPI->US_CR = US_CR_RSTRX | US_CR_RSTTX;			// reset transmitter and receiver (required - see datasheet)
+	USART_SSPI->US_CR = US_CR_RSTRX | US_CR_RSTTX | US_CR_RSTSTA;	// reset transmitter, receiver and overrun (required - see datasheet)
 	USART_SSPI->US_CR = US_CR_RXEN | US_CR_TXEN;			// enable transmitter and receiver
 #else
 	spi_reset(SSPI);
@@ -270,6 +324,69 @@ void sspi_deselect_device(const struct sspi_device *device)
 	digitalWrite(device->csPin, !device->csPolarity);
 }
 
+#if SSPI_USE_PDC
+
+// Start the PDC sending and receiving a sequence of bytes. At least one of tx_data and rx_data must be non-null.
+static void pdcStart(const uint8_t *tx_data, uint8_t *rx_data, size_t len)
+{
+	if (tx_data == nullptr)
+	{
+		// We need to send 0xFF bytes, but the PDC always increments the transmit pointer. So fill the receive buffer with 0xFF and send that.
+		// Each byte is read by the transmitter before the byte received in its place overwrites it.
+		memset(rx_data, 0xFF, len);
+		tx_data = rx_data;
+	}
+
+	USART_SSPI->US_PTCR = US_PTCR_RXTDIS | US_PTCR_TXTDIS;
+	(void)USART_SSPI->US_RHR;								// discard any stale received data
+	if (rx_data != nullptr)
+	{
+		USART_SSPI->US_RPR = reinterpret_cast<uint32_t>(rx_data);
+		USART_SSPI->US_RCR = len;
+		USART_SSPI->US_RNCR = 0;
+	}
+	USART_SSPI->US_TPR = reinterpret_cast<uint32_t>(tx_data);
+	USART_SSPI->US_TCR = len;
+	USART_SSPI->US_TNCR = 0;
+	USART_SSPI->US_PTCR = (rx_data != nullptr) ? (US_PTCR_RXTEN | US_PTCR_TXTEN) : US_PTCR_TXTEN;
+}
+
+// Send and receive a sequence of bytes using the PDC. At least one of tx_data and rx_data must be non-null.
+static spi_status_t sspi_transceive_packet_pdc(const uint8_t *tx_data, uint8_t *rx_data, size_t len)
+{
+	pdcStart(tx_data, rx_data, len);
+
+	// Wait for the last byte to be received, or for the last byte to be handed to the transmitter if we are not receiving.
+	// Allow for the time taken to clock the data out at the current speed.
+	const uint32_t doneBit = (rx_data != nullptr) ? US_CSR_RXBUFF : US_CSR_TXBUFE;
+	const uint32_t transferMicros = (lastClockFrequency == 0) ? 0 : (uint32_t)(((uint64_t)len * 8 * 1000000)/lastClockFrequency);
+	CoreWaitState ws;
+	CoreWaitStart(&ws, SPI_TIMEOUT_MICROS + transferMicros);
+	bool timedOut = false;
+	while ((USART_SSPI->US_CSR & doneBit) == 0)
+	{
+		if (CoreWaitPoll(&ws))
+		{
+			timedOut = true;
+			break;
+		}
+	}
+	USART_SSPI->US_PTCR = US_PTCR_RXTDIS | US_PTCR_TXTDIS;
+
+	if (timedOut)
+	{
+		return SPI_ERROR_TIMEOUT;
+	}
+	if (rx_data == nullptr)
+	{
+		waitForTxEmpty();
+		(void)USART_SSPI->US_RHR;
+	}
+	return SPI_OK;
+}
+
+#endif
+
 /**
  * \brief Send and receive a sequence of bytes from an SPI device.
  *
@@ -281,6 +398,13 @@ void sspi_deselect_device(const struct sspi_device *device)
  */
 spi_status_t sspi_transceive_packet(const uint8_t *tx_data, uint8_t *rx_data, size_t len)
 {
+#if SSPI_USE_PDC
+	if (len >= PdcMinTransferLength && len <= 0xFFFF && (tx_data != nullptr || rx_data != nullptr))
+	{
+		return sspi_transceive_packet_pdc(tx_data, rx_data, len);
+	}
+#endif
+
 	for (uint32_t i = 0; i < len; ++i)
 	{
 		uint32_t dOut = (tx_data == nullptr) ? 0x000000FF : (uint32_t)*tx_data++;
@@ -381,6 +505,221 @@ spi_status_t sspi_transceive_packet16(const uint16_t *tx_data, uint16_t *rx_data
 }
 #endif
 
+// The shared SPI peripheral as seen by the transaction queue
+class SspiBus
+{
+public:
+	static void StartTransfer(struct sspi_transaction *t);
+	static void StopTransfer(struct sspi_transaction *t, bool ok);
+	static uint32_t GetTime() { return DWT->CYCCNT; }
+	static uint32_t GetTimeout(const struct sspi_transaction *t);
+	static void Interrupt();
+
+private:
+	static void WriteNextByte(const struct sspi_transaction *t);
+
+	static struct sspi_transaction * volatile current;		// the transaction using the SPI, or nullptr
+	static size_t txCount, rxCount;							// its progress when it is done by programmed I/O
+#if SSPI_USE_PDC
+	static bool usingPdc;									// true if it is done by the PDC
+#endif
+};
+
+struct sspi_transaction * volatile SspiBus::current = nullptr;
+size_t SspiBus::txCount = 0;
+size_t SspiBus::rxCount = 0;
+#if SSPI_USE_PDC
+bool SspiBus::usingPdc = false;
+#endif
+
+static SharedSpiQueue<SspiBus> queue;
+
+// Write the next byte of the transaction to the transmit register
+inline void SspiBus::WriteNextByte(const struct sspi_transaction *t)
+{
+	uint32_t dOut = (t->tx_data == nullptr) ? 0x000000FF : (uint32_t)t->tx_data[txCount];
+	++txCount;
+#if USART_SPI
+	USART_SSPI->US_THR = dOut;
+#else
+	if (txCount == t->len)
+	{
+		dOut |= SPI_TDR_LASTXFER;
+	}
+	SSPI->SPI_TDR = dOut;
+#endif
+}
+
+void SspiBus::StartTransfer(struct sspi_transaction *t)
+{
+	sspi_master_setup_device(t->device);
+	sspi_select_device(t->device);
+	txCount = rxCount = 0;
+	current = t;
+
+#if SSPI_USE_PDC
+	// Long transfers go through the PDC, which interrupts once at the end
+	usingPdc = t->len >= PdcMinTransferLength && t->len <= 0xFFFF && (t->tx_data != nullptr || t->rx_data != nullptr);
+	if (usingPdc)
+	{
+		pdcStart(t->tx_data, t->rx_data, t->len);
+		USART_SSPI->US_IER = (t->rx_data != nullptr) ? US_IER_RXBUFF : US_IER_TXBUFE;
+		return;
+	}
+#endif
+
+	// Discard any stale received data, then send the first byte and let the receive interrupt do the rest
+#if USART_SPI
+	(void)USART_SSPI->US_RHR;
+	WriteNextByte(t);
+	USART_SSPI->US_IER = US_IER_RXRDY;
+#else
+	(void)SSPI->SPI_RDR;
+	WriteNextByte(t);
+	SSPI->SPI_IER = SPI_IER_RDRF;
+#endif
+}
+
+void SspiBus::StopTransfer(struct sspi_transaction *t, bool ok)
+{
+	current = nullptr;
+#if USART_SPI
+	USART_SSPI->US_IDR = US_IDR_RXRDY | US_IDR_TXEMPTY;
+# if SSPI_USE_PDC
+	USART_SSPI->US_IDR = US_IDR_RXBUFF | US_IDR_TXBUFE;
+	USART_SSPI->US_PTCR = US_PTCR_RXTDIS | US_PTCR_TXTDIS;
+# endif
+#else
+	SSPI->SPI_IDR = SPI_IDR_RDRF;
+#endif
+
+	if (!ok)
+	{
+		deviceConfigValid = false;							// reset the peripheral before the next transfer
+	}
+
+	// The transmitter is already empty, or the transfer has been abandoned, so don't wait for it before deselecting
+	digitalWrite(t->device->csPin, !t->device->csPolarity);
+}
+
+// Return the time allowed for a transaction in CPU clocks, allowing for the time taken to clock the data out
+uint32_t SspiBus::GetTimeout(const struct sspi_transaction *t)
+{
+	const uint32_t clock = t->device->clockFrequency;
+	const uint64_t micros = SPI_TIMEOUT_MICROS + ((clock == 0) ? 0 : ((uint64_t)t->len * 8 * 1000000)/clock);
+	const uint64_t cycles = micros * (SystemCoreClock/1000000);
+	return (cycles > 0xFFFFFFFF) ? 0xFFFFFFFF : (uint32_t)cycles;
+}
+
+void SspiBus::Interrupt()
+{
+	struct sspi_transaction * const t = current;
+
+#if SSPI_USE_PDC
+	if (t != nullptr && usingPdc)
+	{
+		const uint32_t events = USART_SSPI->US_CSR & USART_SSPI->US_IMR;
+		if ((events & US_CSR_RXBUFF) != 0)
+		{
+			queue.TransferDone(SPI_OK);
+		}
+		else if ((events & US_CSR_TXBUFE) != 0)
+		{
+			// The last byte has been handed to the transmitter, so wait for it to be shifted out
+			USART_SSPI->US_IDR = US_IDR_TXBUFE;
+			USART_SSPI->US_IER = US_IER_TXEMPTY;
+		}
+		else if ((events & US_CSR_TXEMPTY) != 0)
+		{
+			(void)USART_SSPI->US_RHR;
+			USART_SSPI->US_CR = US_CR_RSTSTA;				// we didn't read the received data, so clear the overrun
+			queue.TransferDone(SPI_OK);
+		}
+		return;
+	}
+#endif
+
+#if USART_SPI
+	if ((USART_SSPI->US_IMR & US_IMR_RXRDY) == 0 || !usart_is_rx_ready(USART_SSPI))
+#else
+	if ((SSPI->SPI_IMR & SPI_IMR_RDRF) == 0 || !spi_is_rx_ready(SSPI))
+#endif
+	{
+		return;
+	}
+
+	const uint8_t dIn =
+#if USART_SPI
+			(uint8_t)USART_SSPI->US_RHR;
+#else
+			(uint8_t)SSPI->SPI_RDR;
+#endif
+	if (t == nullptr)
+	{
+		return;
+	}
+
+	if (t->rx_data != nullptr)
+	{
+		t->rx_data[rxCount] = dIn;
+	}
+	++rxCount;
+
+	if (txCount < t->len)
+	{
+		WriteNextByte(t);
+	}
+	else
+	{
+		queue.TransferDone(SPI_OK);							// this deselects the device and chains straight on to the next transaction
+	}
+}
+
+// Queue a transaction, starting it if the bus is idle
+bool sspi_queue_transaction(struct sspi_transaction *transaction)
+{
+	if (transaction->device == nullptr || (transaction->len != 0 && transaction->device->bitsPerTransferControl !=
+#if USART_SPI
+			US_MR_CHRL_8_BIT
+#else
+			SPI_CSR_BITS_8_BIT
+#endif
+	   ))
+	{
+		return false;
+	}
+
+	if (!queueIrqEnabled)
+	{
+		EnableCycleCounter();								// the time-out uses it
+		NVIC_SetPriority((IRQn_Type)ID_SSPI, sspiInterruptPriority);
+		NVIC_ClearPendingIRQ((IRQn_Type)ID_SSPI);
+		NVIC_EnableIRQ((IRQn_Type)ID_SSPI);
+		queueIrqEnabled = true;
+	}
+
+	const irqflags_t flags = cpu_irq_save();
+	queue.Add(transaction);
+	cpu_irq_restore(flags);
+	return true;
+}
+
+// Return true if the queue is not empty, first failing the transaction in progress if it has timed out
+bool sspi_queue_busy(void)
+{
+	const irqflags_t flags = cpu_irq_save();
+	(void)queue.CheckTimeout();
+	const bool busy = queue.IsBusy();
+	cpu_irq_restore(flags);
+	return busy;
+}
+
+// Interrupt handler, to be called from the SPI or USART ISR
+void sspi_irq_handler(void)
+{
+	SspiBus::Interrupt();
+}
+
 #if defined(USE_SAM3X_DMAC)
 
 void sspi_start_transmit_dma(Dmac *p_dmac, uint32_t ul_num, const void *src, uint32_t nb_bytes)
@@ -62,6 +62,24 @@ struct sspi_device {
 	uint32_t clockFrequency;
 };
 
+struct sspi_transaction;
+
+//! \brief Completion callback for a queued transaction. Called from interrupt context.
+typedef void (*sspi_callback_t)(struct sspi_transaction *transaction);
+
+//! \brief Asynchronous SPI transaction descriptor.
+// The storage is owned by the caller and must remain valid until the completion callback has been called or sspi_queue_busy() returns false.
+struct sspi_transaction {
+	const struct sspi_device *device;	// device to select, which must use 8 bits per transfer
+	const uint8_t *tx_data;				// data to send, or NULL to send 0xFF
+	uint8_t *rx_data;					// buffer for received data, or NULL to discard it
+	size_t len;							// number of bytes to transfer
+	sspi_callback_t callback;			// called when the transaction has completed, may be NULL
+	void *param;						// for use by the callback
+	volatile spi_status_t status;		// SPI_BUSY while queued or in progress, then SPI_OK or SPI_ERROR_TIMEOUT
+	struct sspi_transaction *next;		// used internally to link the queue
+};
+
 #ifdef __cplusplus
 // Use C linkage because these functions are called from the ASF SPI SD card code
 extern "C" {
@@ -126,6 +144,36 @@ static inline spi_status_t sspi_write_packet(uint8_t *buf, size_t len)
 	return sspi_transceive_packet(buf, NULL, len);
 }
 
+/**
+ * \brief Append a transaction to the asynchronous transaction queue.
+ *
+ * Transactions are executed in order under interrupt control. Each one selects its device (reconfiguring the SPI
+ * only if the mode, clock or word size differs from the previous device), transfers the data, deselects the device
+ * and calls its completion callback; the next transaction is then started immediately from the same interrupt.
+ * On the SAM4E and SAM4S, transfers of 16 bytes or more use the PDC and interrupt only at the end; other transfers interrupt once per byte.
+ * The application must call sspi_irq_handler() from the interrupt handler of the shared SPI peripheral
+ * (USART0 on SAM4E, SAM4S and SAME70 boards other than the SAME70 Xplained, otherwise SPI0), whose priority is set to 5.
+ * While the queue is busy, the synchronous functions above must not be used.
+ *
+ * \param transaction   Transaction descriptor. Its next and status fields are overwritten.
+ *
+ * \return true if the transaction was queued, false if it was invalid.
+ */
+bool sspi_queue_transaction(struct sspi_transaction *transaction);
+
+/**
+ * \brief Return true if a queued transaction is pending or in progress.
+ *
+ * If the transaction in progress has taken too long, this first completes it with status SPI_ERROR_TIMEOUT and starts the next one,
+ * so poll it while waiting for a transaction. The completion callback is then called with interrupts disabled.
+ */
+bool sspi_queue_busy(void);
+
+/**
+ * \brief Interrupt handler for the asynchronous transaction queue.
+ */
+void sspi_irq_handler(void);
+
 #if SAM3XA
 /**
  * \brief Send and receive a sequence of 16-bit words from the shared SPI device.
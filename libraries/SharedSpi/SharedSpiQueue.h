@@ -0,0 +1,120 @@
+/*
+ * SharedSpiQueue.h
+ *
+ * The scheduling part of the shared SPI transaction queue: ordering, chaining, completion and time-outs.
+ * It reaches the peripheral only through the Bus class, so that it can be tested on a host against a fake bus.
+ *
+ * Bus must provide these static functions:
+ *   void StartTransfer(struct sspi_transaction *t)			select the device and start the transfer; the bus calls TransferDone() when it ends
+ *   void StopTransfer(struct sspi_transaction *t, bool ok)	stop the transfer if it is still running and deselect the device
+ *   uint32_t GetTime()										the current time, in any unit that wraps round at 2^32
+ *   uint32_t GetTimeout(const struct sspi_transaction *t)	how long the transfer may take, in the same unit
+ *
+ * The queue doesn't disable interrupts itself, so call it from the SPI interrupt or with that interrupt disabled.
+ */
+
+#ifndef SHAREDSPIQUEUE_H_
+#define SHAREDSPIQUEUE_H_
+
+#include "SharedSpi.h"
+
+template<class Bus> class SharedSpiQueue
+{
+public:
+	SharedSpiQueue() : head(nullptr), tail(nullptr), active(false), startTime(0), timeout(0) { }
+
+	// Append a transaction and start it if the bus is idle
+	void Add(struct sspi_transaction *t)
+	{
+		t->status = SPI_BUSY;
+		t->next = nullptr;
+		if (head == nullptr)
+		{
+			head = t;
+		}
+		else
+		{
+			tail->next = t;
+		}
+		tail = t;
+		StartNext();
+	}
+
+	// Return true if a transaction is pending or in progress
+	bool IsBusy() const { return head != nullptr; }
+
+	// Called by the bus when the transfer of the transaction at the head of the queue has ended
+	void TransferDone(spi_status_t status)
+	{
+		if (active)
+		{
+			Complete(status);
+		}
+	}
+
+	// Fail the transaction in progress if it has taken too long. Returns true if it timed out.
+	bool CheckTimeout()
+	{
+		if (active && Bus::GetTime() - startTime >= timeout)
+		{
+			Complete(SPI_ERROR_TIMEOUT);
+			return true;
+		}
+		return false;
+	}
+
+private:
+	// End the transaction in progress and start the next one
+	void Complete(spi_status_t status)
+	{
+		struct sspi_transaction * const t = head;
+		Bus::StopTransfer(t, status == SPI_OK);
+		active = false;
+		Finish(t, status);
+		StartNext();
+	}
+
+	// Remove the transaction at the head of the queue, set its status and call its callback
+	void Finish(struct sspi_transaction *t, spi_status_t status)
+	{
+		head = t->next;
+		if (head == nullptr)
+		{
+			tail = nullptr;
+		}
+		t->status = status;
+		if (t->callback != nullptr)
+		{
+			t->callback(t);
+		}
+	}
+
+	// Start the transaction at the head of the queue, completing any of zero length.
+	// A callback may queue another transaction, which starts it, so check 'active' each time round.
+	void StartNext()
+	{
+		while (head != nullptr && !active)
+		{
+			struct sspi_transaction * const t = head;
+			if (t->len == 0)
+			{
+				Finish(t, SPI_OK);
+			}
+			else
+			{
+				active = true;
+				startTime = Bus::GetTime();
+				timeout = Bus::GetTimeout(t);
+				Bus::StartTransfer(t);
+			}
+		}
+	}
+
+	struct sspi_transaction * volatile head;
+	struct sspi_transaction * volatile tail;
+	volatile bool active;									// true while the transaction at the head of the queue is using the SPI
+	uint32_t startTime;
+	uint32_t timeout;
+};
+
+#endif /* SHAREDSPIQUEUE_H_ */
@@ -132,6 +132,7 @@ static xSemaphoreHandle ctrl_access_semphr = NULL;
     TPASTE3(Lun_, lun, _usb_write_10),\
     TPASTE3(Lun_, lun, _mem_2_ram),\
     TPASTE3(Lun_, lun, _ram_2_mem),\
+    TPASTE3(Lun_, lun, _sync),\
     TPASTE3(LUN_, lun, _NAME)\
   }
 #elif ACCESS_USB == true
@@ -156,6 +157,7 @@ static xSemaphoreHandle ctrl_access_semphr = NULL;
     TPASTE3(Lun_, lun, _removal),\
     TPASTE3(Lun_, lun, _mem_2_ram),\
     TPASTE3(Lun_, lun, _ram_2_mem),\
+    TPASTE3(Lun_, lun, _sync),\
     TPASTE3(LUN_, lun, _NAME)\
   }
 #else
@@ -185,6 +187,7 @@ static const struct
 #if ACCESS_MEM_TO_RAM == true
   Ctrl_status (*mem_2_ram)(U32, void *, U32);
   Ctrl_status (*ram_2_mem)(U32, const void *, U32);
+  Ctrl_status (*sync)(bool);
 #endif
   const char *name;
 } lun_desc[MAX_LUN] =
@@ -192,48 +195,72 @@ static const struct
 #if LUN_0 == ENABLE
 # ifndef Lun_0_unload
 #  define Lun_0_unload NULL
+# endif
+# ifndef Lun_0_sync
+#  define Lun_0_sync NULL
 # endif
   Lun_desc_entry(0),
 #endif
 #if LUN_1 == ENABLE
 # ifndef Lun_1_unload
 #  define Lun_1_unload NULL
+# endif
+# ifndef Lun_1_sync
+#  define Lun_1_sync NULL
 # endif
   Lun_desc_entry(1),
 #endif
 #if LUN_2 == ENABLE
 # ifndef Lun_2_unload
 #  define Lun_2_unload NULL
+# endif
+# ifndef Lun_2_sync
+#  define Lun_2_sync NULL
 # endif
   Lun_desc_entry(2),
 #endif
 #if LUN_3 == ENABLE
 # ifndef Lun_3_unload
 #  define Lun_3_unload NULL
+# endif
+# ifndef Lun_3_sync
+#  define Lun_3_sync NULL
 # endif
   Lun_desc_entry(3),
 #endif
 #if LUN_4 == ENABLE
 # ifndef Lun_4_unload
 #  define Lun_4_unload NULL
+# endif
+# ifndef Lun_4_sync
+#  define Lun_4_sync NULL
 # endif
   Lun_desc_entry(4),
 #endif
 #if LUN_5 == ENABLE
 # ifndef Lun_5_unload
 #  define Lun_5_unload NULL
+# endif
+# ifndef Lun_5_sync
+#  define Lun_5_sync NULL
 # endif
   Lun_desc_entry(5),
 #endif
 #if LUN_6 == ENABLE
 # ifndef Lun_6_unload
 #  define Lun_6_unload NULL
+# endif
+# ifndef Lun_6_sync
+#  define Lun_6_sync NULL
 # endif
   Lun_desc_entry(6),
 #endif
 #if LUN_7 == ENABLE
 # ifndef Lun_7_unload
 #  define Lun_7_unload NULL
+# endif
+# ifndef Lun_7_sync
+#  define Lun_7_sync NULL
 # endif
   Lun_desc_entry(7)
 #endif
@@ -591,6 +618,27 @@ Ctrl_status ram_2_memory(U8 lun, U32 addr, const void *ram, uint32_t numBlocks)
 }
 
 
+Ctrl_status memory_sync(U8 lun, bool only_if_expired)
+{
+  Ctrl_status status;
+#if MAX_LUN==0
+  UNUSED(lun);
+#endif
+
+  if (!Ctrl_access_lock()) return CTRL_FAIL;
+
+  status =
+#if MAX_LUN
+           (lun < MAX_LUN) ? (lun_desc[lun].sync ? lun_desc[lun].sync(only_if_expired) : CTRL_GOOD) :
+#endif
+                             CTRL_GOOD;
+
+  Ctrl_access_unlock();
+
+  return status;
+}
+
+
 //! @}
 
 #endif  // ACCESS_MEM_TO_RAM == true
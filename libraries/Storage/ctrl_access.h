@@ -337,6 +337,16 @@ extern Ctrl_status memory_2_ram(U8 lun, U32 addr, void *ram, uint32_t numBlocks)
  */
 extern Ctrl_status ram_2_memory(U8 lun, U32 addr, const void *ram, uint32_t numBlocks);
 
+/*! \brief Writes any data held in a write-back cache to the memory.
+ *
+ * \param lun   Logical Unit Number.
+ * \param only_if_expired  If true, only write cached data that has been held for longer than the cache timeout.
+ *                         Call it this way periodically; call it with false to implement a sync request.
+ *
+ * \return Status.
+ */
+extern Ctrl_status memory_sync(U8 lun, bool only_if_expired);
+
 //! @}
 
 #endif  // ACCESS_MEM_TO_RAM == true
@@ -49,6 +49,7 @@
 #include "sd_mmc_protocol.h"
 #include "sd_mmc.h"
 #include "conf_sd_mmc.h"
+#include "sd_mmc_mem.h"
 
 #include "Core.h"		// for digitalRead() and pinMode()
 
@@ -80,33 +81,6 @@ extern void debugPrintf(const char* fmt, ...);
 #  error SD_MMC_SPI_MEM_CNT not defined
 #endif
 
-typedef void (*driverIdleFunc_t)(uint32_t, uint32_t);
-
-struct DriverInterface
-{
-	void (*select_device)(uint8_t slot, uint32_t clock, uint8_t bus_width, bool high_speed);
-	void (*deselect_device)(uint8_t slot);
-	uint8_t (*get_bus_width)(uint8_t slot);
-	bool (*is_high_speed_capable)(void);
-	void (*send_clock)(void);
-	bool (*send_cmd)(sdmmc_cmd_def_t cmd, uint32_t arg);
-	uint32_t (*get_response)(void);
-	void (*get_response_128)(uint8_t* response);
-	bool (*adtc_start)(sdmmc_cmd_def_t cmd, uint32_t arg, uint16_t block_size, uint16_t nb_block, bool access_block);
-	bool (*adtc_stop)(sdmmc_cmd_def_t cmd, uint32_t arg);
-	bool (*read_word)(uint32_t* value);
-	bool (*write_word)(uint32_t value);
-	bool (*start_read_blocks)(void *dest, uint16_t nb_block);
-	bool (*wait_end_of_read_blocks)(void);
-	bool (*start_write_blocks)(const void *src, uint16_t nb_block);
-	bool (*wait_end_of_write_blocks)(void);
-#if 1	//dc42
-	uint32_t (*getInterfaceSpeed)(void);
-#endif
-	driverIdleFunc_t (*set_idle_func)(driverIdleFunc_t);
-	bool is_spi;			// true if the interface is SPI, false if it is HSMCI
-};
-
 #if (SD_MMC_HSMCI_MEM_CNT != 0)
 #  include "hsmci.h"
 
@@ -201,6 +175,17 @@ struct sd_mmc_card {
 	uint8_t bus_width;			//!< Number of DATA lines on bus (MCI only)
 	uint8_t csd[CSD_REG_BSIZE];	//!< CSD register
 	uint8_t high_speed;			//!< High speed card (1)
+#if 1	// dc42
+	bool hs_disabled;			// true if high speed mode failed on this card, so it must run at default speed
+	uint8_t hs_crc_errors;		// number of CRC errors since the card was switched to high speed mode
+
+	// Transfer context. This is kept per slot so that slots on different interfaces can have transfers in progress at the same time.
+	bool selected;					// true if the card is selected in its driver
+	bool stream_open;				// true if a multi-block read has been left open for streaming
+	uint16_t nb_block_to_transfer;	// number of blocks to read or write in the current transfer
+	uint16_t nb_block_remaining;	// number of blocks remaining to read or write in the current transfer
+	uint32_t stream_next_block;		// next block that the open streaming read will deliver
+#endif
 };
 
 //! SD/MMC card list
@@ -210,10 +195,40 @@ static struct sd_mmc_card sd_mmc_cards[SD_MMC_MEM_CNT];
 static uint8_t sd_mmc_slot_sel;
 //! Pointer on current slot selected
 static struct sd_mmc_card *sd_mmc_card;
-//! Number of block to read or write on the current transfer
-static uint16_t sd_mmc_nb_block_to_tranfer = 0;
-//! Number of block remaining to read or write on the current transfer
-static uint16_t sd_mmc_nb_block_remaining = 0;
+
+#if 1	// dc42
+//! Queue of asynchronous requests. The request at the head of the queue is the one in progress.
+static struct sd_mmc_async_request * volatile sd_mmc_async_head = NULL;
+static struct sd_mmc_async_request * volatile sd_mmc_async_tail = NULL;
+//! True while the request at the head of the queue has been started and not yet finished
+static volatile bool sd_mmc_async_active = false;
+//! Set by the interrupt handler when the data phase of the active request has ended
+static volatile bool sd_mmc_async_data_done = false;
+//! True while an asynchronous request is being started, so that sd_mmc_select_slot claims the interface for the queue
+static bool sd_mmc_async_starting = false;
+
+//! Synchronous calls and the asynchronous queue take turns to own the HSMCI interface
+#define SD_MMC_OWNER_NONE		0
+#define SD_MMC_OWNER_SYNC		1
+#define SD_MMC_OWNER_ASYNC		2
+static volatile uint8_t sd_mmc_hsmci_owner = SD_MMC_OWNER_NONE;
+
+//! Latency statistics and error counters
+static struct sd_mmc_stats sd_mmc_stats;
+
+static sd_mmc_err_t sd_mmc_card_start_read_blocks(struct sd_mmc_card *card, void *dest, uint16_t nb_block);
+static sd_mmc_err_t sd_mmc_card_wait_end_of_read_blocks(struct sd_mmc_card *card, bool abort);
+static sd_mmc_err_t sd_mmc_card_start_write_blocks(struct sd_mmc_card *card, const void *src, uint16_t nb_block);
+static sd_mmc_err_t sd_mmc_card_wait_end_of_write_blocks(struct sd_mmc_card *card, bool abort);
+static void sd_mmc_card_abort_blocks(struct sd_mmc_card *card, bool write);
+static void sd_mmc_stop_card_read_stream(struct sd_mmc_card *card);
+static void sd_mmc_stop_read_streams(const struct DriverInterface *iface);
+
+//! Number of times the SD Status is read back to check the bus after switching to high speed mode
+#define SD_MMC_HS_VERIFY_READS		4
+//! Number of CRC errors in high speed mode after which the card is initialised at default speed next time
+#define SD_MMC_HS_MAX_CRC_ERRORS	8
+#endif
 
 //! SD/MMC transfer rate unit codes (10K) list
 const uint32_t sd_mmc_trans_units[7] = {
@@ -239,6 +254,7 @@ static bool sdio_get_max_speed(void);
 static bool sdio_cmd52_set_bus_width(void);
 static bool sdio_cmd52_set_high_speed(void);
 static bool sd_cm6_set_high_speed(void);
+static bool sd_cm6_set_default_speed(void);	// dc42
 static bool mmc_cmd6_set_bus_width(uint8_t bus_width);
 static bool mmc_cmd6_set_high_speed(void);
 static bool sd_cmd8(uint8_t * v2);
@@ -255,6 +271,8 @@ static bool sdio_cmd53(uint8_t rw_flag, uint8_t func_nb, uint32_t reg_addr,
 		uint8_t inc_addr, uint32_t size, bool access_block);
 #endif // SDIO_SUPPORT_ENABLE
 static bool sd_acmd6(void);
+static bool sd_acmd23(uint16_t nb_block);
+static bool sd_acmd13(uint8_t *sd_status);	// dc42
 static bool sd_acmd51(void);
 //! @}
 
@@ -263,10 +281,14 @@ static bool sd_acmd51(void);
 static sd_mmc_err_t sd_mmc_select_slot(uint8_t slot);
 static void sd_mmc_configure_slot(void);
 static void sd_mmc_deselect_slot(void);
+static void sd_mmc_deselect_card(struct sd_mmc_card *card);	// dc42
+static bool sd_mmc_claim_interface(const struct DriverInterface *iface, uint8_t owner);	// dc42
+static void sd_mmc_release_interface(const struct DriverInterface *iface, uint8_t owner);	// dc42
 static bool sd_mmc_spi_card_init(void);
 static bool sd_mmc_mci_card_init(void);
 static bool sd_mmc_spi_install_mmc(void);
 static bool sd_mmc_mci_install_mmc(void);
+static bool sd_mmc_mci_negotiate_high_speed(void);	// dc42
 //! @}
 
 
@@ -850,6 +872,48 @@ static bool sd_cm6_set_high_speed(void)
 	return true;
 }
 
+#if 1	// dc42
+/**
+ * \brief CMD6 for SD - Switch card back to default speed mode
+ *
+ * \note CMD6 for SD is valid under the "trans" state.
+ * \note The caller must already have set sd_mmc_card->high_speed and
+ * sd_mmc_card->clock back to their default speed values.
+ *
+ * \return true if success, otherwise false
+ */
+static bool sd_cm6_set_default_speed(void)
+{
+	uint8_t switch_status[SD_SW_STATUS_BSIZE];
+
+	if (!sd_mmc_card->iface->adtc_start(SD_CMD6_SWITCH_FUNC,
+			SD_CMD6_MODE_SWITCH
+			| SD_CMD6_GRP6_NO_INFLUENCE
+			| SD_CMD6_GRP5_NO_INFLUENCE
+			| SD_CMD6_GRP4_NO_INFLUENCE
+			| SD_CMD6_GRP3_NO_INFLUENCE
+			| SD_CMD6_GRP2_DEFAULT
+			| SD_CMD6_GRP1_DEFAULT,
+			SD_SW_STATUS_BSIZE, 1, true)) {
+		return false;
+	}
+	if (!sd_mmc_card->iface->start_read_blocks(switch_status, 1)) {
+		return false;
+	}
+	if (!sd_mmc_card->iface->wait_end_of_read_blocks()) {
+		return false;
+	}
+	if (sd_mmc_card->iface->get_response() & CARD_STATUS_SWITCH_ERROR) {
+		sd_mmc_debug("%s: CMD6 CARD_STATUS_SWITCH_ERROR\n\r", __func__);
+		return false;
+	}
+	// CMD6 function switching period is within 8 clocks
+	// after the end bit of status data.
+	sd_mmc_card->iface->send_clock();
+	return true;
+}
+#endif
+
 /**
  * \brief CMD6 for MMC - Switches the bus width mode
  *
@@ -1103,11 +1167,30 @@ static void mmc_decode_csd(void)
 	}
 }
 
+#if 1	// dc42
+/**
+ * \brief Get the default speed clock of an SD card from the TRAN_SPEED field of its CSD
+ *
+ * \return Maximum transfer speed in Hz
+ */
+static uint32_t sd_csd_default_clock(void)
+{
+	const uint32_t tran_speed = CSD_TRAN_SPEED(sd_mmc_card->csd);
+	const uint32_t unit = sd_mmc_trans_units[tran_speed & 0x7];
+	const uint32_t mul = sd_trans_multipliers[(tran_speed >> 3) & 0xF];
+	return unit * mul * 1000;
+}
+#endif
+
 /**
  * \brief Decodes SD CSD register
  */
 static void sd_decode_csd(void)
 {
+#if 1	// dc42
+	// Get SD memory maximum transfer speed in Hz.
+	sd_mmc_card->clock = sd_csd_default_clock();
+#else
  	uint32_t unit;
 	uint32_t mul;
 	uint32_t tran_speed;
@@ -1117,6 +1200,7 @@ static void sd_decode_csd(void)
 	unit = sd_mmc_trans_units[tran_speed & 0x7];
 	mul = sd_trans_multipliers[(tran_speed >> 3) & 0xF];
 	sd_mmc_card->clock = unit * mul * 1000;
+#endif
 
 	/*
 	 * Get card capacity.
@@ -1270,6 +1354,56 @@ static bool sd_acmd6(void)
 	return true;
 }
 
+/**
+ * \brief ACMD23 - Set the number of blocks to pre-erase before a multi-block write.
+ *
+ * \note
+ * The setting only applies to the next write command. Pre-erasing allows the
+ * card to write the blocks faster.
+ *
+ * \param nb_block  Number of blocks that will be written
+ *
+ * \return true if success, otherwise false
+ */
+static bool sd_acmd23(uint16_t nb_block)
+{
+	// CMD55 - Indicate to the card that the next command is an
+	// application specific command rather than a standard command.
+	if (!sd_mmc_card->iface->send_cmd(SDMMC_CMD55_APP_CMD, (uint32_t)sd_mmc_card->rca << 16)) {
+		return false;
+	}
+	return sd_mmc_card->iface->send_cmd(SD_ACMD23_SET_WR_BLK_ERASE_COUNT, nb_block);
+}
+
+#if 1	// dc42
+/**
+ * \brief ACMD13 - Read the SD Status register.
+ *
+ * \note The SD Status does not change while the card is in use, so it is
+ * used as a known pattern when checking that the bus works at a new speed.
+ *
+ * \param sd_status  Buffer of SD_STATUS_BSIZE bytes to receive the status
+ *
+ * \return true if success, otherwise false
+ */
+static bool sd_acmd13(uint8_t *sd_status)
+{
+	// CMD55 - Indicate to the card that the next command is an
+	// application specific command rather than a standard command.
+	if (!sd_mmc_card->iface->send_cmd(SDMMC_CMD55_APP_CMD, (uint32_t)sd_mmc_card->rca << 16)) {
+		return false;
+	}
+	if (!sd_mmc_card->iface->adtc_start(SD_ACMD13_SD_STATUS, 0,
+			SD_STATUS_BSIZE, 1, true)) {
+		return false;
+	}
+	if (!sd_mmc_card->iface->start_read_blocks(sd_status, 1)) {
+		return false;
+	}
+	return sd_mmc_card->iface->wait_end_of_read_blocks();
+}
+#endif
+
 /**
  * \brief ACMD51 - Read the SD Configuration Register.
  *
@@ -1343,7 +1477,16 @@ static sd_mmc_err_t sd_mmc_select_slot(uint8_t slot)
 	if (slot >= SD_MMC_MEM_CNT) {
 		return SD_MMC_ERR_SLOT;
 	}
-	Assert(sd_mmc_nb_block_remaining == 0);
+#if 1	// dc42
+	const struct DriverInterface * const iface = sd_mmc_cards[slot].iface;
+	// Any new command must terminate streaming reads on the same interface first.
+	// There are none while the asynchronous queue owns the interface, because starting a request terminated them.
+	sd_mmc_stop_read_streams(iface);
+	if (!sd_mmc_claim_interface(iface, (sd_mmc_async_starting) ? SD_MMC_OWNER_ASYNC : SD_MMC_OWNER_SYNC)) {
+		return SD_MMC_ERR_BUSY;
+	}
+	Assert(sd_mmc_cards[slot].nb_block_remaining == 0);
+#endif
 
 #if 1	// dc42
 	// RepRapFirmware now handles the card detect pin and debouncing, so ignore the card detect pin here
@@ -1399,6 +1542,7 @@ static sd_mmc_err_t sd_mmc_select_slot(uint8_t slot)
 	sd_mmc_slot_sel = slot;
 	sd_mmc_card = &sd_mmc_cards[slot];
 	sd_mmc_configure_slot();
+	sd_mmc_card->selected = true;	// dc42
 	return (sd_mmc_cards[slot].state == SD_MMC_CARD_STATE_INIT) ?
 			SD_MMC_INIT_ONGOING : SD_MMC_OK;
 }
@@ -1416,11 +1560,65 @@ static void sd_mmc_configure_slot(void)
  */
 static void sd_mmc_deselect_slot(void)
 {
+#if 1	// dc42
+	sd_mmc_deselect_card(sd_mmc_card);
+#else
 	if (sd_mmc_slot_sel < SD_MMC_MEM_CNT) {
 		sd_mmc_card->iface->deselect_device(sd_mmc_card->slot);
 		sd_mmc_slot_sel = 0xFF;					// No slot selected
 	}
+#endif
+}
+
+#if 1	// dc42
+/**
+ * \brief Deselect a card, which need not be the current one
+ */
+static void sd_mmc_deselect_card(struct sd_mmc_card *card)
+{
+	if (card != NULL && card->selected) {
+		card->selected = false;
+		card->iface->deselect_device(card->slot);
+		if (card == sd_mmc_card) {
+			sd_mmc_slot_sel = 0xFF;				// No slot selected
+		}
+		sd_mmc_release_interface(card->iface, SD_MMC_OWNER_SYNC);	// the asynchronous queue releases the interface itself
+	}
+}
+
+/**
+ * \brief Claim an interface for synchronous calls or for the asynchronous queue
+ *
+ * \return false if the other kind of user owns it. Only the HSMCI interface is claimed, because asynchronous requests can't use SPI slots.
+ */
+static bool sd_mmc_claim_interface(const struct DriverInterface *iface, uint8_t owner)
+{
+#if (SD_MMC_HSMCI_MEM_CNT != 0)
+	if (iface == &hsmciInterface) {
+		const irqflags_t flags = cpu_irq_save();
+		const bool ok = (sd_mmc_hsmci_owner == SD_MMC_OWNER_NONE || sd_mmc_hsmci_owner == owner);
+		if (ok) {
+			sd_mmc_hsmci_owner = owner;
+		}
+		cpu_irq_restore(flags);
+		return ok;
+	}
+#endif
+	return true;
+}
+
+/**
+ * \brief Release an interface if it is owned by the given kind of user
+ */
+static void sd_mmc_release_interface(const struct DriverInterface *iface, uint8_t owner)
+{
+#if (SD_MMC_HSMCI_MEM_CNT != 0)
+	if (iface == &hsmciInterface && sd_mmc_hsmci_owner == owner) {
+		sd_mmc_hsmci_owner = SD_MMC_OWNER_NONE;
+	}
+#endif
 }
+#endif
 
 /**
  * \brief Initialize the SD card in SPI mode.
@@ -1466,6 +1664,20 @@ static bool sd_mmc_spi_card_init(void)
 			return sd_mmc_spi_install_mmc();
 		}
 
+#if 1	// dc42
+		/* Enable CRC checking so that corrupted data blocks are detected.
+		 * If the card doesn't accept that, make sure that CRC checking is disabled as in the original code.
+		 * Unfortunately, specific SDIO card does not support it
+		 * (H&D wireless card - HDG104 WiFi SIP)
+		 * and the command is send only on SD card.
+		 */
+		if (!sd_mmc_card->iface->send_cmd(SDMMC_SPI_CMD59_CRC_ON_OFF, 1)) {
+			sd_mmc_debug("%s: CMD59 CRC on failed\n\r", __func__);
+			if (!sd_mmc_card->iface->send_cmd(SDMMC_SPI_CMD59_CRC_ON_OFF, 0)) {
+				return false;
+			}
+		}
+#else
 		/* The CRC on card is disabled by default.
 		 * However, to be sure, the CRC OFF command is send.
 		 * Unfortunately, specific SDIO card does not support it
@@ -1475,6 +1687,7 @@ static bool sd_mmc_spi_card_init(void)
 		if (!sd_mmc_card->iface->send_cmd(SDMMC_SPI_CMD59_CRC_ON_OFF, 0)) {
 			return false;
 		}
+#endif
 	}
 	// SD MEMORY
 	if (sd_mmc_card->type & CARD_TYPE_SD) {
@@ -1511,6 +1724,57 @@ static bool sd_mmc_spi_card_init(void)
 	return true;
 }
 
+#if 1	// dc42
+/**
+ * \brief Switch an SD card to high speed mode and check that the bus works at the higher clock.
+ *
+ * \note
+ * The SD Status is read at default speed, then CMD6 switches the card to high
+ * speed and the SD Status is read back several times and compared. If a read
+ * fails (e.g. with a data CRC error) or returns different data, the card is
+ * switched back to default speed and checked again. A card that has failed in
+ * high speed mode is left at default speed until a different card is inserted.
+ *
+ * \return true if the card is usable at the selected speed, otherwise false
+ */
+static bool sd_mmc_mci_negotiate_high_speed(void)
+{
+	if (sd_mmc_card->hs_disabled) {
+		return true;
+	}
+
+	uint8_t reference[SD_STATUS_BSIZE];
+	if (!sd_acmd13(reference)) {
+		return false;
+	}
+	if (!sd_cm6_set_high_speed()) {
+		return false;
+	}
+	if (!sd_mmc_card->high_speed) {
+		return true;		// the card doesn't support high speed mode
+	}
+	sd_mmc_card->hs_crc_errors = 0;
+	sd_mmc_configure_slot();
+
+	uint8_t sd_status[SD_STATUS_BSIZE];
+	for (unsigned int i = 0; i < SD_MMC_HS_VERIFY_READS; ++i) {
+		if (!sd_acmd13(sd_status) || memcmp(sd_status, reference, SD_STATUS_BSIZE) != 0) {
+			sd_mmc_debug("%s: high speed read-back failed, using default speed\n\r", __func__);
+			sd_mmc_card->hs_disabled = true;
+			sd_mmc_card->high_speed = 0;
+			sd_mmc_card->clock = sd_csd_default_clock();		// the CSD was read before switching to high speed
+			sd_mmc_configure_slot();
+			++sd_mmc_stats.hs_fallbacks;
+			if (!sd_cm6_set_default_speed() || !sd_acmd13(sd_status)) {
+				return false;
+			}
+			return memcmp(sd_status, reference, SD_STATUS_BSIZE) == 0;
+		}
+	}
+	return true;
+}
+#endif
+
 /**
  * \brief Initialize the SD card in MCI mode.
  *
@@ -1524,6 +1788,10 @@ static bool sd_mmc_spi_card_init(void)
 static bool sd_mmc_mci_card_init(void)
 {
 	uint8_t v2 = 0;
+#if 1	// dc42
+	uint8_t old_csd[CSD_REG_BSIZE];
+	memcpy(old_csd, sd_mmc_card->csd, CSD_REG_BSIZE);
+#endif
 
 	// In first, try to install SD/SDIO card
 	sd_mmc_card->type = CARD_TYPE_SD;
@@ -1575,6 +1843,12 @@ static bool sd_mmc_mci_card_init(void)
 			return false;
 		}
 		sd_decode_csd();
+#if 1	// dc42
+		if (memcmp(old_csd, sd_mmc_card->csd, CSD_REG_BSIZE) != 0) {
+			// It's a different card, so let it try high speed mode
+			sd_mmc_card->hs_disabled = false;
+		}
+#endif
 	}
 	// Select the and put it into Transfer Mode
 	if (!sd_mmc_card->iface->send_cmd(SDMMC_CMD7_SELECT_CARD_CMD,
@@ -1616,9 +1890,15 @@ static bool sd_mmc_mci_card_init(void)
 		}
 		if (sd_mmc_card->type & CARD_TYPE_SD) {
 			if (sd_mmc_card->version > CARD_VER_SD_1_0) {
+#if 1	// dc42
+				if (!sd_mmc_mci_negotiate_high_speed()) {
+					return false;
+				}
+#else
 				if (!sd_cm6_set_high_speed()) {
 					return false;
 				}
+#endif
 			}
 		}
 		// Valid new configuration
@@ -1774,6 +2054,7 @@ static bool sd_mmc_mci_install_mmc(void)
 
 void sd_mmc_init(const Pin wpPins[], const Pin spiCsPins[])
 {
+	EnableCycleCounter();						// used to measure latencies
 	for (size_t slot = 0; slot < SD_MMC_MEM_CNT; slot++)
 	{
 		struct sd_mmc_card *card = &sd_mmc_cards[slot];
@@ -1809,6 +2090,15 @@ void sd_mmc_init(const Pin wpPins[], const Pin spiCsPins[])
 #endif
 }
 
+void sd_mmc_set_driver_interface(uint8_t slot, const struct DriverInterface *iface, uint8_t driverSlot)
+{
+	if (slot < SD_MMC_MEM_CNT) {
+		sd_mmc_unmount(slot);
+		sd_mmc_cards[slot].iface = iface;
+		sd_mmc_cards[slot].slot = driverSlot;
+	}
+}
+
 uint8_t sd_mmc_nb_slot(void)
 {
 	return SD_MMC_MEM_CNT;
@@ -1827,7 +2117,14 @@ sd_mmc_err_t sd_mmc_check(uint8_t slot)
 #endif
 	if (sd_mmc_err != SD_MMC_INIT_ONGOING)
 	{
+#if 1	// dc42
+		// If the interface is busy then the slot wasn't selected, and the current card may belong to the asynchronous queue
+		if (sd_mmc_err != SD_MMC_ERR_BUSY) {
+			sd_mmc_deselect_slot();
+		}
+#else
 		sd_mmc_deselect_slot();
+#endif
 		return sd_mmc_err;
 	}
 
@@ -1888,13 +2185,370 @@ bool sd_mmc_is_write_protected(uint8_t slot)
 // Unmount the card. Must call this to force it to be re-initialised when changing card.
 void sd_mmc_unmount(uint8_t slot)
 {
+#if ((SD_MMC_0_MEM == ENABLE) || (SD_MMC_1_MEM == ENABLE)) && ACCESS_MEM_TO_RAM == true
+	sd_mmc_mem_unmount(slot);
+#endif
+	sd_mmc_stop_card_read_stream(&sd_mmc_cards[slot]);
 	sd_mmc_cards[slot].state = SD_MMC_CARD_STATE_NO_CARD;
 }
 
-// Get the interface speed in bytes/sec
+// Get the interface speed in bytes/sec, taking account of the bus width and clock negotiated with the card
 uint32_t sd_mmc_get_interface_speed(uint8_t slot)
 {
-	return sd_mmc_cards[slot].iface->getInterfaceSpeed();
+	const struct sd_mmc_card * const card = &sd_mmc_cards[slot];
+	const uint32_t speed = card->iface->getInterfaceSpeed();
+	// The HSMCI driver reports the speed of a 4-bit bus, the SPI driver the speed of its 1-bit bus
+	return (card->iface->is_spi || card->bus_width == 0) ? speed : (speed * card->bus_width)/4;
+}
+
+void sd_mmc_get_bus_config(uint8_t slot, uint32_t *clock, uint8_t *bus_width, bool *high_speed)
+{
+	const struct sd_mmc_card * const card = &sd_mmc_cards[slot];
+	const uint8_t width = (card->bus_width == 0) ? 1 : card->bus_width;
+	*clock = (sd_mmc_get_interface_speed(slot) * 8)/width;
+	*bus_width = width;
+	*high_speed = card->high_speed != 0;
+}
+
+bool sd_mmc_card_ready(uint8_t slot)
+{
+	return slot < SD_MMC_MEM_CNT && sd_mmc_cards[slot].state == SD_MMC_CARD_STATE_READY;
+}
+
+uint32_t sd_mmc_get_nb_block(uint8_t slot)
+{
+	return (sd_mmc_card_ready(slot)) ? sd_mmc_cards[slot].capacity * (1024 / SD_MMC_BLOCK_SIZE) : 0;
+}
+
+void sd_mmc_get_stats(struct sd_mmc_stats *stats)
+{
+	const irqflags_t flags = cpu_irq_save();
+	*stats = sd_mmc_stats;
+	cpu_irq_restore(flags);
+}
+
+void sd_mmc_reset_stats(void)
+{
+	const irqflags_t flags = cpu_irq_save();
+	memset(&sd_mmc_stats, 0, sizeof(sd_mmc_stats));
+	cpu_irq_restore(flags);
+}
+
+void sd_mmc_record_latency(uint8_t op, uint32_t startCycles)
+{
+	if (op >= SD_MMC_NUM_OPS) {
+		return;
+	}
+	const uint32_t micros = (DWT->CYCCNT - startCycles)/(SystemCoreClock/1000000);
+	uint32_t bucket = 32 - __CLZ(micros);		// 0 if micros is 0, else 1 + the index of the most significant 1 bit
+	if (bucket >= SD_MMC_LATENCY_BUCKETS) {
+		bucket = SD_MMC_LATENCY_BUCKETS - 1;
+	}
+
+	struct sd_mmc_latency_stats * const ls = &sd_mmc_stats.ops[op];
+	const irqflags_t flags = cpu_irq_save();
+	++ls->count;
+	ls->total_us += micros;
+	if (micros > ls->max_us) {
+		ls->max_us = micros;
+	}
+	++ls->buckets[bucket];
+	cpu_irq_restore(flags);
+}
+
+void sd_mmc_record_error(uint8_t kind)
+{
+	const irqflags_t flags = cpu_irq_save();
+	switch (kind) {
+	case SD_MMC_ERROR_CRC:
+		++sd_mmc_stats.crc_errors;
+		// The drivers don't say which slot the error was on, but only one card per interface is selected and only HSMCI cards use high speed mode
+		for (size_t slot = 0; slot < SD_MMC_MEM_CNT; ++slot) {
+			struct sd_mmc_card * const card = &sd_mmc_cards[slot];
+			if (card->selected && card->high_speed && !card->hs_disabled && ++card->hs_crc_errors >= SD_MMC_HS_MAX_CRC_ERRORS) {
+				// Too many errors at high speed, so use default speed when the card is next initialised
+				card->hs_disabled = true;
+				++sd_mmc_stats.hs_fallbacks;
+			}
+		}
+		break;
+	case SD_MMC_ERROR_TIMEOUT:
+		++sd_mmc_stats.timeouts;
+		break;
+	default:
+		++sd_mmc_stats.other_errors;
+		break;
+	}
+	cpu_irq_restore(flags);
+}
+
+// Send CMD12 to end a multi-block transfer, retrying once if it fails, and record how long it took
+static bool sd_mmc_send_stop(struct sd_mmc_card *card)
+{
+	const uint32_t startCycles = DWT->CYCCNT;
+	bool ok = card->iface->adtc_stop(SDMMC_CMD12_STOP_TRANSMISSION, 0);
+	if (!ok) {
+		++sd_mmc_stats.retries;
+		ok = card->iface->adtc_stop(SDMMC_CMD12_STOP_TRANSMISSION, 0);
+	}
+	sd_mmc_record_latency(SD_MMC_OP_STOP, startCycles);
+	return ok;
+}
+
+sd_mmc_err_t sd_mmc_read_stream(uint8_t slot, uint32_t start, void *dest, uint16_t nb_block, uint16_t nb_window)
+{
+	if (slot >= SD_MMC_MEM_CNT) {
+		return SD_MMC_ERR_SLOT;
+	}
+
+	struct sd_mmc_card * const card = &sd_mmc_cards[slot];
+	if (!sd_mmc_claim_interface(card->iface, SD_MMC_OWNER_SYNC)) {
+		return SD_MMC_ERR_BUSY;						// the asynchronous queue has terminated the stream and is using the interface
+	}
+	if (!card->stream_open || card->stream_next_block != start || card->nb_block_remaining < nb_block) {
+		// Start a new multi-block read, but don't ask for blocks beyond the end of the card
+		uint32_t nb_stream = (nb_window > nb_block) ? nb_window : nb_block;
+		const uint32_t nb_card_blocks = card->capacity * (1024 / SD_MMC_BLOCK_SIZE);
+		if (start + nb_stream > nb_card_blocks && nb_card_blocks >= start + nb_block) {
+			nb_stream = nb_card_blocks - start;
+		}
+		const sd_mmc_err_t sd_mmc_err = sd_mmc_init_read_blocks(slot, start, (uint16_t)nb_stream);		// this terminates any open streaming read on the same interface
+		if (sd_mmc_err != SD_MMC_OK) {
+			sd_mmc_release_interface(card->iface, SD_MMC_OWNER_SYNC);
+			return sd_mmc_err;
+		}
+		card->stream_open = (nb_stream > 1);
+		card->stream_next_block = start;
+	}
+
+	// Use the card's own transfer context, because commands may have been sent to a slot on another interface since the stream was opened
+	if (sd_mmc_card_start_read_blocks(card, dest, nb_block) != SD_MMC_OK || sd_mmc_card_wait_end_of_read_blocks(card, false) != SD_MMC_OK) {
+		card->stream_open = false;					// the failed transfer has been stopped and the card deselected
+		return SD_MMC_ERR_COMM;
+	}
+
+	card->stream_next_block += nb_block;
+	if (card->nb_block_remaining == 0) {
+		// sd_mmc_card_wait_end_of_read_blocks has already sent CMD12 and deselected the slot
+		card->stream_open = false;
+	} else {
+		// While the stream is parked the asynchronous queue may take the interface, terminating the stream first
+		sd_mmc_release_interface(card->iface, SD_MMC_OWNER_SYNC);
+	}
+	return SD_MMC_OK;
+}
+
+// Terminate the streaming read on a card, if there is one open
+static void sd_mmc_stop_card_read_stream(struct sd_mmc_card *card)
+{
+	if (card->stream_open) {
+		card->stream_open = false;
+		if (card->nb_block_remaining != 0) {
+			card->nb_block_remaining = 0;
+			// As in sd_mmc_wait_end_of_read_blocks, errors are ignored and we retry once
+			(void)sd_mmc_send_stop(card);
+			sd_mmc_deselect_card(card);
+		}
+	}
+}
+
+// Terminate the streaming reads on slots that use the given interface, or on all slots if iface is NULL
+static void sd_mmc_stop_read_streams(const struct DriverInterface *iface)
+{
+	for (size_t slot = 0; slot < SD_MMC_MEM_CNT; ++slot) {
+		if (iface == NULL || sd_mmc_cards[slot].iface == iface) {
+			sd_mmc_stop_card_read_stream(&sd_mmc_cards[slot]);
+		}
+	}
+}
+
+void sd_mmc_stop_read_stream(void)
+{
+	sd_mmc_stop_read_streams(NULL);
+}
+
+void sd_mmc_release_read_stream(void)
+{
+	for (size_t slot = 0; slot < SD_MMC_MEM_CNT; ++slot) {
+		if (sd_mmc_cards[slot].iface->is_spi) {
+			sd_mmc_stop_card_read_stream(&sd_mmc_cards[slot]);
+		}
+	}
+}
+
+// Remove the request at the head of the asynchronous queue, record its result and call its callback
+static void sd_mmc_async_complete(struct sd_mmc_async_request *req, sd_mmc_err_t err)
+{
+	const irqflags_t flags = cpu_irq_save();
+	sd_mmc_async_head = req->next;
+	if (sd_mmc_async_head == NULL) {
+		sd_mmc_async_tail = NULL;
+	}
+	cpu_irq_restore(flags);
+
+	req->status = err;
+	if (req->callback != NULL) {
+		req->callback(req);
+	}
+}
+
+// Start the request at the head of the asynchronous queue, completing with an error any that can't be started.
+// Called in task context when no request is active. The command phase runs here; the interrupt only signals the end of the data phase.
+// If a synchronous call owns the interface then the request stays queued and sd_mmc_async_spin() tries again later.
+static void sd_mmc_async_start(void)
+{
+	for (;;) {
+		const irqflags_t flags = cpu_irq_save();
+		struct sd_mmc_async_request * const req = sd_mmc_async_head;
+		if (req == NULL || sd_mmc_async_active) {
+			cpu_irq_restore(flags);
+			return;
+		}
+		sd_mmc_async_active = true;
+		sd_mmc_async_data_done = false;
+		cpu_irq_restore(flags);
+
+		struct sd_mmc_card * const card = &sd_mmc_cards[req->slot];
+		if (!sd_mmc_claim_interface(card->iface, SD_MMC_OWNER_ASYNC)) {
+			sd_mmc_async_active = false;
+			return;
+		}
+
+		// The current card is put back afterwards, because a synchronous transfer on a slot that uses another interface may be in progress
+		struct sd_mmc_card * const savedCard = sd_mmc_card;
+		const uint8_t savedSlot = sd_mmc_slot_sel;
+
+		sd_mmc_async_starting = true;
+		sd_mmc_err_t err = (req->write)
+							? sd_mmc_init_write_blocks(req->slot, req->start, req->nb_block)
+								: sd_mmc_init_read_blocks(req->slot, req->start, req->nb_block);
+		sd_mmc_async_starting = false;
+		sd_mmc_card = savedCard;
+		sd_mmc_slot_sel = savedSlot;
+		if (err == SD_MMC_OK) {
+			err = (req->write)
+					? sd_mmc_card_start_write_blocks(card, req->buffer, req->nb_block)
+						: sd_mmc_card_start_read_blocks(card, req->buffer, req->nb_block);
+			if (err == SD_MMC_OK) {
+#if (SD_MMC_HSMCI_MEM_CNT != 0)
+				hsmci_enable_end_of_transfer_interrupt(req->write);
+#endif
+				return;
+			}
+			sd_mmc_deselect_card(card);
+		}
+		sd_mmc_release_interface(card->iface, SD_MMC_OWNER_ASYNC);
+		sd_mmc_async_active = false;
+		sd_mmc_async_complete(req, err);
+	}
+}
+
+sd_mmc_err_t sd_mmc_async_submit(struct sd_mmc_async_request *request)
+{
+	if (request == NULL || request->buffer == NULL || request->nb_block == 0) {
+		return SD_MMC_ERR_PARAM;
+	}
+	if (request->slot >= SD_MMC_MEM_CNT) {
+		return SD_MMC_ERR_SLOT;
+	}
+#if (SD_MMC_HSMCI_MEM_CNT != 0)
+	if (sd_mmc_cards[request->slot].iface->is_spi) {
+		return SD_MMC_ERR_PARAM;				// SPI slots share the bus with other devices, so only the synchronous functions are supported
+	}
+#else
+	return SD_MMC_ERR_PARAM;
+#endif
+	if (!sd_mmc_card_ready(request->slot)) {
+		return SD_MMC_INIT_ONGOING;
+	}
+
+	request->next = NULL;
+	request->status = SD_MMC_PENDING;
+
+	const irqflags_t flags = cpu_irq_save();
+	if (sd_mmc_async_head == NULL) {
+		sd_mmc_async_head = request;
+	} else {
+		sd_mmc_async_tail->next = request;
+	}
+	sd_mmc_async_tail = request;
+	cpu_irq_restore(flags);
+
+	sd_mmc_async_start();
+	return SD_MMC_OK;
+}
+
+bool sd_mmc_async_cancel(struct sd_mmc_async_request *request)
+{
+	bool found = false;
+	const irqflags_t flags = cpu_irq_save();
+	struct sd_mmc_async_request *prev = sd_mmc_async_head;
+	if (prev == request && !sd_mmc_async_active) {
+		// The request is at the head of the queue but is waiting for a synchronous call to release the interface
+		sd_mmc_async_head = request->next;
+		if (sd_mmc_async_head == NULL) {
+			sd_mmc_async_tail = NULL;
+		}
+		found = true;
+	} else if (prev != NULL) {							// the head of the queue is in progress, so start looking after it
+		while (prev->next != NULL) {
+			if (prev->next == request) {
+				prev->next = request->next;
+				if (sd_mmc_async_tail == request) {
+					sd_mmc_async_tail = prev;
+				}
+				found = true;
+				break;
+			}
+			prev = prev->next;
+		}
+	}
+	cpu_irq_restore(flags);
+
+	if (found) {
+		request->status = SD_MMC_ERR_ABORTED;
+	}
+	return found;
+}
+
+bool sd_mmc_async_busy(void)
+{
+	return sd_mmc_async_head != NULL;
+}
+
+void sd_mmc_async_spin(void)
+{
+	struct sd_mmc_async_request * const req = sd_mmc_async_head;
+	if (sd_mmc_async_active) {
+		if (!sd_mmc_async_data_done) {
+			return;
+		}
+
+		// The data phase has ended, so send CMD12 if needed and wait for the card to finish programming
+		sd_mmc_async_data_done = false;
+		struct sd_mmc_card * const card = &sd_mmc_cards[req->slot];
+		const sd_mmc_err_t err = (req->write) ? sd_mmc_card_wait_end_of_write_blocks(card, false) : sd_mmc_card_wait_end_of_read_blocks(card, false);
+		if (err != SD_MMC_OK) {
+			sd_mmc_deselect_card(card);
+		}
+		sd_mmc_release_interface(card->iface, SD_MMC_OWNER_ASYNC);
+		sd_mmc_async_active = false;
+		sd_mmc_async_complete(req, err);
+	}
+	sd_mmc_async_start();									// start the next request, or retry one that was waiting for the interface
+}
+
+bool sd_mmc_async_irq_handler(void)
+{
+#if (SD_MMC_HSMCI_MEM_CNT != 0)
+	if (!sd_mmc_async_active || sd_mmc_async_data_done || !hsmci_disable_interrupts()) {
+		return false;
+	}
+	sd_mmc_async_data_done = true;
+	return true;
+#else
+	return false;
+#endif
 }
 
 #endif
@@ -1903,6 +2557,9 @@ sd_mmc_err_t sd_mmc_init_read_blocks(uint8_t slot, uint32_t start, uint16_t nb_b
 {
 	sd_mmc_err_t sd_mmc_err;
 	uint32_t cmd, arg, resp;
+#if 1	// dc42
+	const uint32_t startCycles = DWT->CYCCNT;
+#endif
 
 	sd_mmc_err = sd_mmc_select_slot(slot);
 	if (sd_mmc_err != SD_MMC_OK) {
@@ -1944,54 +2601,84 @@ sd_mmc_err_t sd_mmc_init_read_blocks(uint8_t slot, uint32_t start, uint16_t nb_b
 			return SD_MMC_ERR_COMM;
 		}
 	}
-	sd_mmc_nb_block_remaining = nb_block;
-	sd_mmc_nb_block_to_tranfer = nb_block;
+	sd_mmc_card->nb_block_remaining = nb_block;		// dc42
+	sd_mmc_card->nb_block_to_transfer = nb_block;		// dc42
+#if 1	// dc42
+	sd_mmc_record_latency((cmd & SDMMC_CMD_WRITE) ? SD_MMC_OP_INIT_WRITE : SD_MMC_OP_INIT_READ, startCycles);
+#endif
 	return SD_MMC_OK;
 }
 
-sd_mmc_err_t sd_mmc_start_read_blocks(void *dest, uint16_t nb_block)
+#if 1	// dc42
+// Abandon a block transfer that has failed. A multi-block command is stopped with CMD12 (except an SPI write, which the driver has already
+// ended with a stop token) and the card is deselected, which releases the interface and leaves it ready for the next command.
+static void sd_mmc_card_abort_blocks(struct sd_mmc_card *card, bool write)
+{
+	card->nb_block_remaining = 0;
+	if (card->nb_block_to_transfer > 1 && (!write || !card->iface->is_spi)) {
+		(void)sd_mmc_send_stop(card);
+	}
+	sd_mmc_deselect_card(card);
+}
+
+static sd_mmc_err_t sd_mmc_card_start_read_blocks(struct sd_mmc_card *card, void *dest, uint16_t nb_block)
 {
-	Assert(sd_mmc_nb_block_remaining >= nb_block);
+	Assert(card->nb_block_remaining >= nb_block);
 
-	if (!sd_mmc_card->iface->start_read_blocks(dest, nb_block)) {
-		sd_mmc_nb_block_remaining = 0;
+	if (!card->iface->start_read_blocks(dest, nb_block)) {
+		sd_mmc_card_abort_blocks(card, false);
 		return SD_MMC_ERR_COMM;
 	}
-	sd_mmc_nb_block_remaining -= nb_block;
+	card->nb_block_remaining -= nb_block;
 	return SD_MMC_OK;
 }
 
-sd_mmc_err_t sd_mmc_wait_end_of_read_blocks(bool abort)
+static sd_mmc_err_t sd_mmc_card_wait_end_of_read_blocks(struct sd_mmc_card *card, bool abort)
 {
-	if (!sd_mmc_card->iface->wait_end_of_read_blocks()) {
+	const uint32_t startCycles = DWT->CYCCNT;
+	if (!card->iface->wait_end_of_read_blocks()) {
+		sd_mmc_card_abort_blocks(card, false);
 		return SD_MMC_ERR_COMM;
 	}
+	sd_mmc_record_latency(SD_MMC_OP_READ_DATA, startCycles);
 	if (abort) {
-		sd_mmc_nb_block_remaining = 0;
-	} else if (sd_mmc_nb_block_remaining) {
+		card->nb_block_remaining = 0;
+	} else if (card->nb_block_remaining) {
 		return SD_MMC_OK;
 	}
 
 	// All blocks are transfered then stop read operation
-	if (sd_mmc_nb_block_to_tranfer == 1) {
+	if (card->nb_block_to_transfer == 1) {
 		// Single block transfer, then nothing to do
-		sd_mmc_deselect_slot();
+		sd_mmc_deselect_card(card);
 		return SD_MMC_OK;
 	}
 	// WORKAROUND for no compliance card (Atmel Internal ref. !MMC7 !SD19):
 	// The errors on this command must be ignored
 	// and one retry can be necessary in SPI mode for no compliance card.
-	if (!sd_mmc_card->iface->adtc_stop(SDMMC_CMD12_STOP_TRANSMISSION, 0)) {
-		sd_mmc_card->iface->adtc_stop(SDMMC_CMD12_STOP_TRANSMISSION, 0);
-	}
-	sd_mmc_deselect_slot();
+	(void)sd_mmc_send_stop(card);
+	sd_mmc_deselect_card(card);
 	return SD_MMC_OK;
 }
 
+sd_mmc_err_t sd_mmc_start_read_blocks(void *dest, uint16_t nb_block)
+{
+	return sd_mmc_card_start_read_blocks(sd_mmc_card, dest, nb_block);
+}
+
+sd_mmc_err_t sd_mmc_wait_end_of_read_blocks(bool abort)
+{
+	return sd_mmc_card_wait_end_of_read_blocks(sd_mmc_card, abort);
+}
+#endif
+
 sd_mmc_err_t sd_mmc_init_write_blocks(uint8_t slot, uint32_t start, uint16_t nb_block)
 {
 	sd_mmc_err_t sd_mmc_err;
 	uint32_t cmd, arg, resp;
+#if 1	// dc42
+	const uint32_t startCycles = DWT->CYCCNT;
+#endif
 
 	sd_mmc_err = sd_mmc_select_slot(slot);
 	if (sd_mmc_err != SD_MMC_OK) {
@@ -2002,6 +2689,16 @@ sd_mmc_err_t sd_mmc_init_write_blocks(uint8_t slot, uint32_t start, uint16_t nb_
 		return SD_MMC_ERR_WP;
 	}
 
+#if 1	// dc42
+	// Tell SD cards how many blocks are about to be written so that they can be pre-erased.
+	// This is only an optimisation, so carry on if the card doesn't accept it.
+	if (nb_block > 1 && (sd_mmc_card->type & CARD_TYPE_SD)) {
+		if (!sd_acmd23(nb_block)) {
+			sd_mmc_debug("%s: ACMD23 failed\n\r", __func__);
+		}
+	}
+#endif
+
 	if (nb_block > 1) {
 		cmd = SDMMC_CMD25_WRITE_MULTIPLE_BLOCK;
 	} else {
@@ -2030,52 +2727,73 @@ sd_mmc_err_t sd_mmc_init_write_blocks(uint8_t slot, uint32_t start, uint16_t nb_
 			return SD_MMC_ERR_COMM;
 		}
 	}
-	sd_mmc_nb_block_remaining = nb_block;
-	sd_mmc_nb_block_to_tranfer = nb_block;
+	sd_mmc_card->nb_block_remaining = nb_block;		// dc42
+	sd_mmc_card->nb_block_to_transfer = nb_block;		// dc42
+#if 1	// dc42
+	sd_mmc_record_latency((cmd & SDMMC_CMD_WRITE) ? SD_MMC_OP_INIT_WRITE : SD_MMC_OP_INIT_READ, startCycles);
+#endif
 	return SD_MMC_OK;
 }
 
-sd_mmc_err_t sd_mmc_start_write_blocks(const void *src, uint16_t nb_block)
+#if 1	// dc42
+static sd_mmc_err_t sd_mmc_card_start_write_blocks(struct sd_mmc_card *card, const void *src, uint16_t nb_block)
 {
-	Assert(sd_mmc_nb_block_remaining >= nb_block);
-	if (!sd_mmc_card->iface->start_write_blocks(src, nb_block)) {
-		sd_mmc_nb_block_remaining = 0;
+	Assert(card->nb_block_remaining >= nb_block);
+	if (!card->iface->start_write_blocks(src, nb_block)) {
+		sd_mmc_card_abort_blocks(card, true);
 		return SD_MMC_ERR_COMM;
 	}
-	sd_mmc_nb_block_remaining -= nb_block;
+	card->nb_block_remaining -= nb_block;
 	return SD_MMC_OK;
 }
 
-sd_mmc_err_t sd_mmc_wait_end_of_write_blocks(bool abort)
+static sd_mmc_err_t sd_mmc_card_wait_end_of_write_blocks(struct sd_mmc_card *card, bool abort)
 {
-	if (!sd_mmc_card->iface->wait_end_of_write_blocks()) {
+	uint32_t startCycles = DWT->CYCCNT;
+	if (!card->iface->wait_end_of_write_blocks()) {
+		sd_mmc_card_abort_blocks(card, true);
 		return SD_MMC_ERR_COMM;
 	}
+	sd_mmc_record_latency(SD_MMC_OP_WRITE_DATA, startCycles);
 	if (abort) {
-		sd_mmc_nb_block_remaining = 0;
-	} else if (sd_mmc_nb_block_remaining) {
+		card->nb_block_remaining = 0;
+	} else if (card->nb_block_remaining) {
 		return SD_MMC_OK;
 	}
 
 	// All blocks are transfered then stop write operation
-	if (sd_mmc_nb_block_to_tranfer == 1) {
+	if (card->nb_block_to_transfer == 1) {
 		// Single block transfer, then nothing to do
-		sd_mmc_deselect_slot();
+		sd_mmc_deselect_card(card);
 		return SD_MMC_OK;
 	}
 
-	if (!sd_mmc_card->iface->is_spi) {
+	if (!card->iface->is_spi) {
 		// Note: SPI multi block writes terminate using a special
 		// token, not a STOP_TRANSMISSION request.
-		if (!sd_mmc_card->iface->adtc_stop(SDMMC_CMD12_STOP_TRANSMISSION, 0)) {
-			sd_mmc_deselect_slot();
+		startCycles = DWT->CYCCNT;
+		const bool ok = card->iface->adtc_stop(SDMMC_CMD12_STOP_TRANSMISSION, 0);
+		sd_mmc_record_latency(SD_MMC_OP_STOP, startCycles);
+		if (!ok) {
+			sd_mmc_deselect_card(card);
 			return SD_MMC_ERR_COMM;
 		}
 	}
-	sd_mmc_deselect_slot();
+	sd_mmc_deselect_card(card);
 	return SD_MMC_OK;
 }
 
+sd_mmc_err_t sd_mmc_start_write_blocks(const void *src, uint16_t nb_block)
+{
+	return sd_mmc_card_start_write_blocks(sd_mmc_card, src, nb_block);
+}
+
+sd_mmc_err_t sd_mmc_wait_end_of_write_blocks(bool abort)
+{
+	return sd_mmc_card_wait_end_of_write_blocks(sd_mmc_card, abort);
+}
+#endif
+
 #ifdef SDIO_SUPPORT_ENABLE
 sd_mmc_err_t sdio_read_direct(uint8_t slot, uint8_t func_num, uint32_t addr,
 		uint8_t *dest)
@@ -48,6 +48,7 @@
 #define SD_MMC_H_INCLUDED
 
 #include "compiler.h"
+#include "sd_mmc_protocol.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -81,6 +82,9 @@ typedef uint8_t sd_mmc_err_t; //!< Type of return error code
 #define SD_MMC_ERR_PARAM        6    //! Illegal input parameter
 #define SD_MMC_ERR_WP           7    //! Card write protected
 #define SD_MMC_CD_DEBOUNCING	8	 //! Waiting for card to settle after CD
+#define SD_MMC_ERR_ABORTED      9    //! Asynchronous request cancelled
+#define SD_MMC_PENDING          10   //! Asynchronous request queued or in progress
+#define SD_MMC_ERR_BUSY         11   //! Interface in use by asynchronous requests
 //! @}
 
 typedef uint8_t card_type_t; //!< Type of card type
@@ -171,12 +175,158 @@ bool sd_mmc_is_write_protected(uint8_t slot);
 
 #if 1		// dc42
 
+typedef void (*driverIdleFunc_t)(uint32_t, uint32_t);
+
+// Low level driver functions used by the SD/MMC stack. The HSMCI and SPI drivers provide the standard implementations.
+struct DriverInterface
+{
+	void (*select_device)(uint8_t slot, uint32_t clock, uint8_t bus_width, bool high_speed);
+	void (*deselect_device)(uint8_t slot);
+	uint8_t (*get_bus_width)(uint8_t slot);
+	bool (*is_high_speed_capable)(void);
+	void (*send_clock)(void);
+	bool (*send_cmd)(sdmmc_cmd_def_t cmd, uint32_t arg);
+	uint32_t (*get_response)(void);
+	void (*get_response_128)(uint8_t* response);
+	bool (*adtc_start)(sdmmc_cmd_def_t cmd, uint32_t arg, uint16_t block_size, uint16_t nb_block, bool access_block);
+	bool (*adtc_stop)(sdmmc_cmd_def_t cmd, uint32_t arg);
+	bool (*read_word)(uint32_t* value);
+	bool (*write_word)(uint32_t value);
+	bool (*start_read_blocks)(void *dest, uint16_t nb_block);
+	bool (*wait_end_of_read_blocks)(void);
+	bool (*start_write_blocks)(const void *src, uint16_t nb_block);
+	bool (*wait_end_of_write_blocks)(void);
+	uint32_t (*getInterfaceSpeed)(void);
+	driverIdleFunc_t (*set_idle_func)(driverIdleFunc_t);
+	bool is_spi;			// true if the interface is SPI, false if it is HSMCI
+};
+
+// Replace the driver used by a slot, for example by a simulated card. Call this after sd_mmc_init(). The card in the slot is unmounted.
+// 'driverSlot' is the slot number passed to the driver's select_device, deselect_device and get_bus_width functions.
+void sd_mmc_set_driver_interface(uint8_t slot, const struct DriverInterface *iface, uint8_t driverSlot);
+
 // Unmount the card. Must call this to force it to be re-initialised when changing card.
 void sd_mmc_unmount(uint8_t slot);
 
-// Get the interface speed in bytes/sec
+// Get the interface speed in bytes/sec, taking account of the bus width and clock negotiated with the card
 uint32_t sd_mmc_get_interface_speed(uint8_t slot);
 
+// Get the bus clock in Hz actually delivered by the host, the bus width and whether the card was switched to high speed mode
+void sd_mmc_get_bus_config(uint8_t slot, uint32_t *clock, uint8_t *bus_width, bool *high_speed);
+
+// Return true if the card in the slot has been initialised and is ready for use
+bool sd_mmc_card_ready(uint8_t slot);
+
+// Return the number of blocks on the card in the slot, or 0 if it is not ready. Unlike sd_mmc_get_capacity() this doesn't access the card.
+uint32_t sd_mmc_get_nb_block(uint8_t slot);
+
+// Read blocks as part of a sequential stream.
+// If the previous streaming read on this slot ended at 'start' then the blocks are read from the multi-block read command that is still open,
+// otherwise a new multi-block read of up to nb_window blocks is started. The command is left open afterwards until the window is exhausted,
+// another command is sent to a slot on the same interface, or sd_mmc_stop_read_stream() or sd_mmc_release_read_stream() is called.
+sd_mmc_err_t sd_mmc_read_stream(uint8_t slot, uint32_t start, void *dest, uint16_t nb_block, uint16_t nb_window);
+
+// Terminate the open streaming reads on all slots, if any, by sending CMD12
+void sd_mmc_stop_read_stream(void);
+
+// Terminate the open streaming read if it is on a shared bus (i.e. SPI) that other devices may need to use
+void sd_mmc_release_read_stream(void);
+
+struct sd_mmc_async_request;
+
+// Completion callback for an asynchronous block transfer.
+// Called from sd_mmc_async_spin(), or from sd_mmc_async_submit() if the transfer could not be started.
+typedef void (*sd_mmc_async_callback_t)(struct sd_mmc_async_request *request);
+
+// Asynchronous block transfer request.
+// The storage is owned by the caller and must remain valid until the request has completed or been cancelled.
+struct sd_mmc_async_request {
+	uint8_t slot;						// card slot, which must be an HSMCI slot
+	bool write;							// true to write blocks, false to read them
+	uint16_t nb_block;					// number of blocks to transfer
+	uint32_t start;						// first block number
+	void *buffer;						// data to write, or buffer to read into
+	sd_mmc_async_callback_t callback;	// called when the transfer has completed, may be NULL
+	void *param;						// for use by the callback
+	volatile sd_mmc_err_t status;		// SD_MMC_PENDING while queued or in progress, then the result
+	struct sd_mmc_async_request *next;	// used internally to link the queue
+};
+
+// Queue a block transfer whose data phase runs under DMA, and return without waiting for it. Call this from task context, not from an interrupt.
+// Requests are executed in order. The command phases run in task context: the first request's in the caller's, later ones in sd_mmc_async_spin().
+// The HSMCI interrupt only signals the end of the data phase; sd_mmc_async_spin() then finishes the transfer (including CMD12 after a
+// multi-block transfer), calls the callback and starts the next request.
+// The application must call sd_mmc_async_irq_handler() from HSMCI_Handler and sd_mmc_async_spin() regularly from its main loop.
+// The card must already have been initialised by sd_mmc_check().
+// Synchronous calls and the queue take turns to own the HSMCI interface. A synchronous call to an HSMCI slot while a request is in progress
+// returns SD_MMC_ERR_BUSY, and a request waits in the queue while a synchronous transfer is in progress. Callbacks may make synchronous calls.
+// Synchronous calls to SPI slots go ahead while the queue is busy.
+// The sd_mmc_mem read-ahead and write caches are bypassed. Call memory_sync() with only_if_expired false before submitting requests, so that
+// they don't race with cached writes, and again after they have completed and before reading through ctrl_access, so that the read-ahead
+// buffer doesn't return data that they have overwritten.
+// Returns SD_MMC_OK if the request was queued, otherwise the reason it was rejected; in that case the callback is not called.
+sd_mmc_err_t sd_mmc_async_submit(struct sd_mmc_async_request *request);
+
+// Remove a request from the queue if it has not started yet, setting its status to SD_MMC_ERR_ABORTED. The callback is not called.
+// Returns false if the request is in progress or has already completed; a transfer in progress always runs to completion.
+bool sd_mmc_async_cancel(struct sd_mmc_async_request *request);
+
+// Return true if an asynchronous request is queued or in progress
+bool sd_mmc_async_busy(void);
+
+// Finish the asynchronous transfer whose data phase has ended and start the next request. Call this regularly from task context.
+void sd_mmc_async_spin(void);
+
+// Operations whose latency is recorded
+#define SD_MMC_OP_INIT_READ		0		// sd_mmc_init_read_blocks(): select the card, CMD13 and the read command
+#define SD_MMC_OP_READ_DATA		1		// data phase, as waited for by sd_mmc_wait_end_of_read_blocks()
+#define SD_MMC_OP_INIT_WRITE	2		// sd_mmc_init_write_blocks(): select the card, ACMD23 and the write command
+#define SD_MMC_OP_WRITE_DATA	3		// data phase including busy after each block, as waited for by sd_mmc_wait_end_of_write_blocks()
+#define SD_MMC_OP_STOP			4		// CMD12 at the end of a multi-block transfer
+#define SD_MMC_OP_BUSY			5		// card busy after an R1b command, as waited for by hsmci_wait_busy()
+#define SD_MMC_NUM_OPS			6
+
+// Number of latency histogram buckets. Bucket 0 counts operations that took less than 1us, bucket n counts those that took
+// from 2^(n-1) to 2^n - 1 microseconds, and the last bucket also counts anything longer.
+#define SD_MMC_LATENCY_BUCKETS	24
+
+struct sd_mmc_latency_stats {
+	uint32_t count;							// number of operations that completed successfully
+	uint32_t max_us;						// longest time taken
+	uint64_t total_us;						// total time taken
+	uint32_t buckets[SD_MMC_LATENCY_BUCKETS];
+};
+
+struct sd_mmc_stats {
+	struct sd_mmc_latency_stats ops[SD_MMC_NUM_OPS];
+	uint32_t crc_errors;					// command response and data CRC errors
+	uint32_t timeouts;						// command response, data and busy timeouts
+	uint32_t other_errors;					// other errors detected by the low level driver
+	uint32_t retries;						// commands that failed and were retried
+	uint32_t hs_fallbacks;					// times a card was put back to default speed because high speed mode was unreliable
+};
+
+// Copy the latency statistics and error counters, which are collected all the time
+void sd_mmc_get_stats(struct sd_mmc_stats *stats);
+
+// Clear the latency statistics and error counters
+void sd_mmc_reset_stats(void);
+
+// Record the duration of an operation that started when the DWT cycle counter had the value 'startCycles'. Used by the low level drivers.
+void sd_mmc_record_latency(uint8_t op, uint32_t startCycles);
+
+// Kinds of error recorded by the low level drivers
+#define SD_MMC_ERROR_CRC		0
+#define SD_MMC_ERROR_TIMEOUT	1
+#define SD_MMC_ERROR_OTHER		2
+
+// Record an error detected by a low level driver
+void sd_mmc_record_error(uint8_t kind);
+
+// HSMCI interrupt handler for asynchronous transfers. Call it first in HSMCI_Handler; returns true if the interrupt was for an asynchronous transfer.
+// It disables the interrupt and records that the data phase has ended, leaving the commands to sd_mmc_async_spin().
+bool sd_mmc_async_irq_handler(void);
+
 #endif
 
 /**
@@ -51,6 +51,7 @@
 #include "Core.h"
 #include "sd_mmc.h"
 #include "sd_mmc_mem.h"
+#include "conf_sd_mmc.h"
 
 /**
  * \ingroup sd_mmc_stack_mem
@@ -80,6 +81,7 @@ Ctrl_status sd_mmc_test_unit_ready(uint8_t slot)
 		return CTRL_NO_PRESENT;
 
 	case SD_MMC_INIT_ONGOING:
+	case SD_MMC_ERR_BUSY:
 		return CTRL_BUSY;
 
 	case SD_MMC_ERR_NO_CARD:
@@ -304,16 +306,233 @@ Ctrl_status sd_mmc_usb_write_10_1(uint32_t addr, uint16_t nb_sector)
  * \name MEM <-> RAM Interface
  * @{
  */
-Ctrl_status sd_mmc_mem_2_ram(uint8_t slot, uint32_t addr, void *ram, uint32_t numBlocks)
+// Convert an sd_mmc error code from starting a read or write to a Ctrl_status
+static Ctrl_status sd_mmc_ctrl_status(sd_mmc_err_t err)
 {
-	switch (sd_mmc_init_read_blocks(slot, addr, numBlocks)) {
+	switch (err) {
 	case SD_MMC_OK:
-		break;
+		return CTRL_GOOD;
 	case SD_MMC_ERR_NO_CARD:
 		return CTRL_NO_PRESENT;
+	case SD_MMC_ERR_BUSY:
+		return CTRL_BUSY;
 	default:
 		return CTRL_FAIL;
 	}
+}
+
+// Write-back cache.
+// Writes of fewer than SD_MMC_WRITE_CACHE_BLOCKS blocks are held in a per-slot buffer. Writes that continue or overwrite the buffered range are
+// merged into it, so that a series of small writes reaches the card as a single multi-block write, which sd_mmc_init_write_blocks pre-erases
+// using ACMD23. The buffer is flushed when it is full, when a write or read that can't be merged touches the slot, when the data is older than
+// SD_MMC_WRITE_CACHE_TIMEOUT milliseconds and the slot is accessed or memory_sync() is called, and when the card is unmounted.
+// The cache is disabled by default. Data written by FatFs is only safe once it reaches the card, so a build that enables the cache must call
+// sd_mmc_mem_sync() from the CTRL_SYNC case of disk_ioctl(). The cache uses SD_MMC_WRITE_CACHE_BLOCKS * 512 bytes of RAM per slot.
+#ifndef SD_MMC_WRITE_CACHE_BLOCKS
+# define SD_MMC_WRITE_CACHE_BLOCKS	(0)			// number of blocks buffered per slot, or 0 to disable write-back caching
+#endif
+#ifndef SD_MMC_WRITE_CACHE_TIMEOUT
+# define SD_MMC_WRITE_CACHE_TIMEOUT	(500)		// maximum time in milliseconds that data may be held in the cache
+#endif
+
+#if SD_MMC_WRITE_CACHE_BLOCKS != 0
+
+struct sd_mmc_write_cache {
+	uint32_t first_block;				// block number of the first block in the buffer
+	uint32_t dirty_since;				// value of millis() when the buffer became non-empty
+	uint16_t count;						// number of blocks in the buffer
+	COMPILER_WORD_ALIGNED
+	uint8_t buffer[SD_MMC_WRITE_CACHE_BLOCKS][SD_MMC_BLOCK_SIZE];
+};
+
+static struct sd_mmc_write_cache sd_mmc_write_caches[SD_MMC_MEM_CNT];
+
+#endif
+
+// Write blocks to the card
+static Ctrl_status sd_mmc_write_blocks(uint8_t slot, uint32_t addr, const void *ram, uint32_t numBlocks)
+{
+	const sd_mmc_err_t err = sd_mmc_init_write_blocks(slot, addr, numBlocks);
+	if (err != SD_MMC_OK) {
+		return sd_mmc_ctrl_status(err);
+	}
+	if (SD_MMC_OK != sd_mmc_start_write_blocks(ram, numBlocks)) {
+		return CTRL_FAIL;
+	}
+	if (SD_MMC_OK != sd_mmc_wait_end_of_write_blocks(false)) {
+		return CTRL_FAIL;
+	}
+	return CTRL_GOOD;
+}
+
+#if SD_MMC_WRITE_CACHE_BLOCKS != 0
+
+// Write the cached blocks to the card. If this fails the data is kept so that the write is tried again on the next access to the slot or
+// call to memory_sync(). This matters when the asynchronous queue owns the interface (CTRL_BUSY), which is only temporary.
+// The data is only discarded when the card is unmounted.
+static Ctrl_status sd_mmc_write_cache_flush(uint8_t slot)
+{
+	struct sd_mmc_write_cache * const wc = &sd_mmc_write_caches[slot];
+	if (wc->count == 0) {
+		return CTRL_GOOD;
+	}
+	const Ctrl_status status = sd_mmc_write_blocks(slot, wc->first_block, wc->buffer, wc->count);
+	if (status == CTRL_GOOD) {
+		wc->count = 0;
+	}
+	return status;
+}
+
+// Flush the cache if the data in it has been held for too long
+static Ctrl_status sd_mmc_write_cache_flush_expired(uint8_t slot)
+{
+	struct sd_mmc_write_cache * const wc = &sd_mmc_write_caches[slot];
+	return (wc->count != 0 && millis() - wc->dirty_since >= SD_MMC_WRITE_CACHE_TIMEOUT)
+			? sd_mmc_write_cache_flush(slot)
+				: CTRL_GOOD;
+}
+
+// Flush the cache if it holds any of the specified blocks
+static Ctrl_status sd_mmc_write_cache_flush_overlapping(uint8_t slot, uint32_t addr, uint32_t numBlocks)
+{
+	struct sd_mmc_write_cache * const wc = &sd_mmc_write_caches[slot];
+	return (wc->count != 0 && addr < wc->first_block + wc->count && wc->first_block < addr + numBlocks)
+			? sd_mmc_write_cache_flush(slot)
+				: sd_mmc_write_cache_flush_expired(slot);
+}
+
+#endif
+
+// Read-ahead for sequential reads.
+// When a read carries on from where the previous one on the same slot finished, we read using a multi-block read command that we leave open,
+// and we keep a few blocks beyond the end of the request in a ring buffer. A run of sequential reads then costs one command per stream window
+// instead of one command per read. If a non-sequential read intervenes (e.g. FatFs reading the FAT), the buffered blocks are kept so that the
+// sequence can resume; the open command is cancelled by sending CMD12.
+// Read-ahead is disabled by default because it uses SD_MMC_READ_AHEAD_BLOCKS * 512 bytes of RAM per slot. Builds that read large files
+// sequentially and can spare the RAM should define it as 4 or more.
+#ifndef SD_MMC_READ_AHEAD_BLOCKS
+# define SD_MMC_READ_AHEAD_BLOCKS	(0)			// number of blocks buffered per slot, or 0 to disable read-ahead
+#endif
+#ifndef SD_MMC_READ_STREAM_BLOCKS
+# define SD_MMC_READ_STREAM_BLOCKS	(256)		// number of blocks requested from the card when we start a sequential read
+#endif
+
+#if SD_MMC_READ_AHEAD_BLOCKS != 0
+
+struct sd_mmc_read_ahead {
+	uint32_t next_block;				// block number at which a sequential read would start
+	uint32_t first_block;				// block number of the oldest block in the buffer
+	uint8_t first_index;				// index of that block in the buffer
+	uint8_t count;						// number of blocks in the buffer
+	bool next_valid;					// true if next_block is valid
+	COMPILER_WORD_ALIGNED
+	uint8_t buffer[SD_MMC_READ_AHEAD_BLOCKS][SD_MMC_BLOCK_SIZE];
+};
+
+static struct sd_mmc_read_ahead sd_mmc_read_aheads[SD_MMC_MEM_CNT];
+
+// Forget the buffered data and sequence position for a slot
+static void sd_mmc_read_ahead_reset(uint8_t slot)
+{
+	sd_mmc_read_aheads[slot].count = 0;
+	sd_mmc_read_aheads[slot].next_valid = false;
+}
+
+// Discard buffered blocks that overlap blocks being written
+static void sd_mmc_read_ahead_invalidate(uint8_t slot, uint32_t addr, uint32_t numBlocks)
+{
+	struct sd_mmc_read_ahead * const ra = &sd_mmc_read_aheads[slot];
+	if (ra->count != 0 && addr < ra->first_block + ra->count && ra->first_block < addr + numBlocks) {
+		ra->count = 0;
+	}
+}
+
+// Top up the read-ahead buffer with the blocks that follow the ones already in it
+static void sd_mmc_read_ahead_fill(uint8_t slot)
+{
+	struct sd_mmc_read_ahead * const ra = &sd_mmc_read_aheads[slot];
+	if (ra->count == 0) {
+		ra->first_block = ra->next_block;
+		ra->first_index = 0;
+	}
+#if SD_MMC_WRITE_CACHE_BLOCKS != 0
+	// Don't read blocks from the card if newer data for them is in the write cache
+	if (sd_mmc_write_cache_flush_overlapping(slot, ra->first_block + ra->count, SD_MMC_READ_AHEAD_BLOCKS - ra->count) != CTRL_GOOD) {
+		return;
+	}
+#endif
+	while (ra->count < SD_MMC_READ_AHEAD_BLOCKS) {
+		const uint8_t write_index = (ra->first_index + ra->count) % SD_MMC_READ_AHEAD_BLOCKS;
+		const uint8_t free_blocks = SD_MMC_READ_AHEAD_BLOCKS - ra->count;
+		const uint8_t nb_block = (free_blocks < SD_MMC_READ_AHEAD_BLOCKS - write_index) ? free_blocks : SD_MMC_READ_AHEAD_BLOCKS - write_index;
+		if (sd_mmc_read_stream(slot, ra->first_block + ra->count, ra->buffer[write_index], nb_block, SD_MMC_READ_STREAM_BLOCKS) != SD_MMC_OK) {
+			ra->count = 0;						// read-ahead is only speculative, so just discard what we have
+			break;
+		}
+		ra->count += nb_block;
+	}
+}
+
+#endif
+
+Ctrl_status sd_mmc_mem_2_ram(uint8_t slot, uint32_t addr, void *ram, uint32_t numBlocks)
+{
+#if SD_MMC_WRITE_CACHE_BLOCKS != 0
+	// Make sure the card holds the latest data before we read it
+	const Ctrl_status status = sd_mmc_write_cache_flush_overlapping(slot, addr, numBlocks);
+	if (status != CTRL_GOOD) {
+		return status;
+	}
+#endif
+
+#if SD_MMC_READ_AHEAD_BLOCKS != 0
+	struct sd_mmc_read_ahead * const ra = &sd_mmc_read_aheads[slot];
+	const bool buffered = (ra->count != 0 && addr == ra->first_block);
+	if (buffered || (ra->next_valid && addr == ra->next_block)) {
+		// Sequential read. Copy whatever we can from the read-ahead buffer.
+		uint8_t *dest = (uint8_t *)ram;
+		if (buffered) {
+			while (numBlocks != 0 && ra->count != 0) {
+				memcpy(dest, ra->buffer[ra->first_index], SD_MMC_BLOCK_SIZE);
+				dest += SD_MMC_BLOCK_SIZE;
+				++addr;
+				--numBlocks;
+				++ra->first_block;
+				ra->first_index = (ra->first_index + 1) % SD_MMC_READ_AHEAD_BLOCKS;
+				--ra->count;
+			}
+		} else {
+			ra->count = 0;						// buffered blocks don't follow on from this read
+		}
+
+		// Read the remainder directly into the caller's buffer
+		while (numBlocks != 0) {
+			const uint16_t nb_block = (numBlocks > SD_MMC_READ_STREAM_BLOCKS) ? SD_MMC_READ_STREAM_BLOCKS : (uint16_t)numBlocks;
+			const sd_mmc_err_t err = sd_mmc_read_stream(slot, addr, dest, nb_block, SD_MMC_READ_STREAM_BLOCKS);
+			if (err != SD_MMC_OK) {
+				sd_mmc_read_ahead_reset(slot);
+				return sd_mmc_ctrl_status(err);
+			}
+			dest += (uint32_t)nb_block * SD_MMC_BLOCK_SIZE;
+			addr += nb_block;
+			numBlocks -= nb_block;
+		}
+
+		ra->next_block = addr;
+		sd_mmc_read_ahead_fill(slot);
+		sd_mmc_release_read_stream();
+		return CTRL_GOOD;
+	}
+
+	// Not sequential. Keep the buffered blocks in case the previous sequence resumes, but start a new sequence from the end of this read.
+	ra->next_block = addr + numBlocks;
+	ra->next_valid = true;
+#endif
+
+	const sd_mmc_err_t err = sd_mmc_init_read_blocks(slot, addr, numBlocks);
+	if (err != SD_MMC_OK) {
+		return sd_mmc_ctrl_status(err);
+	}
 	if (SD_MMC_OK != sd_mmc_start_read_blocks(ram, numBlocks)) {
 		return CTRL_FAIL;
 	}
@@ -335,21 +554,46 @@ Ctrl_status sd_mmc_mem_2_ram_1(uint32_t addr, void *ram, uint32_t numBlocks)
 
 Ctrl_status sd_mmc_ram_2_mem(uint8_t slot, uint32_t addr, const void *ram, uint32_t numBlocks)
 {
-	switch (sd_mmc_init_write_blocks(slot, addr, numBlocks)) {
-	case SD_MMC_OK:
-		break;
-	case SD_MMC_ERR_NO_CARD:
-		return CTRL_NO_PRESENT;
-	default:
+#if SD_MMC_READ_AHEAD_BLOCKS != 0
+	sd_mmc_read_ahead_invalidate(slot, addr, numBlocks);
+#endif
+
+#if SD_MMC_WRITE_CACHE_BLOCKS != 0
+	// Blocks beyond the end of the card must be rejected now, because the cache would keep failing to write them
+	if (sd_mmc_card_ready(slot) && (addr >= sd_mmc_get_nb_block(slot) || numBlocks > sd_mmc_get_nb_block(slot) - addr)) {
 		return CTRL_FAIL;
 	}
-	if (SD_MMC_OK != sd_mmc_start_write_blocks(ram, numBlocks)) {
-		return CTRL_FAIL;
+
+	struct sd_mmc_write_cache * const wc = &sd_mmc_write_caches[slot];
+	if (wc->count != 0) {
+		// Merge this write into the cache if it starts within or immediately after the cached blocks and the result fits
+		if (addr >= wc->first_block && addr <= wc->first_block + wc->count && addr + numBlocks <= wc->first_block + SD_MMC_WRITE_CACHE_BLOCKS) {
+			memcpy(wc->buffer[addr - wc->first_block], ram, numBlocks * SD_MMC_BLOCK_SIZE);
+			if (addr + numBlocks > wc->first_block + wc->count) {
+				wc->count = (uint16_t)(addr + numBlocks - wc->first_block);
+			}
+			const Ctrl_status status = (wc->count == SD_MMC_WRITE_CACHE_BLOCKS) ? sd_mmc_write_cache_flush(slot) : sd_mmc_write_cache_flush_expired(slot);
+			// The data is in the cache whether or not the flush succeeded, and if the interface was busy it will be written later
+			return (status == CTRL_BUSY) ? CTRL_GOOD : status;
+		}
+
+		const Ctrl_status status = sd_mmc_write_cache_flush(slot);
+		if (status != CTRL_GOOD) {
+			return status;
+		}
 	}
-	if (SD_MMC_OK != sd_mmc_wait_end_of_write_blocks(false)) {
-		return CTRL_FAIL;
+
+	// Start caching if the write is small and the card is ready and not write protected, otherwise write directly so that errors are reported now
+	if (numBlocks < SD_MMC_WRITE_CACHE_BLOCKS && sd_mmc_card_ready(slot) && !sd_mmc_is_write_protected(slot) && !sd_mmc_ejected[slot]) {
+		memcpy(wc->buffer[0], ram, numBlocks * SD_MMC_BLOCK_SIZE);
+		wc->first_block = addr;
+		wc->count = (uint16_t)numBlocks;
+		wc->dirty_since = millis();
+		return CTRL_GOOD;
 	}
-	return CTRL_GOOD;
+#endif
+
+	return sd_mmc_write_blocks(slot, addr, ram, numBlocks);
 }
 
 Ctrl_status sd_mmc_ram_2_mem_0(uint32_t addr, const void *ram, uint32_t numBlocks)
@@ -361,6 +605,47 @@ Ctrl_status sd_mmc_ram_2_mem_1(uint32_t addr, const void *ram, uint32_t numBlock
 {
 	return sd_mmc_ram_2_mem(1, addr, ram, numBlocks);
 }
+
+Ctrl_status sd_mmc_mem_sync(uint8_t slot, bool only_if_expired)
+{
+#if SD_MMC_READ_AHEAD_BLOCKS != 0
+	// A full sync is also the point at which the caller may start using the asynchronous functions, which bypass the read-ahead buffer.
+	// Discard it so that blocks they write are not read back stale.
+	if (!only_if_expired) {
+		sd_mmc_read_ahead_reset(slot);
+	}
+#endif
+#if SD_MMC_WRITE_CACHE_BLOCKS != 0
+	return (only_if_expired) ? sd_mmc_write_cache_flush_expired(slot) : sd_mmc_write_cache_flush(slot);
+#else
+	UNUSED(slot);
+	UNUSED(only_if_expired);
+	return CTRL_GOOD;
+#endif
+}
+
+Ctrl_status sd_mmc_mem_sync_0(bool only_if_expired)
+{
+	return sd_mmc_mem_sync(0, only_if_expired);
+}
+
+Ctrl_status sd_mmc_mem_sync_1(bool only_if_expired)
+{
+	return sd_mmc_mem_sync(1, only_if_expired);
+}
+
+void sd_mmc_mem_unmount(uint8_t slot)
+{
+#if SD_MMC_WRITE_CACHE_BLOCKS != 0
+	// Write any cached data while the card is still mounted. If the card has already been removed, it is lost.
+	// It must not be kept, because it would be written to the next card inserted.
+	(void)sd_mmc_write_cache_flush(slot);
+	sd_mmc_write_caches[slot].count = 0;
+#endif
+#if SD_MMC_READ_AHEAD_BLOCKS != 0
+	sd_mmc_read_ahead_reset(slot);
+#endif
+}
 //! @}
 
 //! @}
@@ -215,6 +215,25 @@ extern Ctrl_status sd_mmc_ram_2_mem_0(uint32_t addr, const void *ram, uint32_t n
 //! Instance Declaration for sd_mmc_mem_2_ram Slot 1
 extern Ctrl_status sd_mmc_ram_2_mem_1(uint32_t addr, const void *ram, uint32_t numBlocks);
 
+/*! \brief Writes any data held in the write-back cache to the memory.
+ *
+ * If SD_MMC_WRITE_CACHE_BLOCKS is not zero, this must be called when FatFs requests CTRL_SYNC.
+ * Unless only_if_expired is true, the read-ahead buffer is discarded as well.
+ *
+ * \param slot SD/MMC Slot Card Selected.
+ * \param only_if_expired  If true, only write the data if it has been held for longer than the cache timeout.
+ *
+ * \return Status.
+ */
+extern Ctrl_status sd_mmc_mem_sync(uint8_t slot, bool only_if_expired);
+//! Instance Declaration for sd_mmc_mem_sync Slot O
+extern Ctrl_status sd_mmc_mem_sync_0(bool only_if_expired);
+//! Instance Declaration for sd_mmc_mem_sync Slot 1
+extern Ctrl_status sd_mmc_mem_sync_1(bool only_if_expired);
+
+// Write any cached data to the card in the specified slot and discard the caches. Called by sd_mmc_unmount().
+extern void sd_mmc_mem_unmount(uint8_t slot);
+
 //! @}
 
 #endif
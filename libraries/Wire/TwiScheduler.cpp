@@ -0,0 +1,228 @@
+/*
+ * TwiScheduler.cpp
+ *
+ * The queues are changed by tasks and by the TWI interrupt, so tasks change them with interrupts disabled.
+ */
+
+#include "TwiScheduler.h"
+
+TwiScheduler::TwiScheduler(TwoWire& w) : wire(w), current(nullptr), pollJobs(nullptr)
+{
+	for (size_t i = 0; i < numPriorities; ++i)
+	{
+		queueHead[i] = queueTail[i] = nullptr;
+		stats[i] = LatencyStats();
+	}
+}
+
+// Add a request to the end of its queue. Called with interrupts disabled.
+void TwiScheduler::Enqueue(Request *request)
+{
+	const Priority p = request->device->priority;
+	request->busy = true;
+	request->next = nullptr;
+	request->queuedCycles = DWT->CYCCNT;
+	if (queueTail[p] == nullptr)
+	{
+		queueHead[p] = request;
+	}
+	else
+	{
+		queueTail[p]->next = request;
+	}
+	queueTail[p] = request;
+}
+
+bool TwiScheduler::Submit(Request *request)
+{
+	if (request->busy || request->device == nullptr || request->device->priority >= numPriorities || request->numToWrite + request->numToRead == 0)
+	{
+		return false;
+	}
+
+	EnableCycleCounter();						// used to measure latencies
+	const irqflags_t flags = cpu_irq_save();
+	Enqueue(request);
+	if (current == nullptr)
+	{
+		StartNext();
+	}
+	cpu_irq_restore(flags);
+	return true;
+}
+
+bool TwiScheduler::Cancel(Request *request)
+{
+	bool removed = false;
+	const irqflags_t flags = cpu_irq_save();
+	if (request != current && request->busy)
+	{
+		const Priority p = request->device->priority;
+		Request *prev = nullptr;
+		for (Request *r = queueHead[p]; r != nullptr; prev = r, r = r->next)
+		{
+			if (r == request)
+			{
+				if (prev == nullptr)
+				{
+					queueHead[p] = r->next;
+				}
+				else
+				{
+					prev->next = r->next;
+				}
+				if (queueTail[p] == r)
+				{
+					queueTail[p] = prev;
+				}
+				request->busy = false;
+				removed = true;
+				break;
+			}
+		}
+	}
+	cpu_irq_restore(flags);
+	return removed;
+}
+
+void TwiScheduler::AddPollJob(PollJob *job, uint32_t interval)
+{
+	job->intervalMillis = interval;
+	job->nextDueMillis = millis();
+	const irqflags_t flags = cpu_irq_save();
+	job->next = pollJobs;
+	pollJobs = job;
+	cpu_irq_restore(flags);
+	Spin();
+}
+
+void TwiScheduler::RemovePollJob(PollJob *job)
+{
+	const irqflags_t flags = cpu_irq_save();
+	for (PollJob **pp = &pollJobs; *pp != nullptr; pp = &(*pp)->next)
+	{
+		if (*pp == job)
+		{
+			*pp = job->next;
+			break;
+		}
+	}
+	cpu_irq_restore(flags);
+	(void)Cancel(&job->request);
+}
+
+// Queue the poll jobs that are due and not already queued. Called with interrupts disabled.
+void TwiScheduler::SubmitDuePollJobs()
+{
+	const uint32_t now = millis();
+	for (PollJob *job = pollJobs; job != nullptr; job = job->next)
+	{
+		if (!job->request.busy && (int32_t)(now - job->nextDueMillis) >= 0)
+		{
+			job->nextDueMillis += job->intervalMillis;
+			if ((int32_t)(now - job->nextDueMillis) >= 0)
+			{
+				job->nextDueMillis = now + job->intervalMillis;		// we have fallen behind, so don't try to catch up
+			}
+			Enqueue(&job->request);
+		}
+	}
+}
+
+// Start the highest priority request that is waiting. Called with interrupts disabled, or from the TWI interrupt.
+void TwiScheduler::StartNext()
+{
+	SubmitDuePollJobs();
+	for (size_t p = 0; p < numPriorities; ++p)
+	{
+		Request * const r = queueHead[p];
+		if (r != nullptr)
+		{
+			current = r;
+			if (!wire.TransferAsync(r->device->address, r->buffer, r->numToWrite, r->numToRead, TransferComplete, this, r->device->repeatedStart))
+			{
+				// The interface is busy with a transfer that we didn't start. Spin() will try again.
+				current = nullptr;
+				return;
+			}
+
+			queueHead[p] = r->next;
+			if (queueHead[p] == nullptr)
+			{
+				queueTail[p] = nullptr;
+			}
+			const uint32_t waitMicros = (DWT->CYCCNT - r->queuedCycles)/(SystemCoreClock/1000000);
+			LatencyStats& ls = stats[p];
+			ls.totalWaitMicros += waitMicros;
+			if (waitMicros > ls.maxWaitMicros)
+			{
+				ls.maxWaitMicros = waitMicros;
+			}
+			return;
+		}
+	}
+}
+
+/*static*/ void TwiScheduler::TransferComplete(TwoWire *w, size_t bytesTransferred, void *param)
+{
+	TwiScheduler * const ts = static_cast<TwiScheduler*>(param);
+	Request * const r = ts->current;
+	ts->current = nullptr;
+	if (r != nullptr)
+	{
+		const uint32_t micros = (DWT->CYCCNT - r->queuedCycles)/(SystemCoreClock/1000000);
+		LatencyStats& ls = ts->stats[r->device->priority];
+		++ls.count;
+		ls.totalMicros += micros;
+		if (micros > ls.maxTotalMicros)
+		{
+			ls.maxTotalMicros = micros;
+		}
+
+		r->bytesTransferred = bytesTransferred;
+		r->busy = false;
+		if (r->callback != nullptr)
+		{
+			r->callback(r);
+		}
+	}
+
+	// Chain the next transfer straight away
+	if (ts->current == nullptr)
+	{
+		ts->StartNext();
+	}
+}
+
+void TwiScheduler::Spin()
+{
+	(void)wire.IsBusy();						// this abandons a transfer that has timed out, which calls TransferComplete
+	const irqflags_t flags = cpu_irq_save();
+	if (current == nullptr)
+	{
+		StartNext();
+	}
+	else
+	{
+		SubmitDuePollJobs();
+	}
+	cpu_irq_restore(flags);
+}
+
+TwiScheduler::LatencyStats TwiScheduler::GetLatencyStats(Priority p, bool clear)
+{
+	LatencyStats ret = LatencyStats();
+	if (p < numPriorities)
+	{
+		const irqflags_t flags = cpu_irq_save();
+		ret = stats[p];
+		if (clear)
+		{
+			stats[p] = LatencyStats();
+		}
+		cpu_irq_restore(flags);
+	}
+	return ret;
+}
+
+// End
@@ -0,0 +1,109 @@
+/*
+ * TwiScheduler.h
+ *
+ * Queues transfers to several devices on one TWI interface and runs them back to back using TwoWire::TransferAsync().
+ * Each device has a priority class. When a transfer finishes, the next one started is the oldest request of the highest priority class,
+ * so a high priority request waits for at most one transfer that is already in progress. The time each request waits before it starts
+ * and the time until it completes are measured for each class.
+ *
+ * Poll jobs are requests that the scheduler resubmits at a fixed interval, e.g. to read the inputs of a port expander.
+ */
+
+#ifndef TWISCHEDULER_H_
+#define TWISCHEDULER_H_
+
+#include "Wire.h"
+
+class TwiScheduler
+{
+public:
+	enum Priority : uint8_t
+	{
+		highPriority = 0,
+		normalPriority,
+		lowPriority,
+		numPriorities
+	};
+
+	// Handle for a device on the bus
+	struct Device
+	{
+		uint16_t address;
+		Priority priority;
+		bool repeatedStart;					// true if the device needs or accepts a repeated START between a short write and the following read
+	};
+
+	struct Request;
+
+	// Function called from the TWI interrupt when a request has finished. It may submit the request again.
+	typedef void (*RequestCompleteFunc)(Request *request);
+
+	struct Request
+	{
+		const Device *device;
+		uint8_t *buffer;					// bytes to write, followed by space for the bytes read
+		size_t numToWrite;
+		size_t numToRead;
+		RequestCompleteFunc callback;		// may be null
+		void *param;						// for use by the callback
+		volatile size_t bytesTransferred;	// set when the request has finished, numToWrite + numToRead if it succeeded
+		volatile bool busy;					// true while the request is queued or in progress
+
+		// The remaining fields are used by the scheduler
+		Request *next;
+		uint32_t queuedCycles;
+	};
+
+	struct PollJob
+	{
+		Request request;					// the callback of the request is called each time the job has run
+		uint32_t intervalMillis;
+		uint32_t nextDueMillis;
+		PollJob *next;
+	};
+
+	struct LatencyStats
+	{
+		uint32_t count;						// number of requests completed
+		uint32_t maxWaitMicros;				// longest time from submission to start
+		uint32_t maxTotalMicros;			// longest time from submission to completion
+		uint64_t totalWaitMicros;
+		uint64_t totalMicros;
+	};
+
+	TwiScheduler(TwoWire& w);
+
+	// Queue a request. Returns false if it is already queued or in progress, or it is empty.
+	bool Submit(Request *request);
+
+	// Remove a request from the queue if it has not started. Returns true if it was removed, in which case the callback is not called.
+	bool Cancel(Request *request);
+
+	// Add a job that submits its request every 'interval' milliseconds, starting now. The job must not be on the list already and its request must not be empty.
+	void AddPollJob(PollJob *job, uint32_t interval);
+
+	// Remove a poll job. If its request is queued it is cancelled; if it is in progress, it completes but is not resubmitted.
+	void RemovePollJob(PollJob *job);
+
+	// Submit poll jobs that are due, restart the queue if it has stalled and check for timeouts. Call this at least as often as the shortest poll interval.
+	void Spin();
+
+	// Get the latency statistics of a priority class, optionally clearing them
+	LatencyStats GetLatencyStats(Priority p, bool clear);
+
+private:
+	static void TransferComplete(TwoWire *w, size_t bytesTransferred, void *param);
+
+	void Enqueue(Request *request);
+	void StartNext();
+	void SubmitDuePollJobs();
+
+	TwoWire& wire;
+	Request *queueHead[numPriorities];
+	Request *queueTail[numPriorities];
+	Request * volatile current;				// request in progress
+	PollJob *pollJobs;
+	LatencyStats stats[numPriorities];
+};
+
+#endif /* TWISCHEDULER_H_ */
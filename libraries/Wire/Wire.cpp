@@ -20,12 +20,59 @@
 
 #include "Wire.h"
 
-#if SAME70
-// TWI disabled for now
-#else
-
 #if SAME70
 #include "twihs/twihs.h"
+#include "xdmac/xdmac.h"
+
+// The TWIHS registers and status bits that we use have the same layout as those of the TWI
+# define TWI_CR				TWIHS_CR
+# define TWI_MMR			TWIHS_MMR
+# define TWI_IADR			TWIHS_IADR
+# define TWI_SR				TWIHS_SR
+# define TWI_IER			TWIHS_IER
+# define TWI_IDR			TWIHS_IDR
+# define TWI_IMR			TWIHS_IMR
+# define TWI_RHR			TWIHS_RHR
+# define TWI_THR			TWIHS_THR
+# define TWI_CR_START		TWIHS_CR_START
+# define TWI_CR_STOP		TWIHS_CR_STOP
+# define TWI_MMR_MREAD		TWIHS_MMR_MREAD
+# define TWI_MMR_IADRSZ_Pos	TWIHS_MMR_IADRSZ_Pos
+# define TWI_SR_TXCOMP		TWIHS_SR_TXCOMP
+# define TWI_SR_RXRDY		TWIHS_SR_RXRDY
+# define TWI_SR_TXRDY		TWIHS_SR_TXRDY
+# define TWI_SR_NACK		TWIHS_SR_NACK
+# define TWI_IER_TXCOMP		TWIHS_IER_TXCOMP
+# define TWI_IER_RXRDY		TWIHS_IER_RXRDY
+# define TWI_IER_TXRDY		TWIHS_IER_TXRDY
+# define TWI_IER_NACK		TWIHS_IER_NACK
+# define TWI_IDR_TXCOMP		TWIHS_IDR_TXCOMP
+# define TWI_IDR_RXRDY		TWIHS_IDR_RXRDY
+# define TWI_IDR_TXRDY		TWIHS_IDR_TXRDY
+# define TWI_IDR_NACK		TWIHS_IDR_NACK
+
+// The TWIHS master supports standard and fast modes only. High speed mode is available in slave mode only.
+const uint32_t TwiMaxClockFrequency = 400000;
+
+// Return the XDMAC channel and peripheral IDs for a TWIHS
+static uint32_t GetDmaChannel(Twi *twi)
+{
+# if WIRE_INTERFACES_COUNT > 1
+	if (twi == WIRE1_INTERFACE)
+	{
+		return WIRE1_XDMAC_CHANNEL;
+	}
+# endif
+	return WIRE_XDMAC_CHANNEL;
+}
+
+static uint32_t GetDmaPeripheralId(Twi *twi, bool receive)
+{
+	const uint32_t txId = (twi == TWIHS0) ? XDMAC_CHANNEL_HWID_TWIHS0_TX
+						: (twi == TWIHS1) ? XDMAC_CHANNEL_HWID_TWIHS1_TX
+							: XDMAC_CHANNEL_HWID_TWIHS2_TX;
+	return (receive) ? txId + 1 : txId;				// each RX ID is one more than the TX ID
+}
 #else
 #include "twi/twi.h"
 #endif
@@ -37,19 +84,26 @@ void TwoWire::ErrorCounts::Clear()
 	naks = sendTimeouts = recvTimeouts = finishTimeouts = 0;
 }
 
+// Maximum time we wait for a status bit in the default wait-for-status function
+const uint32_t TwiStatusTimeoutMicros = 2000;
+
 // This is the default wait-for-status function.
-// It wait until either 2 clock ticks have passed (so we have waited for at least 1ms) or one or more of the status bits we are interested in has been set.
+// It waits until either 2ms have passed or one or more of the status bits we are interested in has been set.
 // Reading some status bits clears them, so we return the status.
 /*static*/ uint32_t TwoWire::DefaultWaitForStatusFunc(Twi *twi, uint32_t bitsToWaitFor)
 {
-	const uint32_t startMillis = millis();
-	bool timedOut;
+	CoreWaitState ws;
+	CoreWaitStart(&ws, TwiStatusTimeoutMicros);
 	uint32_t sr;
-	do
+	for (;;)
 	{
-		timedOut = (millis() - startMillis > 2);
+		const bool timedOut = CoreWaitPoll(&ws);
 		sr = twi->TWI_SR;							// read this after checking for timeout, in case we get descheduled between the two statements
-	} while (!timedOut && (sr & bitsToWaitFor) == 0);
+		if (timedOut || (sr & bitsToWaitFor) != 0)
+		{
+			break;
+		}
+	}
 	return sr;
 }
 
@@ -85,7 +139,8 @@ inline bool TwoWire::WaitByteReceived(WaitForStatusFunc statusWaitFunc)
 	return WaitForStatus(TWI_SR_RXRDY, errorCounts.recvTimeouts, statusWaitFunc);
 }
 
-TwoWire::TwoWire(Twi *_twi, void(*_beginCb)(void)) : twi(_twi), onBeginCallback(_beginCb)
+TwoWire::TwoWire(Twi *_twi, IRQn_Type _irqn, void(*_beginCb)(void))
+	: twi(_twi), irqNumber(_irqn), onBeginCallback(_beginCb), asyncState(AsyncState::idle)
 {
 }
 
@@ -97,6 +152,17 @@ void TwoWire::BeginMaster(uint32_t clockFrequency)
 		onBeginCallback();
 	}
 
+#if SAME70
+	pmc_enable_periph_clk(ID_XDMAC);
+	StopDma();
+	XdmacAttachHandler(GetDmaChannel(twi), DmaInterruptHandler, this);
+
+	twihs_options_t opt;
+	opt.speed = min<uint32_t>(clockFrequency, TwiMaxClockFrequency);
+	opt.master_clk = SystemPeripheralClock();
+	opt.chip = opt.smbus = 0;
+	twihs_master_init(twi, &opt);
+#else
 	// Disable PDC channel
 	twi->TWI_PTCR = UART_PTCR_RXTDIS | UART_PTCR_TXTDIS;
 
@@ -105,20 +171,16 @@ void TwoWire::BeginMaster(uint32_t clockFrequency)
 	opt.master_clk = VARIANT_MCK;
 	opt.chip = opt.smbus = 0;
 	twi_master_init(twi, &opt);
+#endif
 
+	twi->TWI_IDR = 0xFFFFFFFF;
+	asyncState = AsyncState::idle;
 	errorCounts.Clear();
 }
 
-// Write then read data
-size_t TwoWire::Transfer(uint16_t address, uint8_t *buffer, size_t numToWrite, size_t numToRead, WaitForStatusFunc statusWaitFunc)
+// Set up the mode register and address
+void TwoWire::SetAddress(uint16_t address)
 {
-	// If an empty transfer, nothing to do
-	if (numToRead + numToWrite == 0)
-	{
-		return 0;
-	}
-
-	// Set up the mode register and address
 	if (address >= 0x80)
 	{
 		// 10-bit address
@@ -132,6 +194,18 @@ size_t TwoWire::Transfer(uint16_t address, uint8_t *buffer, size_t numToWrite, s
 	    twi->TWI_MMR = (uint32_t)address << 16;
 	    twi->TWI_IADR = 0;
 	}
+}
+
+// Write then read data
+size_t TwoWire::Transfer(uint16_t address, uint8_t *buffer, size_t numToWrite, size_t numToRead, WaitForStatusFunc statusWaitFunc)
+{
+	// If an empty transfer, nothing to do
+	if (numToRead + numToWrite == 0)
+	{
+		return 0;
+	}
+
+	SetAddress(address);
 
 	size_t bytesSent = 0;
 	if (numToWrite != 0)
@@ -213,6 +287,420 @@ size_t TwoWire::Transfer(uint16_t address, uint8_t *buffer, size_t numToWrite, s
 
 }
 
+// Asynchronous transfers follow the same sequence as Transfer(), but each wait for a status bit is replaced by enabling the corresponding interrupt.
+// Blocks longer than this are sent or received by DMA, which must leave the last byte (when writing) or two bytes (when reading) to us.
+const size_t TwiDmaThreshold = 4;
+
+// Time after which an asynchronous transfer that has made no progress is abandoned. While the DMA is moving bytes there are no interrupts,
+// so IsBusy() counts a change in the number of bytes it has left as progress.
+const uint32_t TwiAsyncTimeoutMillis = 5;
+
+// Priority of the TWI interrupt for asynchronous transfers. The XDMAC interrupt has the same priority.
+const uint32_t TwiInterruptPriority = 5;
+
+#if SAME70
+const uint32_t TwiAsyncInterrupts = TWI_IDR_TXCOMP | TWI_IDR_RXRDY | TWI_IDR_TXRDY | TWI_IDR_NACK;
+#else
+const uint32_t TwiAsyncInterrupts = TWI_IDR_TXCOMP | TWI_IDR_RXRDY | TWI_IDR_TXRDY | TWI_IDR_NACK | TWI_IDR_ENDRX | TWI_IDR_ENDTX;
+#endif
+
+// Start a DMA transfer to the THR or from the RHR. When it has finished, DmaComplete is called from the interrupt.
+void TwoWire::StartDma(bool receive, uint8_t *buffer, size_t length)
+{
+	asyncLastDmaRemaining = length;
+#if SAME70
+	const uint32_t channel = GetDmaChannel(twi);
+	xdmac_channel_disable(XDMAC, channel);
+	xdmac_channel_config_t cfg = {0, 0, 0, 0, 0, 0, 0, 0};
+	cfg.mbr_ubc = length;
+	if (receive)
+	{
+		cfg.mbr_sa = reinterpret_cast<uint32_t>(&twi->TWIHS_RHR);
+		cfg.mbr_da = reinterpret_cast<uint32_t>(buffer);
+		cfg.mbr_cfg = XDMAC_CC_TYPE_PER_TRAN | XDMAC_CC_MBSIZE_SINGLE | XDMAC_CC_DSYNC_PER2MEM | XDMAC_CC_CSIZE_CHK_1
+					| XDMAC_CC_DWIDTH_BYTE | XDMAC_CC_SIF_AHB_IF1 | XDMAC_CC_DIF_AHB_IF0 | XDMAC_CC_SAM_FIXED_AM | XDMAC_CC_DAM_INCREMENTED_AM
+					| XDMAC_CC_PERID(GetDmaPeripheralId(twi, true));
+	}
+	else
+	{
+		cfg.mbr_sa = reinterpret_cast<uint32_t>(buffer);
+		cfg.mbr_da = reinterpret_cast<uint32_t>(&twi->TWIHS_THR);
+		cfg.mbr_cfg = XDMAC_CC_TYPE_PER_TRAN | XDMAC_CC_MBSIZE_SINGLE | XDMAC_CC_DSYNC_MEM2PER | XDMAC_CC_CSIZE_CHK_1
+					| XDMAC_CC_DWIDTH_BYTE | XDMAC_CC_SIF_AHB_IF0 | XDMAC_CC_DIF_AHB_IF1 | XDMAC_CC_SAM_INCREMENTED_AM | XDMAC_CC_DAM_FIXED_AM
+					| XDMAC_CC_PERID(GetDmaPeripheralId(twi, false));
+	}
+	xdmac_configure_transfer(XDMAC, channel, &cfg);
+	xdmac_channel_enable_interrupt(XDMAC, channel, XDMAC_CIE_BIE);
+	xdmac_enable_interrupt(XDMAC, channel);
+	xdmac_channel_enable(XDMAC, channel);
+#else
+	if (receive)
+	{
+		twi->TWI_RPR = reinterpret_cast<uintptr_t>(buffer);
+		twi->TWI_RCR = length;
+		twi->TWI_PTCR = TWI_PTCR_RXTEN;
+		twi->TWI_IER = TWI_IER_ENDRX;
+	}
+	else
+	{
+		twi->TWI_TPR = reinterpret_cast<uintptr_t>(buffer);
+		twi->TWI_TCR = length;
+		twi->TWI_PTCR = TWI_PTCR_TXTEN;
+		twi->TWI_IER = TWI_IER_ENDTX;
+	}
+#endif
+}
+
+// Return the number of bytes that the DMA has not yet transferred
+size_t TwoWire::GetDmaRemaining() const
+{
+#if SAME70
+	return XDMAC->XDMAC_CHID[GetDmaChannel(twi)].XDMAC_CUBC & XDMAC_CUBC_UBLEN_Msk;
+#else
+	return (asyncState == AsyncState::readingDma) ? twi->TWI_RCR : twi->TWI_TCR;
+#endif
+}
+
+void TwoWire::StopDma()
+{
+#if SAME70
+	const uint32_t channel = GetDmaChannel(twi);
+	xdmac_channel_disable_interrupt(XDMAC, channel, XDMAC_CIE_BIE);
+	xdmac_channel_disable(XDMAC, channel);
+	(void)xdmac_channel_get_interrupt_status(XDMAC, channel);		// clear any pending status
+#else
+	twi->TWI_IDR = TWI_IDR_ENDRX | TWI_IDR_ENDTX;
+	twi->TWI_PTCR = TWI_PTCR_RXTDIS | TWI_PTCR_TXTDIS;
+#endif
+}
+
+bool TwoWire::TransferAsync(uint16_t address, uint8_t *buffer, size_t numToWrite, size_t numToRead, TransferCompleteFunc callback, void *param, bool repeatedStart)
+{
+	if (asyncState != AsyncState::idle || numToRead + numToWrite == 0)
+	{
+		return false;
+	}
+
+	twi->TWI_IDR = TwiAsyncInterrupts;
+	NVIC_SetPriority(irqNumber, TwiInterruptPriority);
+	NVIC_ClearPendingIRQ(irqNumber);
+	NVIC_EnableIRQ(irqNumber);
+
+	asyncBuffer = buffer;
+	asyncNumToWrite = numToWrite;
+	asyncNumToRead = numToRead;
+	asyncBytesTransferred = 0;
+	asyncCallback = callback;
+	asyncCallbackParam = param;
+	asyncLastProgressMillis = millis();
+
+	const irqflags_t flags = cpu_irq_save();
+	if (repeatedStart && numToWrite != 0 && numToWrite <= 3 && numToRead != 0 && address < 0x80)
+	{
+		// The peripheral sends the internal address bytes, then a repeated START and the read address
+		uint32_t internalAddress = 0;
+		for (size_t i = 0; i < numToWrite; ++i)
+		{
+			internalAddress = (internalAddress << 8) | buffer[i];
+		}
+		twi->TWI_MMR = ((uint32_t)address << 16) | (numToWrite << TWI_MMR_IADRSZ_Pos);
+		twi->TWI_IADR = internalAddress;
+		asyncBytesTransferred = numToWrite;
+		StartAsyncRead();
+	}
+	else if (numToWrite != 0)
+	{
+		SetAddress(address);
+		StartAsyncWrite();
+	}
+	else
+	{
+		SetAddress(address);
+		StartAsyncRead();
+	}
+	cpu_irq_restore(flags);
+	return true;
+}
+
+// Start sending the bytes to write
+void TwoWire::StartAsyncWrite()
+{
+	if (asyncNumToWrite > TwiDmaThreshold)
+	{
+		// Let the DMA send all but the last byte
+		asyncState = AsyncState::writingDma;
+		StartDma(false, asyncBuffer, asyncNumToWrite - 1);
+		twi->TWI_IER = TWI_IER_NACK;
+	}
+	else
+	{
+		twi->TWI_THR = asyncBuffer[0];
+		asyncBytesLoaded = 1;
+		if (asyncNumToWrite == 1)
+		{
+			twi->TWI_CR = TWI_CR_STOP;
+		}
+		asyncState = AsyncState::writing;
+		twi->TWI_IER = TWI_IER_TXRDY | TWI_IER_NACK;
+	}
+}
+
+// Start receiving the bytes to read. The bytes are stored after the ones written.
+void TwoWire::StartAsyncRead()
+{
+	twi->TWI_MMR |= TWI_MMR_MREAD;
+	asyncBytesLoaded = 0;
+	if (asyncNumToRead == 1)
+	{
+		asyncState = AsyncState::readingLast;
+		twi->TWI_CR = TWI_CR_START | TWI_CR_STOP;
+		twi->TWI_IER = TWI_IER_RXRDY | TWI_IER_NACK;
+	}
+	else if (asyncNumToRead > TwiDmaThreshold)
+	{
+		// Let the DMA receive all but the last two bytes, because we must set STOP before reading the penultimate one
+		asyncState = AsyncState::readingDma;
+		StartDma(true, asyncBuffer + asyncNumToWrite, asyncNumToRead - 2);
+		twi->TWI_CR = TWI_CR_START;
+		twi->TWI_IER = TWI_IER_NACK;
+	}
+	else
+	{
+		asyncState = AsyncState::reading;
+		twi->TWI_CR = TWI_CR_START;
+		twi->TWI_IER = TWI_IER_RXRDY | TWI_IER_NACK;
+	}
+}
+
+// Finish an asynchronous transfer and call the callback. If timeoutErrorCounter is not null, the transfer timed out.
+void TwoWire::FinishAsync(uint32_t *timeoutErrorCounter)
+{
+	twi->TWI_IDR = TwiAsyncInterrupts;
+	StopDma();
+	if (timeoutErrorCounter != nullptr)
+	{
+		++*timeoutErrorCounter;
+		twi->TWI_CR = TWI_CR_STOP;					// this may not do any good
+	}
+	asyncState = AsyncState::idle;
+	if (asyncCallback != nullptr)
+	{
+		asyncCallback(this, asyncBytesTransferred, asyncCallbackParam);
+	}
+}
+
+void TwoWire::Interrupt()
+{
+	const uint32_t sr = twi->TWI_SR;						// reading this clears NACK
+	const uint32_t active = sr & twi->TWI_IMR;
+	if (active == 0)
+	{
+		return;
+	}
+	asyncLastProgressMillis = millis();
+
+	if ((sr & TWI_SR_NACK) != 0)
+	{
+		// The peripheral ends the transfer itself after a NAK
+		++errorCounts.naks;
+		if (asyncState == AsyncState::writingDma)
+		{
+			// Count the bytes that the DMA passed to the THR the same way as DmaComplete() does
+			const size_t loaded = asyncNumToWrite - 1 - GetDmaRemaining();
+			asyncBytesTransferred = (loaded == 0) ? 0 : loaded - 1;
+		}
+		else if (asyncState == AsyncState::readingDma)
+		{
+			asyncBytesTransferred = asyncNumToWrite + asyncNumToRead - 2 - GetDmaRemaining();
+		}
+		StopDma();
+		twi->TWI_IDR = TwiAsyncInterrupts;
+		asyncState = (asyncState < AsyncState::reading) ? AsyncState::writeFinishing : AsyncState::readFinishing;
+		asyncNumToRead = 0;									// don't start reading after a failed write
+		twi->TWI_IER = TWI_IER_TXCOMP;
+		return;
+	}
+
+	switch (asyncState)
+	{
+#if !SAME70
+	case AsyncState::writingDma:
+		if ((active & TWI_SR_ENDTX) != 0)
+		{
+			DmaComplete();
+		}
+		break;
+#endif
+
+	case AsyncState::writing:
+		if ((active & TWI_SR_TXRDY) != 0)
+		{
+			asyncBytesTransferred = asyncBytesLoaded;
+			if (asyncBytesLoaded < asyncNumToWrite)
+			{
+				twi->TWI_THR = asyncBuffer[asyncBytesLoaded++];
+				if (asyncBytesLoaded == asyncNumToWrite)
+				{
+					twi->TWI_CR = TWI_CR_STOP;
+				}
+			}
+			else
+			{
+				twi->TWI_IDR = TWI_IDR_TXRDY;
+				asyncState = AsyncState::writeFinishing;
+				twi->TWI_IER = TWI_IER_TXCOMP;
+			}
+		}
+		break;
+
+	case AsyncState::writeFinishing:
+		if ((active & TWI_SR_TXCOMP) != 0)
+		{
+			twi->TWI_IDR = TWI_IDR_TXCOMP;
+			if (asyncBytesTransferred == asyncNumToWrite && asyncNumToRead != 0)
+			{
+				StartAsyncRead();
+			}
+			else
+			{
+				FinishAsync(nullptr);
+			}
+		}
+		break;
+
+#if !SAME70
+	case AsyncState::readingDma:
+		if ((active & TWI_SR_ENDRX) != 0)
+		{
+			DmaComplete();
+		}
+		break;
+#endif
+
+	case AsyncState::reading:
+		if ((active & TWI_SR_RXRDY) != 0)
+		{
+			if (asyncBytesLoaded + 2 == asyncNumToRead)
+			{
+				// We must set the STOP flag before we read the penultimate byte from the RHR
+				twi->TWI_CR = TWI_CR_STOP;
+				asyncState = AsyncState::readingLast;
+			}
+			asyncBuffer[asyncNumToWrite + asyncBytesLoaded++] = twi->TWI_RHR;
+			++asyncBytesTransferred;
+		}
+		break;
+
+	case AsyncState::readingLast:
+		if ((active & TWI_SR_RXRDY) != 0)
+		{
+			asyncBuffer[asyncNumToWrite + asyncBytesLoaded++] = twi->TWI_RHR;
+			++asyncBytesTransferred;
+			twi->TWI_IDR = TWI_IDR_RXRDY;
+			asyncState = AsyncState::readFinishing;
+			twi->TWI_IER = TWI_IER_TXCOMP;
+		}
+		break;
+
+	case AsyncState::readFinishing:
+		if ((active & TWI_SR_TXCOMP) != 0)
+		{
+			FinishAsync(nullptr);
+		}
+		break;
+
+	case AsyncState::idle:
+	default:
+		twi->TWI_IDR = TwiAsyncInterrupts;
+		break;
+	}
+}
+
+// Called when the DMA has finished its part of a transfer
+void TwoWire::DmaComplete()
+{
+	StopDma();
+	if (asyncState == AsyncState::writingDma)
+	{
+		// All but the last byte have been passed to the THR. Send the last one when the THR is free.
+		asyncBytesLoaded = asyncNumToWrite - 1;
+		asyncBytesTransferred = asyncBytesLoaded - 1;
+		asyncState = AsyncState::writing;
+		twi->TWI_IER = TWI_IER_TXRDY;
+	}
+	else if (asyncState == AsyncState::readingDma)
+	{
+		// All but the last two bytes have been received. The next RXRDY is for the penultimate byte.
+		asyncBytesLoaded = asyncNumToRead - 2;
+		asyncBytesTransferred = asyncNumToWrite + asyncBytesLoaded;
+		asyncState = AsyncState::reading;
+		twi->TWI_IER = TWI_IER_RXRDY;
+	}
+}
+
+#if SAME70
+
+// Called from the XDMAC interrupt dispatcher
+/*static*/ void TwoWire::DmaInterruptHandler(CallbackParameter param, uint32_t status)
+{
+	static_cast<TwoWire *>(param.vp)->DmaInterrupt(status);
+}
+
+void TwoWire::DmaInterrupt(uint32_t status)
+{
+	if ((status & XDMAC_CIS_BIS) != 0)
+	{
+		// The TWIHS interrupt may have a different priority, so don't let it run while we change the state
+		const irqflags_t flags = cpu_irq_save();
+		asyncLastProgressMillis = millis();
+		DmaComplete();
+		cpu_irq_restore(flags);
+	}
+}
+
+#endif
+
+bool TwoWire::IsBusy()
+{
+	if (asyncState == AsyncState::idle)
+	{
+		return false;
+	}
+
+	const irqflags_t flags = cpu_irq_save();
+	if (asyncState == AsyncState::writingDma || asyncState == AsyncState::readingDma)
+	{
+		const size_t remaining = GetDmaRemaining();
+		if (remaining != asyncLastDmaRemaining)
+		{
+			asyncLastDmaRemaining = remaining;
+			asyncLastProgressMillis = millis();
+		}
+	}
+	if (asyncState != AsyncState::idle && millis() - asyncLastProgressMillis > TwiAsyncTimeoutMillis)
+	{
+		// Count the timeout the same way as Transfer() would have done
+		switch (asyncState)
+		{
+		case AsyncState::writing:
+		case AsyncState::writingDma:
+			FinishAsync(&errorCounts.sendTimeouts);
+			break;
+		case AsyncState::reading:
+		case AsyncState::readingDma:
+		case AsyncState::readingLast:
+			FinishAsync(&errorCounts.recvTimeouts);
+			break;
+		default:
+			FinishAsync(&errorCounts.finishTimeouts);
+			break;
+		}
+	}
+	const bool busy = (asyncState != AsyncState::idle);
+	cpu_irq_restore(flags);
+	return busy;
+}
+
 TwoWire::ErrorCounts TwoWire::GetErrorCounts(bool clear)
 {
 	const irqflags_t flags = cpu_irq_save();
@@ -235,7 +723,14 @@ static void Wire_Init(void)
 	NVIC_ClearPendingIRQ(WIRE_ISR_ID);
 }
 
-TwoWire Wire = TwoWire(WIRE_INTERFACE, Wire_Init);
+TwoWire Wire = TwoWire(WIRE_INTERFACE, WIRE_ISR_ID, Wire_Init);
+
+# ifdef WIRE_DEFINE_ISR_HANDLERS
+void WIRE_ISR_HANDLER()
+{
+	Wire.Interrupt();
+}
+# endif
 #endif
 
 #if WIRE_INTERFACES_COUNT > 1
@@ -248,9 +743,14 @@ static void Wire1_Init(void)
 	NVIC_ClearPendingIRQ(WIRE1_ISR_ID);
 }
 
-TwoWire Wire1 = TwoWire(WIRE1_INTERFACE, Wire1_Init);
-#endif
+TwoWire Wire1 = TwoWire(WIRE1_INTERFACE, WIRE1_ISR_ID, Wire1_Init);
 
+# ifdef WIRE_DEFINE_ISR_HANDLERS
+void WIRE1_ISR_HANDLER()
+{
+	Wire1.Interrupt();
+}
+# endif
 #endif
 
 // End
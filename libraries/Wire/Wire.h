@@ -19,17 +19,14 @@
 
 #include "compiler.h"
 
-#if SAME70
-// TWI disabled for now
-#else
-
 #include "Stream.h"
 #include "variant.h"
 
 #define BUFFER_LENGTH 32
 
 #if SAME70
-# define Twi Twihs
+# include "XdmacInterrupts.h"
+typedef Twihs Twi;
 #endif
 
 class TwoWire
@@ -47,23 +44,78 @@ public:
 
 	typedef uint32_t (*WaitForStatusFunc)(Twi *twi, uint32_t bitsToWaitFor);
 
-	TwoWire(Twi *twi, void(*begin_cb)(void));
+	// Function called when an asynchronous transfer has finished, from the TWI interrupt or from IsBusy() if it timed out. A new transfer may be started from it.
+	typedef void (*TransferCompleteFunc)(TwoWire *wire, size_t bytesTransferred, void *param);
+
+	TwoWire(Twi *twi, IRQn_Type irqn, void(*begin_cb)(void));
 
 	void BeginMaster(uint32_t clockFrequency);
 	size_t Transfer(uint16_t address, uint8_t *buffer, size_t numToWrite, size_t numToRead, WaitForStatusFunc statusWaitFunc = DefaultWaitForStatusFunc);
 	ErrorCounts GetErrorCounts(bool clear);
 
+	// Start a write-then-read transfer driven by the TWI interrupt, using the PDC (or the XDMAC on the SAME70) for longer blocks. Returns false if a transfer is already in progress.
+	// The buffer must remain valid until the callback has been called. The number of bytes transferred is counted as in Transfer().
+	// The TWI interrupt, and on the SAME70 the XDMAC interrupt, are given priority 5.
+	// If repeatedStart is true and 1 to 3 bytes are written before reading, they are sent as the internal address so that the read follows a repeated START.
+	bool TransferAsync(uint16_t address, uint8_t *buffer, size_t numToWrite, size_t numToRead, TransferCompleteFunc callback, void *param, bool repeatedStart = false);
+
+	// Return true if an asynchronous transfer is in progress. If it has made no progress for too long, it is abandoned and the callback is called.
+	// Call this periodically while waiting for an asynchronous transfer, and before calling Transfer().
+	bool IsBusy();
+
+	// Interrupt handler, called from the TWI ISR. If WIRE_DEFINE_ISR_HANDLERS is defined, this library defines the TWI ISRs of Wire and Wire1;
+	// otherwise the application must define them, so that existing applications that already define them still link.
+	void Interrupt();
+
 	static uint32_t DefaultWaitForStatusFunc(Twi *twi, uint32_t bitsToWaitFor);
 
 private:
+	enum class AsyncState : uint8_t
+	{
+		idle,
+		writing,						// sending bytes from the THR
+		writingDma,						// the PDC or XDMAC is sending all bytes except the last
+		writeFinishing,					// waiting for TXCOMP after writing
+		reading,						// receiving bytes from the RHR
+		readingDma,						// the PDC or XDMAC is receiving all bytes except the last two
+		readingLast,					// STOP has been requested, waiting for the last byte
+		readFinishing					// waiting for TXCOMP after reading
+	};
+
+	void SetAddress(uint16_t address);
+	void StartAsyncWrite();
+	void StartAsyncRead();
+	void FinishAsync(uint32_t *timeoutErrorCounter);
+	void StartDma(bool receive, uint8_t *buffer, size_t length);
+	void StopDma();
+	size_t GetDmaRemaining() const;
+	void DmaComplete();
+#if SAME70
+	static void DmaInterruptHandler(CallbackParameter param, uint32_t status);
+	void DmaInterrupt(uint32_t status);
+#endif
+
 	bool WaitForStatus(uint32_t statusBit, uint32_t& timeoutErrorCounter, WaitForStatusFunc statusWaitFunc);
 	bool WaitTransferComplete(WaitForStatusFunc statusWaitFunc);
 	bool WaitByteSent(WaitForStatusFunc statusWaitFunc);
 	bool WaitByteReceived(WaitForStatusFunc statusWaitFunc);
 
 	Twi *twi;							// TWI instance
+	IRQn_Type irqNumber;				// TWI interrupt number
 	void (*onBeginCallback)(void);		// called before initialization
 	ErrorCounts errorCounts;			// error counts
+
+	// Asynchronous transfer state, shared with the interrupt handler
+	volatile AsyncState asyncState;
+	uint8_t *asyncBuffer;
+	size_t asyncNumToWrite;
+	size_t asyncNumToRead;
+	size_t asyncBytesLoaded;			// number of bytes written to the THR or DMA, or read from the RHR or DMA
+	size_t asyncBytesTransferred;		// number of bytes known to have been sent or received
+	TransferCompleteFunc asyncCallback;
+	void *asyncCallbackParam;
+	volatile uint32_t asyncLastProgressMillis;
+	size_t asyncLastDmaRemaining;		// value of GetDmaRemaining() when progress was last recorded
 };
 
 #if WIRE_INTERFACES_COUNT > 0
@@ -75,5 +127,3 @@ extern TwoWire Wire1;
 
 #endif
 
-#endif
-
@@ -0,0 +1,285 @@
+/*
+ * FakeTwi.cpp
+ */
+
+#include "FakeTwi.h"
+#include <cstdio>
+
+uint32_t fakeMillis = 0;
+
+static bool irqEnabled[32];
+static uint32_t irqPriority[32];
+
+void NVIC_EnableIRQ(IRQn_Type irqn) { irqEnabled[irqn] = true; }
+void NVIC_DisableIRQ(IRQn_Type irqn) { irqEnabled[irqn] = false; }
+void NVIC_ClearPendingIRQ(IRQn_Type) { }
+void NVIC_SetPriority(IRQn_Type irqn, uint32_t priority) { irqPriority[irqn] = priority; }
+bool FakeIrqEnabled(IRQn_Type irqn) { return irqEnabled[irqn]; }
+uint32_t FakeIrqPriority(IRQn_Type irqn) { return irqPriority[irqn]; }
+
+FakeTwiRegister::operator uint32_t() const
+{
+	return owner->Read(reg);
+}
+
+FakeTwiRegister& FakeTwiRegister::operator=(uint32_t val)
+{
+	owner->Write(reg, val);
+	return *this;
+}
+
+uint32_t twi_master_init(Twi *twi, const twi_options_t *)
+{
+	twi->Reset();
+	return 0;
+}
+
+Twi::Twi()
+	: TWI_CR(this, cr), TWI_MMR(this, mmr), TWI_IADR(this, iadr), TWI_SR(this, sr), TWI_IER(this, ier), TWI_IDR(this, idr), TWI_IMR(this, imr),
+	  TWI_RHR(this, rhr), TWI_THR(this, thr), TWI_PTCR(this, ptcr), TWI_RPR(this, rpr), TWI_RCR(this, rcr), TWI_TPR(this, tpr), TWI_TCR(this, tcr)
+{
+	Reset();
+}
+
+void Twi::Reset()
+{
+	phase = Phase::idle;
+	addressPending = stopRequested = lastByte = thrFull = shifting = false;
+	thrData = shiftData = rhrData = 0;
+	status = TWI_SR_TXCOMP | TWI_SR_TXRDY;
+	intMask = mode = internalAddress = 0;
+	dataBytesSent = 0;
+	rxPdcEnabled = txPdcEnabled = false;
+	rxPointer = rxCount = txPointer = txCount = 0;
+}
+
+// The PDC pointer registers hold the low 32 bits of a host address. The buffers used in the tests are static, so they share the high bits of
+// this function's static variable.
+uint8_t *Twi::HostAddress(uint32_t pdcAddress)
+{
+	static uint8_t anchor;
+	return reinterpret_cast<uint8_t *>((reinterpret_cast<uintptr_t>(&anchor) & ~(uintptr_t)0xFFFFFFFF) | pdcAddress);
+}
+
+uint32_t Twi::PeekStatus() const
+{
+	return status | ((rxCount == 0) ? TWI_SR_ENDRX : 0) | ((txCount == 0) ? TWI_SR_ENDTX : 0);
+}
+
+uint32_t Twi::Read(unsigned int reg)
+{
+	switch (reg)
+	{
+	case sr:
+		{
+			const uint32_t ret = PeekStatus();
+			status &= ~TWI_SR_NACK;
+			return ret;
+		}
+
+	case rhr:
+		status &= ~TWI_SR_RXRDY;
+		lastByte = stopRequested;			// the receiver starts on the next byte, so STOP must already have been requested if this is the last
+		return rhrData;
+
+	case mmr:	return mode;
+	case iadr:	return internalAddress;
+	case imr:	return intMask;
+	case rpr:	return rxPointer;
+	case rcr:	return rxCount;
+	case tpr:	return txPointer;
+	case tcr:	return txCount;
+	default:	return 0;
+	}
+}
+
+void Twi::Write(unsigned int reg, uint32_t val)
+{
+	switch (reg)
+	{
+	case cr:
+		if ((val & TWI_CR_START) != 0 && phase == Phase::idle && (mode & TWI_MMR_MREAD) != 0)
+		{
+			StartTransfer(Phase::reading);
+		}
+		if ((val & TWI_CR_STOP) != 0)
+		{
+			stopRequested = true;
+		}
+		break;
+
+	case thr:
+		thrData = (uint8_t)val;
+		thrFull = true;
+		status &= ~TWI_SR_TXRDY;
+		if (phase == Phase::idle && (mode & TWI_MMR_MREAD) == 0)
+		{
+			StartTransfer(Phase::writing);
+		}
+		break;
+
+	case ptcr:
+		if ((val & TWI_PTCR_RXTDIS) != 0) { rxPdcEnabled = false; }
+		if ((val & TWI_PTCR_TXTDIS) != 0) { txPdcEnabled = false; }
+		if ((val & TWI_PTCR_RXTEN) != 0) { rxPdcEnabled = true; }
+		if ((val & TWI_PTCR_TXTEN) != 0) { txPdcEnabled = true; }
+		break;
+
+	case mmr:	mode = val; break;
+	case iadr:	internalAddress = val; break;
+	case ier:	intMask |= val; break;
+	case idr:	intMask &= ~val; break;
+	case rpr:	rxPointer = val; break;
+	case rcr:	rxCount = val; break;
+	case tpr:	txPointer = val; break;
+	case tcr:	txCount = val; break;
+	default:	break;
+	}
+	RunPdc();
+}
+
+void Twi::StartTransfer(Phase p)
+{
+	phase = p;
+	addressPending = true;
+	stopRequested = lastByte = shifting = false;
+	dataBytesSent = 0;
+	status &= ~TWI_SR_TXCOMP;
+}
+
+// Send the START and address, and the internal address followed by a repeated START if there is one. Returns false if the slave NAKed.
+bool Twi::SendAddress(bool read)
+{
+	const unsigned int address = (mode >> 16) & 0x7F;
+	const unsigned int internalAddressSize = (mode >> TWI_MMR_IADRSZ_Pos) & 3;
+	char buf[8];
+	if (read && internalAddressSize != 0)
+	{
+		snprintf(buf, sizeof(buf), "S%02XW", address);
+		slave.log += buf;
+		for (unsigned int i = internalAddressSize; i != 0; --i)
+		{
+			slave.received.push_back((uint8_t)(internalAddress >> (8 * (i - 1))));
+		}
+	}
+	snprintf(buf, sizeof(buf), "S%02X%c", address, (read) ? 'R' : 'W');
+	slave.log += buf;
+	return slave.nackAt != 0;
+}
+
+void Twi::Nack()
+{
+	slave.log += 'N';
+	status |= TWI_SR_NACK | TWI_SR_TXCOMP;
+	thrFull = shifting = false;
+	phase = Phase::idle;
+}
+
+void Twi::Stop()
+{
+	slave.log += 'P';
+	status |= TWI_SR_TXCOMP;
+	stopRequested = false;
+	phase = Phase::idle;
+}
+
+void Twi::Step()
+{
+	switch (phase)
+	{
+	case Phase::writing:
+		if (addressPending)
+		{
+			addressPending = false;
+			if (!SendAddress(false))
+			{
+				Nack();
+				break;
+			}
+			if (slave.hang)
+			{
+				phase = Phase::hung;
+				break;
+			}
+		}
+		else if (shifting)
+		{
+			shifting = false;
+			++dataBytesSent;
+			if (slave.nackAt == (int)dataBytesSent)
+			{
+				Nack();
+				break;
+			}
+			slave.received.push_back(shiftData);
+		}
+
+		if (thrFull)
+		{
+			shiftData = thrData;
+			thrFull = false;
+			shifting = true;
+			status |= TWI_SR_TXRDY;
+		}
+		else if (stopRequested)
+		{
+			Stop();
+		}
+		break;											// otherwise the clock is held low until there is another byte or a STOP
+
+	case Phase::reading:
+		if (addressPending)
+		{
+			addressPending = false;
+			if (!SendAddress(true))
+			{
+				Nack();
+			}
+			else if (slave.hang)
+			{
+				phase = Phase::hung;
+			}
+			else
+			{
+				lastByte = stopRequested;
+			}
+		}
+		else if ((status & TWI_SR_RXRDY) == 0)			// the clock is held low until the last byte has been read from the RHR
+		{
+			rhrData = (slave.readIndex < slave.readData.size()) ? slave.readData[slave.readIndex] : 0xFF;
+			++slave.readIndex;
+			status |= TWI_SR_RXRDY;
+			if (lastByte)
+			{
+				Stop();
+			}
+		}
+		break;
+
+	case Phase::idle:
+	case Phase::hung:
+		break;
+	}
+	RunPdc();
+}
+
+// Let the PDC move a byte if it can
+void Twi::RunPdc()
+{
+	if (txPdcEnabled && txCount != 0 && (status & TWI_SR_TXRDY) != 0 && phase != Phase::hung)
+	{
+		uint8_t * const p = HostAddress(txPointer);
+		++txPointer;
+		--txCount;
+		Write(thr, *p);
+	}
+	if (rxPdcEnabled && rxCount != 0 && (status & TWI_SR_RXRDY) != 0)
+	{
+		uint8_t * const p = HostAddress(rxPointer);
+		++rxPointer;
+		--rxCount;
+		*p = (uint8_t)Read(rhr);
+	}
+}
+
+// End
@@ -0,0 +1,153 @@
+/*
+ * FakeTwi.h
+ *
+ * A fake of the SAM3X/SAM4 TWI peripheral in master mode, with its PDC channel, for testing the Wire library on a host.
+ * It stands in for the CMSIS Twi register block: the register members are objects that pass reads and writes to the model.
+ * The bus moves one byte each time Step() is called, and a scripted slave device answers.
+ *
+ * Also declares the few NVIC, timer and interrupt functions that Wire.cpp uses.
+ */
+
+#ifndef FAKETWI_H_
+#define FAKETWI_H_
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Register bits, as in the SAM4E device header
+#define TWI_CR_START		(0x1u << 0)
+#define TWI_CR_STOP			(0x1u << 1)
+#define TWI_MMR_IADRSZ_Pos	8
+#define TWI_MMR_MREAD		(0x1u << 12)
+#define TWI_SR_TXCOMP		(0x1u << 0)
+#define TWI_SR_RXRDY		(0x1u << 1)
+#define TWI_SR_TXRDY		(0x1u << 2)
+#define TWI_SR_NACK			(0x1u << 8)
+#define TWI_SR_ENDRX		(0x1u << 12)
+#define TWI_SR_ENDTX		(0x1u << 13)
+#define TWI_IER_TXCOMP		TWI_SR_TXCOMP
+#define TWI_IER_RXRDY		TWI_SR_RXRDY
+#define TWI_IER_TXRDY		TWI_SR_TXRDY
+#define TWI_IER_NACK		TWI_SR_NACK
+#define TWI_IER_ENDRX		TWI_SR_ENDRX
+#define TWI_IER_ENDTX		TWI_SR_ENDTX
+#define TWI_IDR_TXCOMP		TWI_SR_TXCOMP
+#define TWI_IDR_RXRDY		TWI_SR_RXRDY
+#define TWI_IDR_TXRDY		TWI_SR_TXRDY
+#define TWI_IDR_NACK		TWI_SR_NACK
+#define TWI_IDR_ENDRX		TWI_SR_ENDRX
+#define TWI_IDR_ENDTX		TWI_SR_ENDTX
+#define TWI_PTCR_RXTEN		(0x1u << 0)
+#define TWI_PTCR_RXTDIS		(0x1u << 1)
+#define TWI_PTCR_TXTEN		(0x1u << 8)
+#define TWI_PTCR_TXTDIS		(0x1u << 9)
+#define UART_PTCR_RXTDIS	TWI_PTCR_RXTDIS
+#define UART_PTCR_TXTDIS	TWI_PTCR_TXTDIS
+
+class Twi;
+
+// One register of the fake peripheral
+class FakeTwiRegister
+{
+public:
+	FakeTwiRegister(Twi *t, unsigned int r) : owner(t), reg(r) { }
+	FakeTwiRegister(const FakeTwiRegister&) = delete;
+
+	operator uint32_t() const;
+	FakeTwiRegister& operator=(uint32_t val);
+	FakeTwiRegister& operator|=(uint32_t val) { return *this = (uint32_t)*this | val; }
+
+private:
+	Twi * const owner;
+	const unsigned int reg;
+};
+
+// Scripted behaviour of the slave device
+struct FakeTwiSlave
+{
+	int nackAt = -1;						// -1 never NAK, 0 NAK the address, n > 0 NAK the nth data byte written
+	bool hang = false;						// after the address, hold the clock low for ever
+	std::vector<uint8_t> readData;			// bytes to return when read
+	size_t readIndex = 0;
+	std::vector<uint8_t> received;			// data bytes written to the slave and acknowledged by it
+	std::string log;						// S<addr>W or S<addr>R for a START, N for a NAK, P for a STOP
+};
+
+class Twi
+{
+public:
+	enum Reg : unsigned int { cr, mmr, iadr, sr, ier, idr, imr, rhr, thr, ptcr, rpr, rcr, tpr, tcr };
+
+	Twi();
+	Twi(const Twi&) = delete;
+
+	void Reset();							// as after twi_master_init()
+	void Step();							// move the bus on by one byte
+	bool IsIdle() const { return phase == Phase::idle; }
+	uint32_t PeekStatus() const;			// the status register, without clearing NACK
+	uint32_t GetInterruptMask() const { return intMask; }
+
+	uint32_t Read(unsigned int reg);
+	void Write(unsigned int reg, uint32_t val);
+
+	FakeTwiRegister TWI_CR, TWI_MMR, TWI_IADR, TWI_SR, TWI_IER, TWI_IDR, TWI_IMR, TWI_RHR, TWI_THR, TWI_PTCR, TWI_RPR, TWI_RCR, TWI_TPR, TWI_TCR;
+	FakeTwiSlave slave;
+
+private:
+	enum class Phase { idle, writing, reading, hung };
+
+	void StartTransfer(Phase p);
+	bool SendAddress(bool read);
+	void Nack();
+	void Stop();
+	void RunPdc();
+	static uint8_t *HostAddress(uint32_t pdcAddress);
+
+	Phase phase;
+	bool addressPending;					// the START and address have not been sent yet
+	bool stopRequested;
+	bool lastByte;							// the byte being received is the last one
+	bool thrFull;
+	bool shifting;							// a byte is being sent
+	uint8_t thrData, shiftData, rhrData;
+	uint32_t status;						// TXCOMP, RXRDY, TXRDY and NACK
+	uint32_t intMask;
+	uint32_t mode, internalAddress;
+	size_t dataBytesSent;
+	bool rxPdcEnabled, txPdcEnabled;
+	uint32_t rxPointer, rxCount, txPointer, txCount;
+};
+
+struct twi_options_t
+{
+	uint32_t master_clk;
+	uint32_t speed;
+	uint8_t chip;
+	bool smbus;
+};
+
+uint32_t twi_master_init(Twi *twi, const twi_options_t *opt);
+
+// NVIC, interrupt and timer stand-ins
+enum IRQn_Type { TWI0_IRQn = 19, TWI1_IRQn = 20 };
+void NVIC_EnableIRQ(IRQn_Type irqn);
+void NVIC_DisableIRQ(IRQn_Type irqn);
+void NVIC_ClearPendingIRQ(IRQn_Type irqn);
+void NVIC_SetPriority(IRQn_Type irqn, uint32_t priority);
+bool FakeIrqEnabled(IRQn_Type irqn);
+uint32_t FakeIrqPriority(IRQn_Type irqn);
+
+typedef uint32_t irqflags_t;
+static inline irqflags_t cpu_irq_save() { return 0; }
+static inline void cpu_irq_restore(irqflags_t) { }
+
+extern uint32_t fakeMillis;
+static inline uint32_t millis() { return fakeMillis; }
+
+struct CoreWaitState { uint32_t polls; };
+static inline void CoreWaitStart(CoreWaitState *ws, uint32_t) { ws->polls = 0; }
+static inline bool CoreWaitPoll(CoreWaitState *ws) { return ++ws->polls > 1000; }
+
+#endif /* FAKETWI_H_ */
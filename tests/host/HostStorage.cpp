@@ -0,0 +1,98 @@
+/*
+ * HostStorage.cpp
+ *
+ * The host platform for the storage library: the simulated clock and pins declared in the host Core.h, and HSMCI and SPI drivers that
+ * behave as though no card were present. Tests plug SdCardModel into a slot with sd_mmc_set_driver_interface(). Asynchronous requests to
+ * that slot still use the HSMCI end of transfer interrupt, which is simulated here.
+ */
+
+#include "Core.h"
+#include "conf_sd_mmc.h"
+#include "hsmci.h"
+#include "sd_mmc_spi.h"
+
+HostDwt_Type hostDwt = { 0 };
+uint32_t SystemCoreClock = 120000000;
+
+static uint64_t simulatedMicros = 0;
+
+void HostAdvanceTime(uint32_t micros)
+{
+	simulatedMicros += micros;
+	hostDwt.CYCCNT += micros * (SystemCoreClock/1000000);
+}
+
+uint64_t HostGetMicros(void)
+{
+	return simulatedMicros;
+}
+
+uint32_t millis(void)
+{
+	return (uint32_t)(simulatedMicros/1000);
+}
+
+void EnableCycleCounter(void) { }
+
+void pinMode(Pin, int) { }
+bool digitalRead(Pin) { return true; }
+
+// HSMCI with an empty slot
+
+void hsmci_init(void) { }
+uint8_t hsmci_get_bus_width(uint8_t) { return 4; }
+bool hsmci_is_high_speed_capable(void) { return true; }
+void hsmci_select_device(uint8_t, uint32_t, uint8_t, bool) { }
+void hsmci_deselect_device(uint8_t) { }
+void hsmci_send_clock(void) { }
+bool hsmci_send_cmd(sdmmc_cmd_def_t, uint32_t) { return false; }
+uint32_t hsmci_get_response(void) { return 0xFFFFFFFF; }
+void hsmci_get_response_128(uint8_t *) { }
+bool hsmci_adtc_start(sdmmc_cmd_def_t, uint32_t, uint16_t, uint16_t, bool) { return false; }
+bool hsmci_adtc_stop(sdmmc_cmd_def_t, uint32_t) { return false; }
+bool hsmci_read_word(uint32_t *) { return false; }
+bool hsmci_write_word(uint32_t) { return false; }
+bool hsmci_start_read_blocks(void *, uint16_t) { return false; }
+bool hsmci_wait_end_of_read_blocks(void) { return false; }
+bool hsmci_start_write_blocks(const void *, uint16_t) { return false; }
+bool hsmci_wait_end_of_write_blocks(void) { return false; }
+uint32_t hsmci_get_speed(void) { return 0; }
+hsmciIdleFunc_t hsmci_set_idle_func(hsmciIdleFunc_t) { return nullptr; }
+
+// The end of transfer interrupt of an asynchronous request. A simulated card finishes its data phase at once, so the interrupt is pending as
+// soon as it is enabled.
+static bool hsmciInterruptEnabled = false;
+
+void hsmci_enable_end_of_transfer_interrupt(bool)
+{
+	hsmciInterruptEnabled = true;
+}
+
+bool hsmci_disable_interrupts(void)
+{
+	const bool wasEnabled = hsmciInterruptEnabled;
+	hsmciInterruptEnabled = false;
+	return wasEnabled;
+}
+
+// SPI with an empty slot
+
+void sd_mmc_spi_init(const Pin[]) { }
+sd_mmc_spi_errno_t sd_mmc_spi_get_errno(void) { return SD_MMC_SPI_NO_ERR; }
+void sd_mmc_spi_select_device(uint8_t, uint32_t, uint8_t, bool) { }
+void sd_mmc_spi_deselect_device(uint8_t) { }
+void sd_mmc_spi_send_clock(void) { }
+bool sd_mmc_spi_send_cmd(sdmmc_cmd_def_t, uint32_t) { return false; }
+uint32_t sd_mmc_spi_get_response(void) { return 0xFFFFFFFF; }
+bool sd_mmc_spi_adtc_start(sdmmc_cmd_def_t, uint32_t, uint16_t, uint16_t, bool) { return false; }
+bool sd_mmc_spi_adtc_stop(sdmmc_cmd_def_t, uint32_t) { return false; }
+bool sd_mmc_spi_read_word(uint32_t *) { return false; }
+bool sd_mmc_spi_write_word(uint32_t) { return false; }
+bool sd_mmc_spi_start_read_blocks(void *, uint16_t) { return false; }
+bool sd_mmc_spi_wait_end_of_read_blocks(void) { return false; }
+bool sd_mmc_spi_start_write_blocks(const void *, uint16_t) { return false; }
+bool sd_mmc_spi_wait_end_of_write_blocks(void) { return false; }
+uint32_t spi_mmc_get_speed(void) { return 0; }
+spiIdleFunc_t sd_mmc_spi_set_idle_func(spiIdleFunc_t) { return nullptr; }
+
+// End
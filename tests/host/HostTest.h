@@ -0,0 +1,32 @@
+/*
+ * HostTest.h
+ *
+ * Minimal test helpers for the host tests. A test program returns the value of TestResult() from main().
+ */
+
+#ifndef HOSTTEST_H_
+#define HOSTTEST_H_
+
+#include <cstdio>
+
+static unsigned int testFailures = 0;
+
+#define CHECK(cond) \
+	do { if (!(cond)) { std::printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); ++testFailures; } } while (false)
+
+#define CHECK_EQUAL(expected, actual) \
+	do { const long long e_ = (long long)(expected), a_ = (long long)(actual); \
+		 if (e_ != a_) { std::printf("%s:%d: expected %s == %lld, got %lld\n", __FILE__, __LINE__, #actual, e_, a_); ++testFailures; } } while (false)
+
+static inline int TestResult(const char *name)
+{
+	if (testFailures == 0)
+	{
+		std::printf("%s: passed\n", name);
+		return 0;
+	}
+	std::printf("%s: %u failures\n", name, testFailures);
+	return 1;
+}
+
+#endif /* HOSTTEST_H_ */
@@ -0,0 +1,617 @@
+/*
+ * SdCardModel.cpp
+ */
+
+#include "SdCardModel.h"
+#include "Core.h"
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+const struct DriverInterface SdCardModel::Interface =
+{
+	.select_device = SdCardModel::SelectDevice,
+	.deselect_device = SdCardModel::DeselectDevice,
+	.get_bus_width = SdCardModel::GetSlotBusWidth,
+	.is_high_speed_capable = SdCardModel::IsHighSpeedCapable,
+	.send_clock = SdCardModel::SendClock,
+	.send_cmd = SdCardModel::SendCmd,
+	.get_response = SdCardModel::GetResponse,
+	.get_response_128 = SdCardModel::GetResponse128,
+	.adtc_start = SdCardModel::AdtcStart,
+	.adtc_stop = SdCardModel::SendCmd,
+	.read_word = SdCardModel::ReadWord,
+	.write_word = SdCardModel::WriteWord,
+	.start_read_blocks = SdCardModel::StartReadBlocks,
+	.wait_end_of_read_blocks = SdCardModel::WaitEndOfReadBlocks,
+	.start_write_blocks = SdCardModel::StartWriteBlocks,
+	.wait_end_of_write_blocks = SdCardModel::WaitEndOfWriteBlocks,
+	.getInterfaceSpeed = SdCardModel::GetInterfaceSpeed,
+	.set_idle_func = SdCardModel::SetIdleFunc,
+	.is_spi = false,
+};
+
+SdCardModel *SdCardModel::slots[2] = { nullptr, nullptr };
+SdCardModel *SdCardModel::selected = nullptr;
+driverIdleFunc_t SdCardModel::idleFunc = nullptr;
+
+static const uint16_t CardRca = 0x4567;
+static const uint32_t DefaultSpeedMaxClock = 25000000;
+static const uint32_t HighSpeedMaxClock = 50000000;
+static const uint32_t CardStateTran = 4u << 9;
+static const uint32_t CardStateData = 5u << 9;
+static const uint32_t CardStateRcv = 6u << 9;
+
+// Store a field in a register that SDMMC_UNSTUFF_BITS reads, i.e. with the most significant byte first
+static void StuffBits(uint8_t *reg, unsigned int regBits, unsigned int pos, unsigned int size, uint32_t value)
+{
+	for (unsigned int i = 0; i < size; ++i)
+	{
+		const unsigned int bit = pos + i;
+		const uint8_t mask = (uint8_t)(1u << (bit % 8));
+		uint8_t& b = reg[(regBits - 1 - bit)/8];
+		b = ((value >> i) & 1u) ? (b | mask) : (b & ~mask);
+	}
+}
+
+SdCardModel::SdCardModel(uint32_t nb, const SdCardTiming& t)
+	: timing(t), numBlocks(nb & ~1023u), memory((size_t)numBlocks * SD_MMC_BLOCK_SIZE, 0xFF), fd(-1),
+	  clock(0), busWidth(1), waitRemainderNs(0), pendingNs(0)
+{
+	counters = SdCardCounters();
+	MakeCsd();
+	Reset();
+}
+
+SdCardModel::~SdCardModel()
+{
+	for (SdCardModel *& s : slots)
+	{
+		if (s == this)
+		{
+			s = nullptr;
+		}
+	}
+	if (selected == this)
+	{
+		selected = nullptr;
+	}
+	if (fd >= 0)
+	{
+		close(fd);
+	}
+}
+
+bool SdCardModel::UseFile(const std::string& path)
+{
+	const int f = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+	if (f < 0)
+	{
+		return false;
+	}
+	const off_t size = (off_t)numBlocks * SD_MMC_BLOCK_SIZE;
+	if (lseek(f, 0, SEEK_END) < size && ftruncate(f, size) != 0)
+	{
+		close(f);
+		return false;
+	}
+	if (fd >= 0)
+	{
+		close(fd);
+	}
+	fd = f;
+	std::vector<uint8_t>().swap(memory);
+	return true;
+}
+
+void SdCardModel::Insert(uint8_t driverSlot, SdCardModel *card)
+{
+	if (driverSlot < 2)
+	{
+		if (selected == slots[driverSlot])
+		{
+			selected = nullptr;
+		}
+		slots[driverSlot] = card;
+	}
+}
+
+void SdCardModel::ReadStored(uint32_t block, void *dest) const
+{
+	if (fd >= 0)
+	{
+		if (pread(fd, dest, SD_MMC_BLOCK_SIZE, (off_t)block * SD_MMC_BLOCK_SIZE) != SD_MMC_BLOCK_SIZE)
+		{
+			memset(dest, 0, SD_MMC_BLOCK_SIZE);
+		}
+	}
+	else
+	{
+		memcpy(dest, &memory[(size_t)block * SD_MMC_BLOCK_SIZE], SD_MMC_BLOCK_SIZE);
+	}
+}
+
+void SdCardModel::WriteStored(uint32_t block, const void *src)
+{
+	if (fd >= 0)
+	{
+		(void)pwrite(fd, src, SD_MMC_BLOCK_SIZE, (off_t)block * SD_MMC_BLOCK_SIZE);
+	}
+	else
+	{
+		memcpy(&memory[(size_t)block * SD_MMC_BLOCK_SIZE], src, SD_MMC_BLOCK_SIZE);
+	}
+}
+
+// Go back to the state after power up, as CMD0 does
+void SdCardModel::Reset()
+{
+	appCommand = highSpeed = multiBlock = false;
+	rca = 0;
+	response = 0;
+	preErase = preErasedLeft = 0;
+	transfer = Transfer::none;
+	nextBlock = blocksLeft = 0;
+	dataLength = 0;
+	pendingNs = 0;
+}
+
+// Build a version 2.0 CSD, as used by SDHC and SDXC cards
+void SdCardModel::MakeCsd()
+{
+	memset(csd, 0, sizeof(csd));
+	StuffBits(csd, CSD_REG_BIT_SIZE, 126, 2, SD_CSD_VER_2_0);
+	StuffBits(csd, CSD_REG_BIT_SIZE, 112, 8, 0x0E);							// TAAC
+	StuffBits(csd, CSD_REG_BIT_SIZE, 96, 8, 0x32);							// TRAN_SPEED, 25MHz
+	StuffBits(csd, CSD_REG_BIT_SIZE, 84, 12, 0x5B5);						// CCC
+	StuffBits(csd, CSD_REG_BIT_SIZE, 80, 4, 9);								// READ_BL_LEN, 512 bytes
+	StuffBits(csd, CSD_REG_BIT_SIZE, 48, 22, (numBlocks/1024) - 1);			// C_SIZE, in units of 512KB
+	StuffBits(csd, CSD_REG_BIT_SIZE, 46, 1, 1);								// ERASE_BLK_EN
+	StuffBits(csd, CSD_REG_BIT_SIZE, 39, 7, 0x7F);							// SECTOR_SIZE
+	StuffBits(csd, CSD_REG_BIT_SIZE, 26, 3, 2);								// R2W_FACTOR
+	StuffBits(csd, CSD_REG_BIT_SIZE, 22, 4, 9);								// WRITE_BL_LEN
+	StuffBits(csd, CSD_REG_BIT_SIZE, 0, 1, 1);								// always 1
+}
+
+// Move the simulated clock on, carrying over any part of a microsecond
+void SdCardModel::Wait(uint64_t nanos)
+{
+	const uint64_t total = waitRemainderNs + nanos;
+	waitRemainderNs = total % 1000;
+	uint64_t micros = total/1000;
+	while (micros > 0xFFFFFFFF)
+	{
+		HostAdvanceTime(0xFFFFFFFF);
+		micros -= 0xFFFFFFFF;
+	}
+	HostAdvanceTime((uint32_t)micros);
+}
+
+// Return the time to send a block of data across the bus, including its start bit, CRC and end bit.
+// If 'throttled' is true then the block is card memory, which can't be read or written faster than the card allows.
+uint64_t SdCardModel::TransferNs(size_t length, bool throttled) const
+{
+	const uint64_t clocks = (length * 8)/busWidth + 18;
+	uint64_t ns = (clock == 0) ? 0 : (clocks * 1000000000u)/clock;
+	if (throttled && timing.cardBytesPerSecond != 0)
+	{
+		const uint64_t cardNs = ((uint64_t)length * 1000000000u)/timing.cardBytesPerSecond;
+		if (cardNs > ns)
+		{
+			ns = cardNs;
+		}
+	}
+	return ns;
+}
+
+// Return the R1 card status
+uint32_t SdCardModel::Status() const
+{
+	const uint32_t state = (transfer == Transfer::writeBlocks) ? CardStateRcv
+							: (transfer == Transfer::none) ? CardStateTran
+								: CardStateData;
+	return state | ((transfer == Transfer::none) ? CARD_STATUS_READY_FOR_DATA : 0) | ((appCommand) ? CARD_STATUS_APP_CMD : 0);
+}
+
+// Execute a command that has no data phase, or CMD12
+bool SdCardModel::Command(uint32_t cmd, uint32_t arg)
+{
+	++counters.commands;
+	WaitUs(timing.commandUs);
+	const uint32_t index = SDMMC_CMD_GET_INDEX(cmd);
+	const bool app = appCommand;
+	appCommand = false;
+
+	if (transfer != Transfer::none && index != 12 && index != 13)
+	{
+		++counters.protocolErrors;							// only CMD12 and CMD13 are allowed while a transfer is open
+		return false;
+	}
+
+	switch (index)
+	{
+	case 0:
+		Reset();
+		return true;
+
+	case 2:													// CID, which is not used
+		response = 0;
+		return true;
+
+	case 3:
+		rca = CardRca;
+		response = (uint32_t)rca << 16;
+		return true;
+
+	case 6:
+		if (app)											// ACMD6, set bus width
+		{
+			response = Status() | CARD_STATUS_APP_CMD;
+			return true;
+		}
+		break;
+
+	case 8:
+		if (!app)
+		{
+			response = arg & (SD_CMD8_MASK_PATTERN | SD_CMD8_MASK_VOLTAGE);
+			return true;
+		}
+		break;
+
+	case 7:
+	case 9:													// CSD, read by get_response_128
+	case 13:
+	case 16:
+		response = Status();
+		return true;
+
+	case 12:
+		if (transfer == Transfer::none)
+		{
+			++counters.protocolErrors;
+		}
+		else
+		{
+			++counters.stopCommands;
+			if (transfer == Transfer::writeBlocks)
+			{
+				WaitUs(timing.writeCommitUs);
+			}
+			transfer = Transfer::none;
+		}
+		response = Status();
+		return true;
+
+	case 23:
+		if (app)											// ACMD23, set the number of blocks to pre-erase
+		{
+			preErase = arg & 0x7FFFFF;
+			response = Status() | CARD_STATUS_APP_CMD;
+			return true;
+		}
+		break;
+
+	case 41:
+		if (app)
+		{
+			response = OCR_POWER_UP_BUSY | OCR_CCS | OCR_VDD_27_28 | OCR_VDD_28_29 | OCR_VDD_29_30 | OCR_VDD_30_31 | OCR_VDD_31_32 | OCR_VDD_32_33
+						| OCR_VDD_33_34 | OCR_VDD_34_35 | OCR_VDD_35_36;
+			return true;
+		}
+		break;
+
+	case 55:
+		appCommand = true;
+		response = Status();
+		return true;
+
+	default:
+		break;
+	}
+
+	++counters.protocolErrors;
+	return false;
+}
+
+// Execute a command that has a data phase
+bool SdCardModel::StartTransfer(uint32_t cmd, uint32_t arg, uint16_t blockSize, uint16_t nbBlock)
+{
+	++counters.commands;
+	WaitUs(timing.commandUs);
+	const uint32_t index = SDMMC_CMD_GET_INDEX(cmd);
+	const bool app = appCommand;
+	appCommand = false;
+
+	if (transfer != Transfer::none || nbBlock == 0)
+	{
+		++counters.protocolErrors;
+		return false;
+	}
+
+	memset(readData, 0, sizeof(readData));
+	switch (index)
+	{
+	case 6:
+		if (!app && blockSize == SD_SW_STATUS_BSIZE)		// CMD6, switch function
+		{
+			const uint32_t group1 = arg & 0x0F;
+			const bool supported = (group1 == SD_CMD6_GRP1_DEFAULT) || (group1 == SD_CMD6_GRP1_HIGH_SPEED && timing.highSpeedCapable);
+			StuffBits(readData, SD_SW_STATUS_BIT_SIZE, 496, 16, 100);									// maximum current
+			StuffBits(readData, SD_SW_STATUS_BIT_SIZE, 400, 16, (timing.highSpeedCapable) ? 0x8003 : 0x8001);	// group 1 functions supported
+			StuffBits(readData, SD_SW_STATUS_BIT_SIZE, 376, 4, (supported) ? group1 : SD_SW_STATUS_FUN_GRP_RC_ERROR);
+			StuffBits(readData, SD_SW_STATUS_BIT_SIZE, 368, 8, 1);										// data structure version
+			if (supported && (arg & SD_CMD6_MODE_SWITCH) != 0)
+			{
+				highSpeed = (group1 == SD_CMD6_GRP1_HIGH_SPEED);
+			}
+			response = Status();
+			SetReadData(SD_SW_STATUS_BSIZE);
+			return true;
+		}
+		break;
+
+	case 13:
+		if (app && blockSize == SD_STATUS_BSIZE)			// ACMD13, SD status
+		{
+			StuffBits(readData, 512, 510, 2, 2);			// 4-bit bus
+			StuffBits(readData, 512, 440, 8, 4);			// speed class 10
+			StuffBits(readData, 512, 428, 4, 9);			// allocation unit 4MB
+			StuffBits(readData, 512, 408, 16, 0x100);		// erase size
+			response = Status() | CARD_STATUS_APP_CMD;
+			SetReadData(SD_STATUS_BSIZE);
+			return true;
+		}
+		break;
+
+	case 51:
+		if (app && blockSize == SD_SCR_REG_BSIZE)			// ACMD51, SCR
+		{
+			StuffBits(readData, SD_SCR_REG_BIT_SIZE, 56, 4, SD_SCR_SD_SPEC_2_00);
+			StuffBits(readData, SD_SCR_REG_BIT_SIZE, 48, 4, 0x5);			// 1 and 4-bit bus widths
+			StuffBits(readData, SD_SCR_REG_BIT_SIZE, 47, 1, SD_SCR_SD_SPEC_3_00);
+			response = Status() | CARD_STATUS_APP_CMD;
+			SetReadData(SD_SCR_REG_BSIZE);
+			return true;
+		}
+		break;
+
+	case 17:
+	case 18:
+	case 24:
+	case 25:
+		if (!app && blockSize == SD_MMC_BLOCK_SIZE)
+		{
+			const bool write = (index >= 24);
+			++((write) ? counters.writeCommands : counters.readCommands);
+			if (arg >= numBlocks)
+			{
+				response = Status() | CARD_STATUS_ADDR_OUT_OF_RANGE;
+				return true;
+			}
+			if (nbBlock > numBlocks - arg)
+			{
+				// The host would clock the card beyond its last block, which a real card reports as out of range part way through
+				++counters.protocolErrors;
+				response = Status() | CARD_STATUS_ADDR_OUT_OF_RANGE;
+				return true;
+			}
+			response = Status();
+			multiBlock = (index == 18 || index == 25);
+			nextBlock = arg;
+			blocksLeft = nbBlock;
+			if (write)
+			{
+				transfer = Transfer::writeBlocks;
+				preErasedLeft = (multiBlock) ? preErase : 0;
+			}
+			else
+			{
+				transfer = Transfer::readBlocks;
+				WaitUs(timing.readAccessUs);
+			}
+			preErase = 0;
+			return true;
+		}
+		break;
+
+	default:
+		break;
+	}
+
+	++counters.protocolErrors;
+	return false;
+}
+
+void SdCardModel::SetReadData(size_t length)
+{
+	transfer = Transfer::readData;
+	dataLength = (uint16_t)length;
+	multiBlock = false;
+	blocksLeft = 1;
+}
+
+bool SdCardModel::ReadBlocks(uint8_t *dest, uint16_t nbBlock)
+{
+	if (clock > ((highSpeed) ? HighSpeedMaxClock : DefaultSpeedMaxClock) || nbBlock > blocksLeft)
+	{
+		++counters.protocolErrors;							// the data would be garbled or never arrive
+		return false;
+	}
+
+	if (transfer == Transfer::readData)
+	{
+		memcpy(dest, readData, dataLength);
+		pendingNs += TransferNs(dataLength, false);
+		transfer = Transfer::none;
+		return true;
+	}
+
+	if (transfer != Transfer::readBlocks || nextBlock + nbBlock > numBlocks)
+	{
+		++counters.protocolErrors;
+		return false;
+	}
+	for (uint16_t i = 0; i < nbBlock; ++i)
+	{
+		ReadStored(nextBlock++, dest);
+		dest += SD_MMC_BLOCK_SIZE;
+		pendingNs += TransferNs(SD_MMC_BLOCK_SIZE, true);
+	}
+	counters.blocksRead += nbBlock;
+	blocksLeft -= nbBlock;
+	if (!multiBlock && blocksLeft == 0)
+	{
+		transfer = Transfer::none;
+	}
+	return true;
+}
+
+bool SdCardModel::WriteBlocks(const uint8_t *src, uint16_t nbBlock)
+{
+	if (clock > ((highSpeed) ? HighSpeedMaxClock : DefaultSpeedMaxClock) || nbBlock > blocksLeft
+		|| transfer != Transfer::writeBlocks || nextBlock + nbBlock > numBlocks)
+	{
+		++counters.protocolErrors;
+		return false;
+	}
+
+	for (uint16_t i = 0; i < nbBlock; ++i)
+	{
+		WriteStored(nextBlock++, src);
+		src += SD_MMC_BLOCK_SIZE;
+		pendingNs += TransferNs(SD_MMC_BLOCK_SIZE, true) + (uint64_t)timing.programUs * 1000;
+		if (preErasedLeft != 0)
+		{
+			--preErasedLeft;
+			++counters.preErasedBlocks;
+		}
+		else
+		{
+			pendingNs += (uint64_t)timing.eraseUs * 1000;
+		}
+	}
+	counters.blocksWritten += nbBlock;
+	blocksLeft -= nbBlock;
+	if (!multiBlock && blocksLeft == 0)
+	{
+		pendingNs += (uint64_t)timing.writeCommitUs * 1000;
+		transfer = Transfer::none;
+	}
+	return true;
+}
+
+// DriverInterface functions
+
+void SdCardModel::SelectDevice(uint8_t slot, uint32_t clk, uint8_t bus_width, bool high_speed)
+{
+	(void)high_speed;
+	selected = (slot < 2) ? slots[slot] : nullptr;
+	if (selected != nullptr)
+	{
+		selected->clock = clk;
+		selected->busWidth = (bus_width == 0) ? 1 : bus_width;
+	}
+}
+
+void SdCardModel::DeselectDevice(uint8_t slot)
+{
+	(void)slot;
+}
+
+uint8_t SdCardModel::GetSlotBusWidth(uint8_t slot)
+{
+	(void)slot;
+	return 4;
+}
+
+bool SdCardModel::IsHighSpeedCapable()
+{
+	return true;
+}
+
+void SdCardModel::SendClock()
+{
+}
+
+bool SdCardModel::SendCmd(sdmmc_cmd_def_t cmd, uint32_t arg)
+{
+	return selected != nullptr && selected->Command(cmd, arg);			// with no card there is no response
+}
+
+uint32_t SdCardModel::GetResponse()
+{
+	return (selected != nullptr) ? selected->response : 0xFFFFFFFF;
+}
+
+void SdCardModel::GetResponse128(uint8_t *response)
+{
+	if (selected != nullptr)
+	{
+		memcpy(response, selected->csd, CSD_REG_BSIZE);
+	}
+}
+
+bool SdCardModel::AdtcStart(sdmmc_cmd_def_t cmd, uint32_t arg, uint16_t block_size, uint16_t nb_block, bool access_block)
+{
+	(void)access_block;
+	return selected != nullptr && selected->StartTransfer(cmd, arg, block_size, nb_block);
+}
+
+bool SdCardModel::ReadWord(uint32_t *value)
+{
+	(void)value;
+	return false;
+}
+
+bool SdCardModel::WriteWord(uint32_t value)
+{
+	(void)value;
+	return false;
+}
+
+bool SdCardModel::StartReadBlocks(void *dest, uint16_t nb_block)
+{
+	return selected != nullptr && selected->ReadBlocks(static_cast<uint8_t *>(dest), nb_block);
+}
+
+bool SdCardModel::WaitEndOfReadBlocks()
+{
+	if (selected == nullptr)
+	{
+		return false;
+	}
+	selected->Wait(selected->pendingNs);
+	selected->pendingNs = 0;
+	if (selected->failNextDataPhase)
+	{
+		selected->failNextDataPhase = false;
+		return false;
+	}
+	return true;
+}
+
+bool SdCardModel::StartWriteBlocks(const void *src, uint16_t nb_block)
+{
+	return selected != nullptr && selected->WriteBlocks(static_cast<const uint8_t *>(src), nb_block);
+}
+
+bool SdCardModel::WaitEndOfWriteBlocks()
+{
+	return WaitEndOfReadBlocks();
+}
+
+// Return the speed of a 4-bit bus in bytes/sec, as the HSMCI driver does
+uint32_t SdCardModel::GetInterfaceSpeed()
+{
+	return (selected != nullptr) ? selected->clock/2 : 0;
+}
+
+driverIdleFunc_t SdCardModel::SetIdleFunc(driverIdleFunc_t func)
+{
+	const driverIdleFunc_t old = idleFunc;
+	idleFunc = func;
+	return old;
+}
+
+// End
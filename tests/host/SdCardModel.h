@@ -0,0 +1,143 @@
+/*
+ * SdCardModel.h
+ *
+ * A software model of an SDHC card, plugged in underneath sd_mmc.c through its DriverInterface so that the storage library can be run and
+ * benchmarked on a host. The card answers the commands that sd_mmc.c sends when it initialises a card on a 4-bit bus and reads and writes
+ * blocks, and it stores its blocks in memory or in a file.
+ *
+ * Time is simulated. Each command and data transfer moves the clock in Core.h on by the time the card would take, so DWT->CYCCNT, millis()
+ * and the latency statistics in sd_mmc.c all see card time, not host time. The time to move a block across the bus follows from the clock and
+ * bus width that sd_mmc.c negotiates, and is limited by the card's own throughput.
+ */
+
+#ifndef SDCARDMODEL_H_
+#define SDCARDMODEL_H_
+
+#include "sd_mmc.h"
+#include "sd_mmc_protocol.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Timing of the simulated card. The defaults are typical of a class 10 card.
+struct SdCardTiming
+{
+	uint32_t commandUs = 5;						// to send a command and receive the response
+	uint32_t readAccessUs = 250;				// from a read command to the start of the first data block
+	uint32_t programUs = 20;					// busy after each block written
+	uint32_t eraseUs = 100;						// extra busy for each block written that ACMD23 did not pre-erase
+	uint32_t writeCommitUs = 1000;				// busy at the end of each write command, after the last block or CMD12
+	uint32_t cardBytesPerSecond = 20000000;		// the most the card can read or write, however fast the bus
+	bool highSpeedCapable = true;				// the card accepts CMD6 switching it to 50MHz
+};
+
+// What the card has been asked to do
+struct SdCardCounters
+{
+	uint32_t commands;							// all commands, including those that carry data
+	uint32_t readCommands;						// CMD17 and CMD18
+	uint32_t writeCommands;						// CMD24 and CMD25
+	uint32_t stopCommands;						// CMD12
+	uint32_t blocksRead;
+	uint32_t blocksWritten;
+	uint32_t preErasedBlocks;					// blocks written that ACMD23 had pre-erased
+	uint32_t protocolErrors;					// commands that the card would reject in its current state
+};
+
+class SdCardModel
+{
+public:
+	// Create a card holding numBlocks blocks in memory, rounded down to a multiple of 1024 (512KB, the capacity unit of an SDHC CSD).
+	// The blocks start filled with 0xFF.
+	explicit SdCardModel(uint32_t numBlocks, const SdCardTiming& t = SdCardTiming());
+	~SdCardModel();
+	SdCardModel(const SdCardModel&) = delete;
+
+	// Keep the blocks in a file instead of in memory. The file is created if necessary and extended to the size of the card, and any
+	// existing contents are kept. Returns false if it can't be opened.
+	bool UseFile(const std::string& path);
+
+	// Plug the card into a driver slot of the model's DriverInterface, or remove it if card is null
+	static void Insert(uint8_t driverSlot, SdCardModel *card);
+
+	// The DriverInterface to give to sd_mmc_set_driver_interface()
+	static const struct DriverInterface Interface;
+
+	uint32_t GetNumBlocks() const { return numBlocks; }
+	uint32_t GetClock() const { return clock; }
+	uint8_t GetBusWidth() const { return busWidth; }
+	SdCardTiming timing;
+	SdCardCounters counters;
+	bool failNextDataPhase = false;				// make the next wait for the end of a data phase fail, as after a CRC error, leaving the command open
+
+	// Access the stored blocks directly, without taking any simulated time
+	void ReadStored(uint32_t block, void *dest) const;
+	void WriteStored(uint32_t block, const void *src);
+
+private:
+	enum class Transfer { none, readData, readBlocks, writeBlocks };
+
+	// The DriverInterface functions, which act on the card in the slot that was last selected
+	static void SelectDevice(uint8_t slot, uint32_t clock, uint8_t bus_width, bool high_speed);
+	static void DeselectDevice(uint8_t slot);
+	static uint8_t GetSlotBusWidth(uint8_t slot);
+	static bool IsHighSpeedCapable();
+	static void SendClock();
+	static bool SendCmd(sdmmc_cmd_def_t cmd, uint32_t arg);
+	static uint32_t GetResponse();
+	static void GetResponse128(uint8_t *response);
+	static bool AdtcStart(sdmmc_cmd_def_t cmd, uint32_t arg, uint16_t block_size, uint16_t nb_block, bool access_block);
+	static bool ReadWord(uint32_t *value);
+	static bool WriteWord(uint32_t value);
+	static bool StartReadBlocks(void *dest, uint16_t nb_block);
+	static bool WaitEndOfReadBlocks();
+	static bool StartWriteBlocks(const void *src, uint16_t nb_block);
+	static bool WaitEndOfWriteBlocks();
+	static uint32_t GetInterfaceSpeed();
+	static driverIdleFunc_t SetIdleFunc(driverIdleFunc_t func);
+
+	static SdCardModel *slots[2];
+	static SdCardModel *selected;
+	static driverIdleFunc_t idleFunc;
+
+	void Reset();
+	bool Command(uint32_t cmd, uint32_t arg);
+	bool StartTransfer(uint32_t cmd, uint32_t arg, uint16_t blockSize, uint16_t nbBlock);
+	bool ReadBlocks(uint8_t *dest, uint16_t nbBlock);
+	bool WriteBlocks(const uint8_t *src, uint16_t nbBlock);
+	void SetReadData(size_t length);
+	void Wait(uint64_t nanos);
+	void WaitUs(uint32_t micros) { Wait((uint64_t)micros * 1000); }
+	uint64_t TransferNs(size_t length, bool throttled) const;
+	uint32_t Status() const;
+	void MakeCsd();
+
+	uint32_t numBlocks;
+	std::vector<uint8_t> memory;
+	int fd;
+
+	// Bus configuration from select_device
+	uint32_t clock;
+	uint8_t busWidth;
+	uint64_t waitRemainderNs;					// part of a microsecond not yet added to the clock
+	uint64_t pendingNs;							// time taken by the data phase started by start_read_blocks or start_write_blocks
+
+	// Card state
+	bool appCommand;							// the previous command was CMD55
+	bool highSpeed;
+	uint16_t rca;
+	uint32_t response;
+	uint8_t csd[CSD_REG_BSIZE];
+	uint32_t preErase;							// number of blocks set by ACMD23 for the next write command
+
+	// The transfer in progress
+	Transfer transfer;
+	bool multiBlock;
+	uint16_t dataLength;						// size of the data block of CMD6, ACMD13 or ACMD51
+	uint32_t nextBlock;
+	uint32_t blocksLeft;						// blocks of the data phase started by adtc_start still to transfer
+	uint32_t preErasedLeft;
+	uint8_t readData[SD_SW_STATUS_BSIZE];		// the data block of CMD6, ACMD13 or ACMD51
+};
+
+#endif /* SDCARDMODEL_H_ */
@@ -0,0 +1,204 @@
+/*
+ * SharedSpiQueueTest.cpp
+ *
+ * Drives SharedSpiQueue with a scripted fake bus. Each transfer the queue starts takes the next step of the script,
+ * which says how long the device takes to answer and what it answers with, or that it never answers.
+ */
+
+#include "SharedSpiQueue.h"
+#include "HostTest.h"
+#include <cstring>
+#include <string>
+#include <vector>
+
+struct ScriptStep
+{
+	uint32_t duration;						// time from the start of the transfer to the end, or 0 if the transfer hangs
+	uint8_t fill;							// the byte the device sends back
+};
+
+class FakeBus
+{
+public:
+	static void StartTransfer(struct sspi_transaction *t)
+	{
+		CHECK(selected == nullptr);			// only one device may be selected at a time
+		selected = t;
+		step = (nextStep < script.size()) ? script[nextStep++] : ScriptStep{ 1, 0 };
+		startTime = now;
+		log += 'S';
+		log += (char)('0' + DeviceNumber(t));
+	}
+
+	static void StopTransfer(struct sspi_transaction *t, bool ok)
+	{
+		CHECK(selected == t);
+		selected = nullptr;
+		log += (ok) ? 'E' : 'X';
+	}
+
+	static uint32_t GetTime() { return now; }
+	static uint32_t GetTimeout(const struct sspi_transaction *t) { return 100 + t->len; }
+
+	static int DeviceNumber(const struct sspi_transaction *t) { return (int)(t->device - devices); }
+
+	static struct sspi_device devices[3];
+	static std::vector<ScriptStep> script;
+	static size_t nextStep;
+	static struct sspi_transaction *selected;
+	static ScriptStep step;
+	static uint32_t startTime;
+	static uint32_t now;
+	static std::string log;
+};
+
+struct sspi_device FakeBus::devices[3];
+std::vector<ScriptStep> FakeBus::script;
+size_t FakeBus::nextStep = 0;
+struct sspi_transaction *FakeBus::selected = nullptr;
+ScriptStep FakeBus::step;
+uint32_t FakeBus::startTime = 0;
+uint32_t FakeBus::now = 0;
+std::string FakeBus::log;
+
+static SharedSpiQueue<FakeBus> *queue = nullptr;
+
+// Run the bus for a number of time units, completing transfers as the script says and polling for time-outs
+static void RunFor(uint32_t time)
+{
+	for (uint32_t i = 0; i < time; ++i)
+	{
+		++FakeBus::now;
+		struct sspi_transaction * const t = FakeBus::selected;
+		if (t != nullptr && FakeBus::step.duration != 0 && FakeBus::now - FakeBus::startTime >= FakeBus::step.duration)
+		{
+			if (t->rx_data != nullptr)
+			{
+				memset(t->rx_data, FakeBus::step.fill, t->len);
+			}
+			queue->TransferDone(SPI_OK);
+		}
+		(void)queue->CheckTimeout();
+	}
+}
+
+static void Reset(std::vector<ScriptStep> script, uint32_t startTime)
+{
+	delete queue;
+	queue = new SharedSpiQueue<FakeBus>;
+	FakeBus::script = script;
+	FakeBus::nextStep = 0;
+	FakeBus::selected = nullptr;
+	FakeBus::now = startTime;
+	FakeBus::log.clear();
+}
+
+static std::string completions;
+
+static void RecordCompletion(struct sspi_transaction *t)
+{
+	completions += (char)('0' + FakeBus::DeviceNumber(t));
+	completions += (t->status == SPI_OK) ? '+' : '-';
+}
+
+static void InitTransaction(struct sspi_transaction& t, int device, uint8_t *rx, size_t len)
+{
+	t.device = &FakeBus::devices[device];
+	t.tx_data = nullptr;
+	t.rx_data = rx;
+	t.len = len;
+	t.callback = RecordCompletion;
+	t.param = nullptr;
+}
+
+// Transactions run in order, each starting as soon as the previous one has ended
+static void TestOrderAndChaining()
+{
+	Reset({ { 5, 0x11 }, { 3, 0x22 }, { 7, 0x33 } }, 0);
+	completions.clear();
+	uint8_t rx[3][4];
+	struct sspi_transaction t[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		InitTransaction(t[i], i, rx[i], sizeof(rx[i]));
+		queue->Add(&t[i]);
+	}
+	CHECK(queue->IsBusy());
+	CHECK_EQUAL(SPI_BUSY, t[0].status);
+	CHECK_EQUAL(SPI_BUSY, t[2].status);
+	CHECK(FakeBus::log == "S0");
+
+	RunFor(20);
+	CHECK(FakeBus::log == "S0ES1ES2E");
+	CHECK(completions == "0+1+2+");
+	CHECK(!queue->IsBusy());
+	CHECK_EQUAL(0x22, rx[1][3]);
+	CHECK_EQUAL(0x33, rx[2][0]);
+}
+
+// Empty transactions complete without using the bus, and a callback may queue another transaction
+static void TestEmptyAndCallbackQueueing()
+{
+	Reset({ { 2, 0 }, { 2, 0 } }, 0);
+	completions.clear();
+	struct sspi_transaction empty, first, chained;
+	InitTransaction(empty, 0, nullptr, 0);
+	InitTransaction(first, 1, nullptr, 10);
+	InitTransaction(chained, 2, nullptr, 10);
+	first.param = &chained;
+	first.callback = [](struct sspi_transaction *t)
+						{
+							RecordCompletion(t);
+							queue->Add(static_cast<struct sspi_transaction *>(t->param));
+						};
+
+	queue->Add(&empty);
+	CHECK_EQUAL(SPI_OK, empty.status);
+	CHECK(!queue->IsBusy());
+	CHECK(FakeBus::log.empty());
+
+	queue->Add(&first);
+	RunFor(2);
+	CHECK(FakeBus::log == "S1ES2");						// the chained transaction started from the completion of the first
+	RunFor(2);
+	CHECK(completions == "0+1+2+");
+	CHECK(!queue->IsBusy());
+}
+
+// A transfer that hangs times out and the queue moves on
+static void TestTimeout()
+{
+	Reset({ { 0, 0 }, { 4, 0x55 } }, 0xFFFFFFF0);		// the clock wraps round during the test
+	completions.clear();
+	uint8_t rx[2];
+	struct sspi_transaction hung, next;
+	InitTransaction(hung, 0, rx, 1);
+	InitTransaction(next, 1, rx, 2);
+	queue->Add(&hung);
+	queue->Add(&next);
+
+	RunFor(100);
+	CHECK(!queue->CheckTimeout());
+	CHECK_EQUAL(SPI_BUSY, hung.status);
+	RunFor(1);											// the time-out is 101
+	CHECK_EQUAL(SPI_ERROR_TIMEOUT, hung.status);
+	CHECK(FakeBus::log == "S0XS1");
+	RunFor(4);
+	CHECK_EQUAL(SPI_OK, next.status);
+	CHECK_EQUAL(0x55, rx[1]);
+	CHECK(completions == "0-1+");
+
+	// A late completion from the bus after the time-out is ignored
+	queue->TransferDone(SPI_OK);
+	CHECK(FakeBus::log == "S0XS1E");
+}
+
+int main()
+{
+	TestOrderAndChaining();
+	TestEmptyAndCallbackQueueing();
+	TestTimeout();
+	return TestResult("SharedSpiQueueTest");
+}
+
+// End
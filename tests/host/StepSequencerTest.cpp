@@ -0,0 +1,228 @@
+/*
+ * StepSequencerTest.cpp
+ *
+ * Drives StepSequencer with a simulated TC channel in waveform mode with WAVSEL_UP_RC, the way StepPulseGenerator drives the real one,
+ * and checks the times of the step pulses that come out.
+ */
+
+#include "StepSequencer.h"
+#include "HostTest.h"
+#include <vector>
+
+// One TC channel in waveform mode. RC compare sets TIOA if ACPC is 'set', RA compare clears it, and CPCDIS stops the clock at RC compare.
+// A software trigger resets the counter at the next clock edge. The counter returns to 0 on the edge after it reaches RC.
+class SimulatedTc
+{
+public:
+	uint32_t rc = 0;
+	uint32_t ra = 0;
+	bool acpcSet = true;
+	bool cpcdis = false;
+	bool clockEnabled = false;
+	bool tioa = false;
+	std::vector<uint64_t> risingEdges;
+	std::vector<uint64_t> fallingEdges;
+
+	void SoftwareTrigger() { clockEnabled = true; triggerPending = true; tioa = false; }
+
+	// Process one clock edge at time 'now'. Returns true if there was an RC compare.
+	bool Tick(uint64_t now)
+	{
+		if (!clockEnabled)
+		{
+			return false;
+		}
+		if (triggerPending)
+		{
+			counter = 0;
+			triggerPending = false;
+		}
+		else
+		{
+			counter = (counter == rc) ? 0 : counter + 1;
+		}
+
+		if (counter == ra && tioa)
+		{
+			tioa = false;
+			fallingEdges.push_back(now);
+		}
+		if (counter == rc)
+		{
+			if (acpcSet && !tioa)
+			{
+				tioa = true;
+				risingEdges.push_back(now);
+			}
+			if (cpcdis)
+			{
+				clockEnabled = false;
+			}
+			return true;
+		}
+		return false;
+	}
+
+private:
+	uint32_t counter = 0;
+	bool triggerPending = false;
+};
+
+// Run a sequence. The interrupt handler runs 'latency' ticks after each RC compare. 'refill' is called after each interrupt
+// so that a test can add intervals while the sequence runs. Returns the time at which the sequencer became idle.
+template<class F> static uint64_t Run(StepSequencer& seq, SimulatedTc& tc, uint32_t minFirst, uint32_t latency, F refill)
+{
+	uint32_t rc;
+	CHECK(seq.Begin(minFirst, rc));
+	tc.rc = rc;
+	tc.acpcSet = true;
+	tc.cpcdis = false;
+	tc.SoftwareTrigger();
+
+	std::vector<uint64_t> pendingInterrupts;
+	for (uint64_t now = 1; now < 10000000; ++now)
+	{
+		if (tc.Tick(now))
+		{
+			pendingInterrupts.push_back(now + latency);
+		}
+		while (!pendingInterrupts.empty() && pendingInterrupts.front() <= now)
+		{
+			pendingInterrupts.erase(pendingInterrupts.begin());
+			switch (seq.OnCompare(rc))
+			{
+			case StepSequencer::Action::reload:
+				tc.rc = rc;
+				break;
+
+			case StepSequencer::Action::finish:
+				tc.acpcSet = false;
+				tc.cpcdis = true;
+				break;
+
+			case StepSequencer::Action::stopped:
+				CHECK(!tc.clockEnabled);
+				tc.acpcSet = true;
+				tc.cpcdis = false;
+				return now;
+			}
+			refill(seq);
+		}
+	}
+	CHECK(false);					// it never stopped
+	return 0;
+}
+
+static void NoRefill(StepSequencer&) { }
+
+// Check that the pulses start at the given times and each lasts 'width' ticks
+static void CheckPulses(const SimulatedTc& tc, const std::vector<uint64_t>& expected, uint32_t width)
+{
+	CHECK_EQUAL(expected.size(), tc.risingEdges.size());
+	CHECK_EQUAL(expected.size(), tc.fallingEdges.size());
+	for (size_t i = 0; i < expected.size() && i < tc.risingEdges.size(); ++i)
+	{
+		CHECK_EQUAL(expected[i], tc.risingEdges[i]);
+		if (i < tc.fallingEdges.size())
+		{
+			CHECK_EQUAL(width, tc.fallingEdges[i] - tc.risingEdges[i]);
+		}
+	}
+}
+
+static void TestIntervals()
+{
+	StepSequencer seq;
+	seq.SetLimits(20, 0xFFFF);
+	SimulatedTc tc;
+	tc.ra = 5 - 1;							// 5 tick pulses
+	for (uint32_t interval : { 100, 50, 200, 75 })
+	{
+		CHECK(seq.AddInterval(interval));
+	}
+	const uint64_t stopTime = Run(seq, tc, 10, 3, NoRefill);
+	CheckPulses(tc, { 100, 150, 350, 425 }, 5);
+	CHECK_EQUAL(4, seq.GetStepsDone());
+	CHECK(!seq.IsRunning());
+	CHECK_EQUAL(425 + 75 + 3, stopTime);	// the clock stops at the end of the last interval
+}
+
+static void TestLimits()
+{
+	StepSequencer seq;
+	seq.SetLimits(20, 0xFFFF);
+	SimulatedTc tc;
+	tc.ra = 0;
+	CHECK(seq.AddInterval(5));
+	CHECK(seq.AddInterval(70000));
+	CHECK(seq.AddInterval(1));
+	Run(seq, tc, 0, 1, NoRefill);
+	CheckPulses(tc, { 20, 20 + 0xFFFF, 20 + 0xFFFF + 20 }, 1);
+	CHECK_EQUAL(0xFFFF - 1, seq.IntervalToRc(0xFFFFFFFF));		// fits a 16-bit RC
+}
+
+static void TestDirectionSetup()
+{
+	StepSequencer seq;
+	seq.SetLimits(20, 0xFFFF);
+	SimulatedTc tc;
+	tc.ra = 1;
+	CHECK(seq.AddInterval(25));
+	CHECK(seq.AddInterval(40));
+	Run(seq, tc, 60, 2, NoRefill);
+	CheckPulses(tc, { 60, 100 }, 2);
+}
+
+static void TestRefillWhileRunning()
+{
+	StepSequencer seq;
+	seq.SetLimits(20, 0xFFFF);
+	SimulatedTc tc;
+	tc.ra = 2;
+	CHECK(seq.AddInterval(30));
+	CHECK(seq.AddInterval(30));								// the producer stays one interval ahead of the interrupt
+	unsigned int added = 0;
+	Run(seq, tc, 0, 5, [&added](StepSequencer& s) { if (added < 199) { s.AddInterval(30 + added % 7); ++added; } });
+	CHECK_EQUAL(201, tc.risingEdges.size());
+	CHECK_EQUAL(201, seq.GetStepsDone());
+	uint64_t expected = 60;
+	for (size_t i = 0; i < tc.risingEdges.size(); ++i)
+	{
+		CHECK_EQUAL((i == 0) ? 30 : expected, tc.risingEdges[i]);
+		if (i != 0)
+		{
+			expected += 30 + (i - 1) % 7;
+		}
+	}
+}
+
+static void TestStartAndQueue()
+{
+	StepSequencer seq;
+	uint32_t rc;
+	CHECK(!seq.Begin(0, rc));								// nothing queued
+	for (size_t i = 0; i < StepIntervalQueue::Size - 1; ++i)
+	{
+		CHECK(seq.AddInterval(100));
+	}
+	CHECK(!seq.AddInterval(100));							// full
+	CHECK_EQUAL(0, seq.GetSpace());
+	CHECK(seq.Begin(0, rc));
+	CHECK(!seq.Begin(0, rc));								// already running
+	CHECK_EQUAL(1, seq.GetSpace());
+	seq.Reset();
+	CHECK(!seq.IsRunning());
+	CHECK_EQUAL(StepIntervalQueue::Size - 1, seq.GetSpace());
+}
+
+int main()
+{
+	TestIntervals();
+	TestLimits();
+	TestDirectionSetup();
+	TestRefillWhileRunning();
+	TestStartAndQueue();
+	return TestResult("StepSequencerTest");
+}
+
+// End
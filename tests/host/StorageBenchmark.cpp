@@ -0,0 +1,239 @@
+/*
+ * StorageBenchmark.cpp
+ *
+ * Measures sequential and random read and write throughput through memory_2_ram() and ram_2_memory() on the simulated SD card, and the
+ * latency percentiles of the individual calls. All times are simulated, so the results depend only on the card timing and the storage
+ * library. Every read is checked against a copy of what was written, so the program fails if the library loses or corrupts data.
+ *
+ * Usage: StorageBenchmark [--file image] [--size megabytes]
+ * With --file the card's blocks are kept in the given file, which is created if necessary, instead of in memory.
+ */
+
+#include "SdCardModel.h"
+#include "HostTest.h"
+#include "Core.h"
+#include "ctrl_access.h"
+#include "conf_sd_mmc.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+// The defaults in sd_mmc_mem.c, for the report
+#ifndef SD_MMC_READ_AHEAD_BLOCKS
+# define SD_MMC_READ_AHEAD_BLOCKS	(0)
+#endif
+#ifndef SD_MMC_WRITE_CACHE_BLOCKS
+# define SD_MMC_WRITE_CACHE_BLOCKS	(0)
+#endif
+
+static const Pin wpPins[SD_MMC_MEM_CNT] = { NoPin, NoPin };
+static const Pin spiCsPins[SD_MMC_SPI_MEM_CNT] = { NoPin };
+
+static const uint32_t MaxBlocksPerCall = 64;
+static const uint32_t SequentialBytes = 4 * 1024 * 1024;
+static const uint32_t RandomCalls = 2000;
+
+static SdCardModel *card;
+static std::vector<uint8_t> shadow;						// what the card should hold
+static uint8_t buffer[MaxBlocksPerCall * SD_MMC_BLOCK_SIZE];
+static std::mt19937 rng(12345);
+
+enum class Pattern { sequential, random };
+
+struct Workload
+{
+	const char *name;
+	Pattern pattern;
+	bool write;
+	uint32_t blocksPerCall;
+};
+
+static const Workload workloads[] =
+{
+	{ "sequential write", Pattern::sequential, true, 1 },
+	{ "sequential write", Pattern::sequential, true, 8 },
+	{ "sequential write", Pattern::sequential, true, 64 },
+	{ "sequential read", Pattern::sequential, false, 1 },
+	{ "sequential read", Pattern::sequential, false, 8 },
+	{ "sequential read", Pattern::sequential, false, 64 },
+	{ "random write", Pattern::random, true, 1 },
+	{ "random write", Pattern::random, true, 8 },
+	{ "random read", Pattern::random, false, 1 },
+	{ "random read", Pattern::random, false, 8 },
+};
+
+// Return the latency below which the given fraction of the sorted latencies fall
+static uint64_t Percentile(const std::vector<uint64_t>& sorted, double fraction)
+{
+	if (sorted.empty())
+	{
+		return 0;
+	}
+	size_t index = (size_t)(fraction * sorted.size() + 0.999999);
+	return sorted[(index == 0) ? 0 : index - 1];
+}
+
+// Read or write blocks, checking the data read against the shadow copy
+static bool Transfer(bool write, uint32_t block, uint32_t numBlocks)
+{
+	uint8_t * const shadowData = &shadow[(size_t)block * SD_MMC_BLOCK_SIZE];
+	const size_t length = (size_t)numBlocks * SD_MMC_BLOCK_SIZE;
+	if (write)
+	{
+		for (size_t i = 0; i < length; i += 4)
+		{
+			const uint32_t r = rng();
+			memcpy(buffer + i, &r, sizeof(r));
+		}
+		if (ram_2_memory(LUN_ID_SD_MMC_0_MEM, block, buffer, numBlocks) != CTRL_GOOD)
+		{
+			return false;
+		}
+		memcpy(shadowData, buffer, length);
+		return true;
+	}
+
+	memset(buffer, 0, length);
+	return memory_2_ram(LUN_ID_SD_MMC_0_MEM, block, buffer, numBlocks) == CTRL_GOOD && memcmp(buffer, shadowData, length) == 0;
+}
+
+static void Run(const Workload& w)
+{
+	const uint32_t calls = (w.pattern == Pattern::sequential) ? SequentialBytes/(w.blocksPerCall * SD_MMC_BLOCK_SIZE) : RandomCalls;
+	const uint32_t sequentialStart = card->GetNumBlocks()/4;
+	std::uniform_int_distribution<uint32_t> randomBlock(0, card->GetNumBlocks() - w.blocksPerCall);
+	std::vector<uint64_t> latencies;
+	latencies.reserve(calls);
+	const SdCardCounters before = card->counters;
+	sd_mmc_reset_stats();
+
+	const uint64_t start = HostGetMicros();
+	unsigned int failures = 0;
+	for (uint32_t i = 0; i < calls; ++i)
+	{
+		const uint32_t block = (w.pattern == Pattern::sequential) ? sequentialStart + i * w.blocksPerCall : randomBlock(rng);
+		const uint64_t callStart = HostGetMicros();
+		if (!Transfer(w.write, block, w.blocksPerCall))
+		{
+			++failures;
+		}
+		latencies.push_back(HostGetMicros() - callStart);
+	}
+
+	// Written data only counts once it has reached the card
+	if (memory_sync(LUN_ID_SD_MMC_0_MEM, false) != CTRL_GOOD)
+	{
+		++failures;
+	}
+	const uint64_t elapsed = HostGetMicros() - start;
+	CHECK_EQUAL(0, failures);
+
+	std::sort(latencies.begin(), latencies.end());
+	const double bytes = (double)calls * w.blocksPerCall * SD_MMC_BLOCK_SIZE;
+	const uint32_t commands = card->counters.commands - before.commands;
+	std::printf("%-17s %3u %6u %8.2f %8.1f %7llu %7llu %7llu %7llu %8u\n", w.name, (unsigned int)w.blocksPerCall, (unsigned int)calls,
+					(elapsed == 0) ? 0.0 : bytes/elapsed, (elapsed == 0) ? 0.0 : calls * 1.0e6/elapsed,
+					(unsigned long long)Percentile(latencies, 0.5), (unsigned long long)Percentile(latencies, 0.9),
+					(unsigned long long)Percentile(latencies, 0.99), (unsigned long long)latencies.back(), (unsigned int)commands);
+}
+
+// Report the latencies that sd_mmc.c recorded for the last workload
+static void PrintDriverStats()
+{
+	static const char * const opNames[SD_MMC_NUM_OPS] = { "init read", "read data", "init write", "write data", "stop", "busy" };
+	struct sd_mmc_stats stats;
+	sd_mmc_get_stats(&stats);
+	std::printf("sd_mmc latencies for the last workload:\n");
+	for (size_t op = 0; op < SD_MMC_NUM_OPS; ++op)
+	{
+		const struct sd_mmc_latency_stats& ls = stats.ops[op];
+		if (ls.count != 0)
+		{
+			std::printf("  %-10s %7u calls, mean %6lluus, max %6uus\n", opNames[op], (unsigned int)ls.count,
+							(unsigned long long)(ls.total_us/ls.count), (unsigned int)ls.max_us);
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	std::string file;
+	uint32_t megabytes = 32;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--file") == 0 && i + 1 < argc)
+		{
+			file = argv[++i];
+		}
+		else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+		{
+			megabytes = (uint32_t)strtoul(argv[++i], nullptr, 10);
+		}
+		else
+		{
+			std::printf("Usage: %s [--file image] [--size megabytes]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	card = new SdCardModel(megabytes * 2048);
+	if (card->GetNumBlocks() < 4 * SequentialBytes/SD_MMC_BLOCK_SIZE)
+	{
+		std::printf("The card must be at least %u megabytes\n", (unsigned int)(4 * SequentialBytes/(1024 * 1024)));
+		return 2;
+	}
+	if (!file.empty() && !card->UseFile(file))
+	{
+		std::printf("Can't open %s\n", file.c_str());
+		return 2;
+	}
+
+	// Start from the card's existing contents, which are random in a file that has been used before
+	shadow.resize((size_t)card->GetNumBlocks() * SD_MMC_BLOCK_SIZE);
+	for (uint32_t block = 0; block < card->GetNumBlocks(); ++block)
+	{
+		card->ReadStored(block, &shadow[(size_t)block * SD_MMC_BLOCK_SIZE]);
+	}
+
+	sd_mmc_init(wpPins, spiCsPins);
+	sd_mmc_set_driver_interface(0, &SdCardModel::Interface, 0);
+	SdCardModel::Insert(0, card);
+	CHECK_EQUAL(CTRL_GOOD, mem_test_unit_ready(LUN_ID_SD_MMC_0_MEM));
+
+	uint32_t clock;
+	uint8_t busWidth;
+	bool highSpeed;
+	sd_mmc_get_bus_config(0, &clock, &busWidth, &highSpeed);
+	std::printf("%uMB card %s, %u-bit bus at %uMHz, read-ahead %u blocks, write cache %u blocks\n", (unsigned int)(card->GetNumBlocks()/2048),
+					(file.empty()) ? "in memory" : "in a file", (unsigned int)busWidth, (unsigned int)(clock/1000000),
+					(unsigned int)SD_MMC_READ_AHEAD_BLOCKS, (unsigned int)SD_MMC_WRITE_CACHE_BLOCKS);
+	std::printf("%-17s %3s %6s %8s %8s %7s %7s %7s %7s %8s\n", "workload", "blk", "calls", "MB/s", "calls/s", "p50us", "p90us", "p99us", "maxus", "commands");
+	for (const Workload& w : workloads)
+	{
+		Run(w);
+	}
+	PrintDriverStats();
+
+	// The card must hold everything that was written
+	uint8_t stored[SD_MMC_BLOCK_SIZE];
+	unsigned int badBlocks = 0;
+	for (uint32_t block = 0; block < card->GetNumBlocks(); ++block)
+	{
+		card->ReadStored(block, stored);
+		if (memcmp(stored, &shadow[(size_t)block * SD_MMC_BLOCK_SIZE], SD_MMC_BLOCK_SIZE) != 0)
+		{
+			++badBlocks;
+		}
+	}
+	CHECK_EQUAL(0, badBlocks);
+	CHECK_EQUAL(0, card->counters.protocolErrors);
+
+	SdCardModel::Insert(0, nullptr);
+	delete card;
+	return TestResult("StorageBenchmark");
+}
+
+// End
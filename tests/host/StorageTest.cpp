@@ -0,0 +1,296 @@
+/*
+ * StorageTest.cpp
+ *
+ * Runs sd_mmc.c, sd_mmc_mem.c and ctrl_access.c against the simulated SD card.
+ * The card must be initialised at 4-bit high speed, data must reach the card intact through memory_2_ram() and ram_2_memory(),
+ * and single operations must take the time that the card's timing parameters say they should.
+ * StorageTestCached runs the same tests that don't depend on timing with the read-ahead and write-back caches of sd_mmc_mem.c enabled.
+ */
+
+#include "SdCardModel.h"
+#include "HostTest.h"
+#include "Core.h"
+#include "ctrl_access.h"
+#include "conf_sd_mmc.h"
+#include <cstring>
+#include <vector>
+
+#ifndef TEST_NAME
+# define TEST_NAME	"StorageTest"
+#endif
+
+static const Pin wpPins[SD_MMC_MEM_CNT] = { NoPin, NoPin };
+static const Pin spiCsPins[SD_MMC_SPI_MEM_CNT] = { NoPin };
+
+static uint8_t buffer[100 * SD_MMC_BLOCK_SIZE];
+
+// Fill the buffer with data that differs for every block and every pass
+static void Fill(uint32_t firstBlock, uint32_t numBlocks, uint8_t pass)
+{
+	for (uint32_t i = 0; i < numBlocks * SD_MMC_BLOCK_SIZE; ++i)
+	{
+		buffer[i] = (uint8_t)(((firstBlock + i/SD_MMC_BLOCK_SIZE) * 7) ^ i ^ (pass * 0x35));
+	}
+}
+
+// Return true if the buffer holds what Fill() put in it
+static bool Matches(uint32_t firstBlock, uint32_t numBlocks, uint8_t pass)
+{
+	for (uint32_t i = 0; i < numBlocks * SD_MMC_BLOCK_SIZE; ++i)
+	{
+		if (buffer[i] != (uint8_t)(((firstBlock + i/SD_MMC_BLOCK_SIZE) * 7) ^ i ^ (pass * 0x35)))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// Return the simulated time taken by an operation, in microseconds
+template<class F> static uint64_t TimeOf(F op)
+{
+	const uint64_t start = HostGetMicros();
+	op();
+	return HostGetMicros() - start;
+}
+
+static void TestInit(SdCardModel& card)
+{
+	// With no card in the slot the card must be reported as unusable
+	SdCardModel::Insert(0, nullptr);
+	CHECK_EQUAL(SD_MMC_ERR_UNUSABLE, sd_mmc_check(0));
+	CHECK(!sd_mmc_card_ready(0));
+
+	SdCardModel::Insert(0, &card);
+	CHECK_EQUAL(SD_MMC_OK, sd_mmc_check(0));
+	CHECK(sd_mmc_card_ready(0));
+	CHECK_EQUAL(CTRL_GOOD, mem_test_unit_ready(LUN_ID_SD_MMC_0_MEM));
+	CHECK_EQUAL(card.GetNumBlocks()/2, sd_mmc_get_capacity(0));
+	CHECK_EQUAL(CARD_TYPE_SD | CARD_TYPE_HC, sd_mmc_get_type(0));
+	CHECK_EQUAL(CARD_VER_SD_3_0, sd_mmc_get_version(0));
+
+	uint32_t lastSector = 0;
+	CHECK_EQUAL(CTRL_GOOD, mem_read_capacity(LUN_ID_SD_MMC_0_MEM, &lastSector));
+	CHECK_EQUAL(card.GetNumBlocks() - 1, lastSector);
+
+	uint32_t clock;
+	uint8_t busWidth;
+	bool highSpeed;
+	sd_mmc_get_bus_config(0, &clock, &busWidth, &highSpeed);
+	CHECK_EQUAL(50000000, clock);
+	CHECK_EQUAL(4, busWidth);
+	CHECK(highSpeed);
+	CHECK_EQUAL(25000000, sd_mmc_get_interface_speed(0));
+	CHECK_EQUAL(0, card.counters.protocolErrors);
+}
+
+static void TestReadWrite(SdCardModel& card)
+{
+	static const uint32_t sizes[] = { 1, 2, 8, 33, 100 };
+	uint32_t block = 10;
+	for (uint32_t n : sizes)
+	{
+		Fill(block, n, 1);
+		CHECK_EQUAL(CTRL_GOOD, ram_2_memory(LUN_ID_SD_MMC_0_MEM, block, buffer, n));
+		memset(buffer, 0, sizeof(buffer));
+		CHECK_EQUAL(CTRL_GOOD, memory_2_ram(LUN_ID_SD_MMC_0_MEM, block, buffer, n));
+		CHECK(Matches(block, n, 1));
+		block += n + 3;
+	}
+
+	// The card itself must hold the data once any cached writes have been flushed
+	CHECK_EQUAL(CTRL_GOOD, memory_sync(LUN_ID_SD_MMC_0_MEM, false));
+	uint8_t stored[SD_MMC_BLOCK_SIZE];
+	card.ReadStored(10, stored);
+	Fill(10, 1, 1);
+	CHECK(memcmp(stored, buffer, SD_MMC_BLOCK_SIZE) == 0);
+
+	// Overwrite part of what was written and read across the boundary
+	Fill(15, 4, 2);
+	CHECK_EQUAL(CTRL_GOOD, ram_2_memory(LUN_ID_SD_MMC_0_MEM, 15, buffer, 4));
+	CHECK_EQUAL(CTRL_GOOD, memory_2_ram(LUN_ID_SD_MMC_0_MEM, 14, buffer, 1));
+	CHECK(Matches(14, 1, 1));
+	CHECK_EQUAL(CTRL_GOOD, memory_2_ram(LUN_ID_SD_MMC_0_MEM, 15, buffer, 4));
+	CHECK(Matches(15, 4, 2));
+
+	// The last block of the card can be used, the one after it can't
+	const uint32_t last = card.GetNumBlocks() - 1;
+	Fill(last, 1, 3);
+	CHECK_EQUAL(CTRL_GOOD, ram_2_memory(LUN_ID_SD_MMC_0_MEM, last, buffer, 1));
+	CHECK_EQUAL(CTRL_GOOD, memory_2_ram(LUN_ID_SD_MMC_0_MEM, last, buffer, 1));
+	CHECK(Matches(last, 1, 3));
+	CHECK(memory_2_ram(LUN_ID_SD_MMC_0_MEM, last + 1, buffer, 1) != CTRL_GOOD);
+
+	// A streaming read that ends at the last block must not ask the card for blocks beyond it
+	const uint32_t errorsBefore = card.counters.protocolErrors;
+	CHECK_EQUAL(SD_MMC_OK, sd_mmc_read_stream(0, last, buffer, 1, 16));
+	CHECK(Matches(last, 1, 3));
+	CHECK_EQUAL(errorsBefore, card.counters.protocolErrors);
+	sd_mmc_stop_read_stream();
+	CHECK(ram_2_memory(LUN_ID_SD_MMC_0_MEM, last + 1, buffer, 1) != CTRL_GOOD);
+
+	// The card must still work after the error
+	CHECK_EQUAL(CTRL_GOOD, memory_2_ram(LUN_ID_SD_MMC_0_MEM, 15, buffer, 4));
+	CHECK(Matches(15, 4, 2));
+	CHECK_EQUAL(0, card.counters.protocolErrors);
+}
+
+#if !defined(SD_MMC_READ_AHEAD_BLOCKS) && !defined(SD_MMC_WRITE_CACHE_BLOCKS)
+
+// Multi-block writes must be preceded by ACMD23 so that the card can pre-erase the blocks
+static void TestPreErase(SdCardModel& card)
+{
+	const SdCardCounters before = card.counters;
+	Fill(200, 16, 4);
+	CHECK_EQUAL(CTRL_GOOD, ram_2_memory(LUN_ID_SD_MMC_0_MEM, 200, buffer, 16));
+	CHECK_EQUAL(16, card.counters.preErasedBlocks - before.preErasedBlocks);
+	CHECK_EQUAL(1, card.counters.writeCommands - before.writeCommands);
+	CHECK_EQUAL(1, card.counters.stopCommands - before.stopCommands);
+
+	// A single block write has no ACMD23 and no CMD12
+	CHECK_EQUAL(CTRL_GOOD, ram_2_memory(LUN_ID_SD_MMC_0_MEM, 300, buffer, 1));
+	CHECK_EQUAL(16, card.counters.preErasedBlocks - before.preErasedBlocks);
+	CHECK_EQUAL(1, card.counters.stopCommands - before.stopCommands);
+}
+
+// Single operations must take the time given by the card's timing and the negotiated bus
+static void TestTiming(SdCardModel& card)
+{
+	// Reading a block from a card limited to 20MB/sec takes 25.6us, longer than the 20.8us it takes on a 4-bit 50MHz bus
+	uint64_t t = TimeOf([]() { (void)memory_2_ram(LUN_ID_SD_MMC_0_MEM, 1000, buffer, 1); });
+	CHECK(t >= 285 && t <= 286);						// CMD13 + CMD17 + access time + 1 block
+
+	t = TimeOf([]() { (void)ram_2_memory(LUN_ID_SD_MMC_0_MEM, 1000, buffer, 1); });
+	CHECK(t >= 1150 && t <= 1151);						// CMD24 + 1 block + program + erase + commit
+
+	t = TimeOf([]() { (void)ram_2_memory(LUN_ID_SD_MMC_0_MEM, 1000, buffer, 8); });
+	CHECK(t >= 1384 && t <= 1385);						// CMD55 + ACMD23 + CMD25 + 8 pre-erased blocks + program + CMD12 + commit
+
+	// The latency statistics must see the simulated time
+	sd_mmc_reset_stats();
+	(void)memory_2_ram(LUN_ID_SD_MMC_0_MEM, 1000, buffer, 1);
+	struct sd_mmc_stats stats;
+	sd_mmc_get_stats(&stats);
+	CHECK_EQUAL(1, stats.ops[SD_MMC_OP_INIT_READ].count);
+	CHECK_EQUAL(260, stats.ops[SD_MMC_OP_INIT_READ].max_us);
+	CHECK_EQUAL(1, stats.ops[SD_MMC_OP_READ_DATA].count);
+	CHECK(stats.ops[SD_MMC_OP_READ_DATA].max_us >= 25 && stats.ops[SD_MMC_OP_READ_DATA].max_us <= 26);
+	CHECK_EQUAL(0, card.counters.protocolErrors);
+}
+
+#endif
+
+// After a data phase fails the card must be stopped and deselected, so that the next command works
+static void TestDataError(SdCardModel& card)
+{
+	const SdCardCounters before = card.counters;
+	Fill(600, 8, 8);
+	card.failNextDataPhase = true;
+	CHECK(ram_2_memory(LUN_ID_SD_MMC_0_MEM, 600, buffer, 8) != CTRL_GOOD || memory_sync(LUN_ID_SD_MMC_0_MEM, false) != CTRL_GOOD);
+	CHECK_EQUAL(1, card.counters.stopCommands - before.stopCommands);
+
+	card.failNextDataPhase = true;
+	CHECK(memory_2_ram(LUN_ID_SD_MMC_0_MEM, 600, buffer, 4) != CTRL_GOOD);
+	CHECK_EQUAL(2, card.counters.stopCommands - before.stopCommands);
+
+	card.failNextDataPhase = true;
+	CHECK(sd_mmc_read_stream(0, 600, buffer, 2, 16) != SD_MMC_OK);
+	CHECK_EQUAL(3, card.counters.stopCommands - before.stopCommands);
+
+	CHECK_EQUAL(CTRL_GOOD, ram_2_memory(LUN_ID_SD_MMC_0_MEM, 600, buffer, 8));
+	CHECK_EQUAL(CTRL_GOOD, memory_sync(LUN_ID_SD_MMC_0_MEM, false));
+	memset(buffer, 0, sizeof(buffer));
+	CHECK_EQUAL(CTRL_GOOD, memory_2_ram(LUN_ID_SD_MMC_0_MEM, 600, buffer, 8));
+	CHECK(Matches(600, 8, 8));
+	CHECK_EQUAL(0, card.counters.protocolErrors);
+}
+
+// Blocks written by an asynchronous request must be read back correctly through ctrl_access, even if they were in the read-ahead buffer
+static void TestAsyncWrite(SdCardModel& card)
+{
+	Fill(500, 8, 6);
+	CHECK_EQUAL(CTRL_GOOD, ram_2_memory(LUN_ID_SD_MMC_0_MEM, 500, buffer, 8));
+	CHECK_EQUAL(CTRL_GOOD, memory_2_ram(LUN_ID_SD_MMC_0_MEM, 500, buffer, 1));
+	CHECK_EQUAL(CTRL_GOOD, memory_2_ram(LUN_ID_SD_MMC_0_MEM, 501, buffer, 1));		// a sequential read, so 502 onwards are read ahead
+
+	// Overwrite two of the blocks that may have been read ahead
+	CHECK_EQUAL(CTRL_GOOD, memory_sync(LUN_ID_SD_MMC_0_MEM, false));
+	Fill(502, 2, 7);
+	std::vector<uint8_t> data(buffer, buffer + 2 * SD_MMC_BLOCK_SIZE);
+	struct sd_mmc_async_request request;
+	memset(&request, 0, sizeof(request));
+	request.slot = 0;
+	request.write = true;
+	request.nb_block = 2;
+	request.start = 502;
+	request.buffer = data.data();
+	CHECK_EQUAL(SD_MMC_OK, sd_mmc_async_submit(&request));
+	while (sd_mmc_async_busy())
+	{
+		(void)sd_mmc_async_irq_handler();
+		sd_mmc_async_spin();
+	}
+	CHECK_EQUAL(SD_MMC_OK, request.status);
+
+	uint8_t stored[SD_MMC_BLOCK_SIZE];
+	card.ReadStored(503, stored);
+	CHECK(memcmp(stored, data.data() + SD_MMC_BLOCK_SIZE, SD_MMC_BLOCK_SIZE) == 0);
+
+	CHECK_EQUAL(CTRL_GOOD, memory_sync(LUN_ID_SD_MMC_0_MEM, false));
+	memset(buffer, 0, sizeof(buffer));
+	CHECK_EQUAL(CTRL_GOOD, memory_2_ram(LUN_ID_SD_MMC_0_MEM, 502, buffer, 2));
+	CHECK(Matches(502, 2, 7));
+	CHECK_EQUAL(CTRL_GOOD, memory_2_ram(LUN_ID_SD_MMC_0_MEM, 504, buffer, 4));
+	CHECK(Matches(504, 4, 6));
+	CHECK_EQUAL(0, card.counters.protocolErrors);
+}
+
+// A card that doesn't support high speed mode must be used at 25MHz
+static void TestDefaultSpeedCard()
+{
+	SdCardTiming timing;
+	timing.highSpeedCapable = false;
+	SdCardModel card(2048, timing);
+	SdCardModel::Insert(0, &card);
+	sd_mmc_unmount(0);
+	CHECK_EQUAL(SD_MMC_OK, sd_mmc_check(0));
+
+	uint32_t clock;
+	uint8_t busWidth;
+	bool highSpeed;
+	sd_mmc_get_bus_config(0, &clock, &busWidth, &highSpeed);
+	CHECK_EQUAL(25000000, clock);
+	CHECK_EQUAL(4, busWidth);
+	CHECK(!highSpeed);
+
+	Fill(5, 3, 5);
+	CHECK_EQUAL(CTRL_GOOD, ram_2_memory(LUN_ID_SD_MMC_0_MEM, 5, buffer, 3));
+	memset(buffer, 0, sizeof(buffer));
+	CHECK_EQUAL(CTRL_GOOD, memory_2_ram(LUN_ID_SD_MMC_0_MEM, 5, buffer, 3));
+	CHECK(Matches(5, 3, 5));
+	CHECK_EQUAL(0, card.counters.protocolErrors);
+
+	SdCardModel::Insert(0, nullptr);
+	sd_mmc_unmount(0);
+}
+
+int main()
+{
+	sd_mmc_init(wpPins, spiCsPins);
+	sd_mmc_set_driver_interface(0, &SdCardModel::Interface, 0);
+
+	SdCardModel card(64 * 1024);						// 32MB
+	TestInit(card);
+	TestReadWrite(card);
+	TestDataError(card);
+	TestAsyncWrite(card);
+#if !defined(SD_MMC_READ_AHEAD_BLOCKS) && !defined(SD_MMC_WRITE_CACHE_BLOCKS)
+	// These count the commands and time taken by single calls, which the caches change
+	TestPreErase(card);
+	TestTiming(card);
+#endif
+	TestDefaultSpeedCard();
+	return TestResult(TEST_NAME);
+}
+
+// End
@@ -0,0 +1,93 @@
+/*
+ * TickLatchTest.cpp
+ *
+ * Torture test for the latch behind millis() and millis64(). One thread increments the count as fast as it can, starting just below 2^32
+ * so that the high word changes during the test, while other threads read it and check that the values they see never go backwards
+ * and are never torn.
+ */
+
+#include "TickLatch.h"
+#include "HostTest.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+static const uint64_t StartCount = 0xFFFFFFFFull - 500000;
+static const uint64_t Increments = 2000000;
+static const unsigned int NumReaders = 3;
+
+static TickLatch latch;
+static std::atomic<bool> writerDone(false);
+static std::atomic<unsigned int> readersStarted(0);
+
+struct ReaderResult
+{
+	uint64_t reads = 0;
+	unsigned int backwards = 0;
+	unsigned int outOfRange = 0;
+	unsigned int lowMismatches = 0;
+};
+
+static void Reader(ReaderResult *result)
+{
+	++readersStarted;
+	uint64_t last = StartCount;
+	uint32_t lastLow = (uint32_t)StartCount;
+	while (!writerDone)
+	{
+		const uint64_t now = TickLatchRead(&latch);
+		const uint32_t low = TickLatchReadLow(&latch);
+		if (now < last)
+		{
+			++result->backwards;
+		}
+		if (now < StartCount || now > StartCount + Increments)
+		{
+			++result->outOfRange;						// a torn read across the 32-bit boundary lands outside the range
+		}
+		if ((uint32_t)(low - lastLow) >= 0x80000000u || (uint32_t)(low - (uint32_t)now) >= 0x80000000u)
+		{
+			++result->lowMismatches;					// the low word went backwards, or is behind the full count read before it
+		}
+		last = now;
+		lastLow = low;
+		++result->reads;
+	}
+}
+
+int main()
+{
+	latch.count[0] = latch.count[1] = StartCount;
+	latch.seq = 0;
+
+	std::vector<ReaderResult> results(NumReaders);
+	std::vector<std::thread> readers;
+	for (unsigned int i = 0; i < NumReaders; ++i)
+	{
+		readers.emplace_back(Reader, &results[i]);
+	}
+	while (readersStarted != NumReaders) { }
+
+	for (uint64_t i = 0; i < Increments; ++i)
+	{
+		TickLatchIncrement(&latch);
+	}
+	writerDone = true;
+	for (std::thread& t : readers)
+	{
+		t.join();
+	}
+
+	CHECK_EQUAL(StartCount + Increments, TickLatchRead(&latch));
+	CHECK_EQUAL((uint32_t)(StartCount + Increments), TickLatchReadLow(&latch));
+	for (const ReaderResult& r : results)
+	{
+		CHECK(r.reads != 0);
+		CHECK_EQUAL(0, r.backwards);
+		CHECK_EQUAL(0, r.outOfRange);
+		CHECK_EQUAL(0, r.lowMismatches);
+	}
+	return TestResult("TickLatchTest");
+}
+
+// End
@@ -0,0 +1,224 @@
+/*
+ * WireTest.cpp
+ *
+ * Runs TwoWire's synchronous and asynchronous transfers against the fake TWI peripheral and a scripted slave.
+ * The asynchronous transfers must put the same bytes on the bus and report the same counts as Transfer().
+ */
+
+#include "Wire.h"
+#include "HostTest.h"
+#include <cstring>
+
+static Twi twi;
+static TwoWire wire(&twi, TWI0_IRQn, nullptr);
+
+static uint8_t buffer[64];				// static, so that the fake PDC can reach it
+
+static bool callbackDone;
+static size_t callbackCount;
+
+static void TransferComplete(TwoWire *w, size_t bytesTransferred, void *param)
+{
+	CHECK(w == &wire);
+	CHECK(param == &callbackDone);
+	callbackDone = true;
+	callbackCount = bytesTransferred;
+}
+
+// Call the interrupt handler while an enabled interrupt is pending, as the NVIC would
+static void ServiceInterrupts()
+{
+	unsigned int calls = 0;
+	while (FakeIrqEnabled(TWI0_IRQn) && (twi.PeekStatus() & twi.GetInterruptMask()) != 0)
+	{
+		if (++calls > 100)
+		{
+			CHECK(false);				// the handler isn't clearing the interrupt
+			return;
+		}
+		wire.Interrupt();
+	}
+}
+
+// Wait-for-status function for Transfer() that moves the bus on while it waits
+static uint32_t StepUntilStatus(Twi *t, uint32_t bitsToWaitFor)
+{
+	uint32_t sr = t->TWI_SR;
+	for (unsigned int i = 0; i < 1000 && (sr & bitsToWaitFor) == 0; ++i)
+	{
+		t->Step();
+		sr = t->TWI_SR;
+	}
+	return sr;
+}
+
+static void ResetBus(int nackAt, std::vector<uint8_t> readData)
+{
+	wire.BeginMaster(100000);
+	(void)wire.GetErrorCounts(true);
+	twi.slave = FakeTwiSlave();
+	twi.slave.nackAt = nackAt;
+	twi.slave.readData = readData;
+	fakeMillis = 0;
+}
+
+static void Fill(size_t length)
+{
+	for (size_t i = 0; i < length; ++i)
+	{
+		buffer[i] = (uint8_t)(0xA0 + i);
+	}
+}
+
+// Run a transfer asynchronously, returning the count passed to the callback
+static size_t RunAsync(uint16_t address, size_t numToWrite, size_t numToRead, bool repeatedStart = false)
+{
+	callbackDone = false;
+	callbackCount = 0xFFFF;
+	CHECK(wire.TransferAsync(address, buffer, numToWrite, numToRead, TransferComplete, &callbackDone, repeatedStart));
+	CHECK(wire.IsBusy());
+	CHECK(!wire.TransferAsync(address, buffer, numToWrite, numToRead, TransferComplete, &callbackDone, repeatedStart));
+	ServiceInterrupts();
+	for (unsigned int i = 0; i < 200 && !callbackDone; ++i)
+	{
+		twi.Step();
+		ServiceInterrupts();
+	}
+	CHECK(callbackDone);
+	CHECK(!wire.IsBusy());
+	CHECK(twi.IsIdle());
+	return callbackCount;
+}
+
+// Run the same transfer synchronously and asynchronously and check that they do the same
+static void Compare(const char *expectedLog, uint16_t address, size_t numToWrite, size_t numToRead, int nackAt, size_t expectedCount,
+						uint32_t expectedNaks = 0)
+{
+	std::vector<uint8_t> readData;
+	for (size_t i = 0; i < numToRead; ++i)
+	{
+		readData.push_back((uint8_t)(0x10 + i));
+	}
+
+	ResetBus(nackAt, readData);
+	memset(buffer, 0, sizeof(buffer));
+	Fill(numToWrite);
+	CHECK_EQUAL(expectedCount, wire.Transfer(address, buffer, numToWrite, numToRead, StepUntilStatus));
+	const std::string syncLog = twi.slave.log;
+	const std::vector<uint8_t> syncReceived = twi.slave.received;
+	std::vector<uint8_t> syncRead(buffer + numToWrite, buffer + numToWrite + numToRead);
+	CHECK_EQUAL(expectedNaks, wire.GetErrorCounts(true).naks);
+
+	ResetBus(nackAt, readData);
+	memset(buffer, 0, sizeof(buffer));
+	Fill(numToWrite);
+	CHECK_EQUAL(expectedCount, RunAsync(address, numToWrite, numToRead));
+	CHECK(twi.slave.log == syncLog);
+	CHECK(twi.slave.log == expectedLog);
+	CHECK(twi.slave.received == syncReceived);
+	CHECK(std::vector<uint8_t>(buffer + numToWrite, buffer + numToWrite + numToRead) == syncRead);
+	CHECK_EQUAL(expectedNaks, wire.GetErrorCounts(true).naks);
+	if (nackAt < 0)
+	{
+		CHECK_EQUAL(numToWrite, twi.slave.received.size());
+		for (size_t i = 0; i < numToRead; ++i)
+		{
+			CHECK_EQUAL(0x10 + i, buffer[numToWrite + i]);
+		}
+	}
+}
+
+static void TestTransfers()
+{
+	Compare("S50WP", 0x50, 3, 0, -1, 3);									// written byte by byte
+	Compare("S50WP", 0x50, 12, 0, -1, 12);									// written by the PDC
+	Compare("S50RP", 0x50, 0, 1, -1, 1);
+	Compare("S50RP", 0x50, 0, 3, -1, 3);									// read byte by byte
+	Compare("S50RP", 0x50, 0, 20, -1, 20);									// read by the PDC
+	Compare("S50WPS50RP", 0x50, 2, 10, -1, 12);
+	Compare("S50WPS50RP", 0x50, 10, 2, -1, 12);
+}
+
+static void TestNaks()
+{
+	Compare("S50WN", 0x50, 3, 0, 0, 0, 1);									// address NAKed
+	Compare("S50WN", 0x50, 12, 0, 0, 0, 1);
+	Compare("S50RN", 0x50, 0, 8, 0, 0, 1);
+	Compare("S50WN", 0x50, 3, 0, 2, 2, 1);									// data byte NAKed
+	Compare("S50WN", 0x50, 12, 0, 5, 5, 1);									// data byte NAKed while the PDC is sending
+	Compare("S50WN", 0x50, 12, 0, 1, 1, 1);
+	Compare("S50WN", 0x50, 12, 8, 7, 7, 1);									// no read after a failed write
+}
+
+static void TestRepeatedStart()
+{
+	ResetBus(-1, { 1, 2, 3, 4, 5, 6 });
+	buffer[0] = 0x12;
+	buffer[1] = 0x34;
+	CHECK_EQUAL(8, RunAsync(0x50, 2, 6, true));
+	CHECK(twi.slave.log == "S50WS50RP");
+	CHECK(twi.slave.received == std::vector<uint8_t>({ 0x12, 0x34 }));
+	CHECK_EQUAL(6, buffer[7]);
+}
+
+static void TestTimeout()
+{
+	ResetBus(-1, {});
+	twi.slave.hang = true;
+	Fill(8);
+	callbackDone = false;
+	CHECK(wire.TransferAsync(0x50, buffer, 8, 0, TransferComplete, &callbackDone));
+	for (unsigned int i = 0; i < 10; ++i)
+	{
+		twi.Step();
+		ServiceInterrupts();
+		CHECK(wire.IsBusy());				// callers poll, which lets IsBusy() see the bytes that the DMA moved before the slave hung
+	}
+	fakeMillis += 5;
+	CHECK(wire.IsBusy());
+	fakeMillis += 1;
+	CHECK(!wire.IsBusy());
+	CHECK(callbackDone);
+	CHECK_EQUAL(0, callbackCount);
+	CHECK_EQUAL(1, wire.GetErrorCounts(false).sendTimeouts);
+	CHECK_EQUAL(5, FakeIrqPriority(TWI0_IRQn));
+}
+
+// A 64-byte DMA transfer takes about 6ms at 100kHz. It must not time out, because bytes are moving even though there are no interrupts.
+static void TestLongDma(size_t numToWrite, size_t numToRead)
+{
+	std::vector<uint8_t> readData(numToRead, 0x55);
+	ResetBus(-1, readData);
+	Fill(numToWrite);
+	callbackDone = false;
+	CHECK(wire.TransferAsync(0x50, buffer, numToWrite, numToRead, TransferComplete, &callbackDone));
+	for (unsigned int i = 0; i < 200 && !callbackDone; ++i)
+	{
+		if (i % 10 == 9)
+		{
+			++fakeMillis;						// each byte takes 90us
+		}
+		twi.Step();
+		ServiceInterrupts();
+		(void)wire.IsBusy();
+	}
+	CHECK(fakeMillis > 5);
+	CHECK(callbackDone);
+	CHECK_EQUAL(numToWrite + numToRead, callbackCount);
+	const TwoWire::ErrorCounts errors = wire.GetErrorCounts(false);
+	CHECK_EQUAL(0, errors.sendTimeouts + errors.recvTimeouts + errors.finishTimeouts);
+	CHECK_EQUAL(numToWrite, twi.slave.received.size());
+}
+
+int main()
+{
+	TestTransfers();
+	TestNaks();
+	TestRepeatedStart();
+	TestTimeout();
+	TestLongDma(64, 0);
+	TestLongDma(0, 64);
+	return TestResult("WireTest");
+}
+
+// End
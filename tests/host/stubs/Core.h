@@ -0,0 +1,49 @@
+/*
+ * Core.h
+ *
+ * Host stand-in for the parts of Core.h that the storage library uses.
+ * Time is simulated: DWT->CYCCNT and millis() only move on when HostAdvanceTime() is called, which the simulated SD card does
+ * as it takes time to answer commands and transfer data. The functions are defined in HostStorage.cpp.
+ */
+
+#ifndef HOST_CORE_H_
+#define HOST_CORE_H_
+
+#include "compiler.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static const Pin NoPin = 0xFF;
+
+#define INPUT_PULLUP	2
+void pinMode(Pin pin, int mode);
+bool digitalRead(Pin pin);
+
+typedef uint32_t irqflags_t;
+static inline irqflags_t cpu_irq_save(void) { return 0; }
+static inline void cpu_irq_restore(irqflags_t flags) { (void)flags; }
+
+typedef struct { volatile uint32_t CYCCNT; } HostDwt_Type;
+extern HostDwt_Type hostDwt;
+#define DWT		(&hostDwt)
+extern uint32_t SystemCoreClock;
+#define __CLZ(x)	(((x) == 0) ? 32 : __builtin_clz(x))
+
+void EnableCycleCounter(void);
+uint32_t millis(void);
+
+// Move the simulated clock on
+void HostAdvanceTime(uint32_t micros);
+
+// Return the simulated time since the program started
+uint64_t HostGetMicros(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HOST_CORE_H_ */
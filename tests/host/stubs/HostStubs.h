@@ -0,0 +1,15 @@
+/*
+ * HostStubs.h
+ *
+ * Stand-ins for the CMSIS intrinsics used by code that is tested on a host. This file is included before every source file.
+ */
+
+#ifndef HOSTSTUBS_H_
+#define HOSTSTUBS_H_
+
+#ifdef __cplusplus
+# include <atomic>
+# define __DMB()	std::atomic_thread_fence(std::memory_order_seq_cst)
+#endif
+
+#endif /* HOSTSTUBS_H_ */
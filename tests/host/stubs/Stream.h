@@ -0,0 +1,10 @@
+/*
+ * Stream.h
+ *
+ * Host stand-in for the core Stream.h. Nothing under test uses it.
+ */
+
+#ifndef HOST_STREAM_H_
+#define HOST_STREAM_H_
+
+#endif /* HOST_STREAM_H_ */
@@ -0,0 +1,32 @@
+/*
+ * compiler.h
+ *
+ * Host stand-in for the ASF compiler.h and the parts of Core.h that the library headers under test need.
+ */
+
+#ifndef HOST_COMPILER_H_
+#define HOST_COMPILER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <assert.h>
+
+typedef uint8_t Pin;
+
+// As in the ASF compiler.h
+typedef uint8_t U8;
+typedef uint16_t U16;
+typedef uint32_t U32;
+
+#define DISABLE		0
+#define ENABLE		1
+#define PASS		0
+#define FAIL		1
+
+#define UNUSED(v)					(void)(v)
+#define COMPILER_ALIGNED(a)			__attribute__((__aligned__(a)))
+#define COMPILER_WORD_ALIGNED		__attribute__((__aligned__(4)))
+#define Assert(expr)				assert(expr)
+
+#endif /* HOST_COMPILER_H_ */
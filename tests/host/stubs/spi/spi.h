@@ -0,0 +1,22 @@
+/*
+ * spi.h
+ *
+ * Host stand-in for the ASF SPI driver header. The status codes must match asf/sam/drivers/spi/spi.h.
+ */
+
+#ifndef HOST_SPI_H_
+#define HOST_SPI_H_
+
+typedef enum
+{
+	SPI_ERROR = -1,
+	SPI_OK = 0,
+	SPI_ERROR_TIMEOUT = 1,
+	SPI_ERROR_ARGUMENT,
+	SPI_ERROR_OVERRUN,
+	SPI_ERROR_MODE_FAULT,
+	SPI_ERROR_OVERRUN_AND_MODE_FAULT,
+	SPI_BUSY
+} spi_status_t;
+
+#endif /* HOST_SPI_H_ */
@@ -0,0 +1,12 @@
+/*
+ * twi.h
+ *
+ * Host stand-in for the ASF TWI driver header. The fake peripheral provides twi_master_init().
+ */
+
+#ifndef HOST_TWI_H_
+#define HOST_TWI_H_
+
+#include "FakeTwi.h"
+
+#endif /* HOST_TWI_H_ */
@@ -0,0 +1,16 @@
+/*
+ * variant.h
+ *
+ * Host stand-in for a board variant header, which on the target brings in the device headers.
+ * Here it brings in the fake TWI peripheral. No Wire interfaces are created; the tests make their own.
+ */
+
+#ifndef HOST_VARIANT_H_
+#define HOST_VARIANT_H_
+
+#include "FakeTwi.h"
+
+#define WIRE_INTERFACES_COUNT	0
+#define VARIANT_MCK				120000000
+
+#endif /* HOST_VARIANT_H_ */
@@ -191,6 +191,33 @@ extern USARTClass Serial2;
 
 extern void ConfigurePin(const PinDescription& pinDesc);
 
+// PIO port and bit of each pin in g_APinDescription, encoded as (port number * 32 + bit number), or NoPioBit if it is not a single PIO pin.
+// This lets PinT<N> access a pin at compile time. It must be kept in step with the pin table in variant.cpp.
+static constexpr uint8_t PinPioBits[] =
+{
+	8, 9, 57, 92, 90, 89, 88, 87,		// 0-7
+	86, 85, 93, 103, 104, 59, 100, 101,		// 8-15
+	13, 12, 11, 10, 44, 45, 58, 14,		// 16-23
+	15, 96, 97, 98, 99, 102, 105, 7,		// 24-31
+	106, 65, 66, 67, 68, 69, 70, 71,		// 32-39
+	72, 73, 19, 20, 83, 82, 81, 80,		// 40-47
+	79, 78, 77, 76, 53, 46, 16, 24,		// 48-55
+	23, 22, 6, 4, 3, 2, 49, 50,		// 56-63
+	51, 52, 47, 48, 1, 0, 17, 18,		// 64-71
+	94, 21, 25, 26, 27, 28, 55, NoPioBit,		// 72-79
+	NoPioBit, NoPioBit, NoPioBit, NoPioBit, NoPioBit, NoPioBit, 53, 29,		// 80-87
+	47, 46, NoPioBit, NoPioBit, 5, 91, 0, 1,		// 88-95
+	75, 72, 66, 70, 84, 105, 93, 94,		// 96-103
+	74, 92, 54, 55, 56, 68		// 104-109
+};
+
+static_assert(sizeof(PinPioBits) == MaxPinNumber + 1, "PinPioBits has the wrong number of entries");
+
+template<Pin N> static inline constexpr uint8_t GetPinPioBit()
+{
+	return (N <= MaxPinNumber) ? PinPioBits[N] : NoPioBit;
+}
+
 #endif
 
 #endif /* _VARIANT_ARDUINO_DUET_X_ */
@@ -371,6 +371,9 @@ void ConfigurePin(const PinDescription& pinDesc)
 
 extern "C" void init( void )
 {
+	// Start the cycle counter used by the 64-bit time base before anything uses it
+	EnableCycleCounter();
+
 	// Initialize Serial port 0 U(S)ART pins
 	ConfigurePin(g_APinDescription[APINS_UART]);
 	setPullup(APIN_UART_RXD, true); 							// Enable pullup for RX0
@@ -378,6 +381,9 @@ extern "C" void init( void )
 	// Initialize USB pins
 	ConfigurePin(g_APinDescription[APINS_USB]);
 
+	// Read the unique ID and user signature while nothing else is using the flash controller
+	DeviceSignatureInit();
+
 	// Initialize Analog Controller
 	AnalogInInit();
 
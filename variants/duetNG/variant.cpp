@@ -255,12 +255,18 @@ void ConfigurePin(const PinDescription& pinDesc)
 
 extern "C" void init( void )
 {
+	// Start the cycle counter used by the 64-bit time base before anything uses it
+	EnableCycleCounter();
+
 	// We no longer disable pullups on all pins here, better to leave them enabled until the port is initialised
 
 	// Initialize Serial port U(S)ART pins
 	ConfigurePin(g_APinDescription[APINS_Serial0]);
 	setPullup(APIN_Serial0_RXD, true); 							// Enable pullup for RX0
 
+	// Read the unique ID and user signature while nothing else is using the flash controller
+	DeviceSignatureInit();
+
  	// Initialize Analog Controller
 	AnalogInInit();
 
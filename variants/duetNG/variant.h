@@ -169,6 +169,33 @@ extern UARTClass Serial1;
 
 extern void ConfigurePin(const PinDescription& pinDesc);
 
+// PIO port and bit of each pin in g_APinDescription, encoded as (port number * 32 + bit number), or NoPioBit if it is not a single PIO pin.
+// This lets PinT<N> access a pin at compile time. It must be kept in step with the pin table in variant.cpp.
+static constexpr uint8_t PinPioBits[] =
+{
+	0, 1, 2, 3, 4, 5, 6, 7,		// 0-7
+	8, 9, 10, 11, 12, 13, 14, 15,		// 8-15
+	16, 17, 18, 19, 20, 21, 22, 23,		// 16-23
+	24, 25, 32, 33, 34, 35, 45, 46,		// 24-31
+	64, 65, 66, 67, 68, 69, 70, 71,		// 32-39
+	72, 73, 74, 75, 76, 77, 78, 79,		// 40-47
+	80, 81, 82, 83, 84, 85, 86, 87,		// 48-55
+	88, 89, 90, 91, 92, 93, 94, 95,		// 56-63
+	96, 97, 98, 99, 100, 101, 102, 103,		// 64-71
+	104, 105, 106, 107, 108, 109, 110, 111,		// 72-79
+	112, 113, 114, 115, 116, 117, 118, 119,		// 80-87
+	120, 121, 122, 123, 124, 125, 126, 127,		// 88-95
+	128, 129, 130, 131, 132, 133, 38, 39,		// 96-103
+	36, 37		// 104-105
+};
+
+static_assert(sizeof(PinPioBits) == MaxPinNumber + 1, "PinPioBits has the wrong number of entries");
+
+template<Pin N> static inline constexpr uint8_t GetPinPioBit()
+{
+	return (N <= MaxPinNumber) ? PinPioBits[N] : NoPioBit;
+}
+
 #endif
 
 #endif /* _VARIANT_DUET_NG_H */
@@ -208,6 +208,9 @@ void ConfigurePin(const PinDescription& pinDesc)
 
 extern "C" void init( void )
 {
+	// Start the cycle counter used by the 64-bit time base before anything uses it
+	EnableCycleCounter();
+
 #ifndef PCCB
 	// Initialize Serial port U(S)ART pins
 	ConfigurePin(g_APinDescription[APINS_Serial0]);				// PanelDue uses UART1
@@ -216,6 +219,9 @@ extern "C" void init( void )
 
 	// No need to initialize the USB pins on the SAM4S because they are USB by default
 
+	// Read the unique ID and user signature while nothing else is using the flash controller
+	DeviceSignatureInit();
+
 	// Initialize Analog Controller
 	AnalogInInit();
 
@@ -167,6 +167,28 @@ extern UARTClass Serial;
 
 extern void ConfigurePin(const PinDescription& pinDesc);
 
+// PIO port and bit of each pin in g_APinDescription, encoded as (port number * 32 + bit number), or NoPioBit if it is not a single PIO pin.
+// This lets PinT<N> access a pin at compile time. It must be kept in step with the pin table in variant.cpp.
+static constexpr uint8_t PinPioBits[] =
+{
+	0, 1, 2, 3, 4, 5, 6, 7,		// 0-7
+	8, 9, 10, 11, 12, 13, 14, 15,		// 8-15
+	16, 17, 18, 19, 20, 21, 22, 23,		// 16-23
+	24, 25, 32, 33, 34, 35, 36, 37,		// 24-31
+	38, 39, 45, 46, 64, 65, 66, 67,		// 32-39
+	68, 69, 70, 71, 72, 73, 74, 75,		// 40-47
+	76, 77, 78, 79, 80, 81, 82, 83,		// 48-55
+	84, 85, 86, 87, 88, 89, 90, 91,		// 56-63
+	92, 93, 94, 95		// 64-67
+};
+
+static_assert(sizeof(PinPioBits) == MaxPinNumber + 1, "PinPioBits has the wrong number of entries");
+
+template<Pin N> static inline constexpr uint8_t GetPinPioBit()
+{
+	return (N <= MaxPinNumber) ? PinPioBits[N] : NoPioBit;
+}
+
 #endif
 
 #endif /* _VARIANT_ARDUINO_DUET_X_ */
@@ -334,11 +334,14 @@ extern const PinDescription g_APinDescription[] =
 #ifdef SAME70XPLD
   { PIOA, PIO_PA5C_URXD1|PIO_PA6C_UTXD1,   ID_PIOA, PIO_PERIPH_C, PIO_DEFAULT, (PIN_ATTR_DIGITAL|PIN_ATTR_COMBO), NO_ADC, NOT_ON_PWM, NOT_ON_TIMER },
 #else
-  { PIOD, PIO_PD18C_URXD4|PIO_PD19C_UTXD4, ID_PIOD, PIO_PERIPH_C, PIO_DEFAULT, (PIN_ATTR_DIGITAL|PIN_ATTR_COMBO), NO_ADC, NOT_ON_PWM, NOT_ON_TIMER }
+  { PIOD, PIO_PD18C_URXD4|PIO_PD19C_UTXD4, ID_PIOD, PIO_PERIPH_C, PIO_DEFAULT, (PIN_ATTR_DIGITAL|PIN_ATTR_COMBO), NO_ADC, NOT_ON_PWM, NOT_ON_TIMER },
 #endif
+
+  // 139 TWIHS0 all pins
+  { PIOA, PIO_PA3A_TWD0|PIO_PA4A_TWCK0,    ID_PIOA, PIO_PERIPH_A, PIO_DEFAULT, (PIN_ATTR_DIGITAL|PIN_ATTR_COMBO), NO_ADC, NOT_ON_PWM, NOT_ON_TIMER }
 };
 
-static_assert(ARRAY_SIZE(g_APinDescription) == 139, "incorrect pin count");		// check on pin numbering
+static_assert(ARRAY_SIZE(g_APinDescription) == 140, "incorrect pin count");		// check on pin numbering
 
 /*
  * UART objects
@@ -391,12 +394,18 @@ void ConfigurePin(const PinDescription& pinDesc)
 
 extern "C" void init( void )
 {
+	// Start the cycle counter used by the 64-bit time base before anything uses it
+	EnableCycleCounter();
+
 	// Initialize Serial port U(S)ART pins
 	ConfigurePin(g_APinDescription[APINS_Serial0]);
 	setPullup(APIN_Serial0_RXD, true); 							// Enable pullup for RX0
 
 	// No need to initialize the USB pins on the SAME70 because they are USB by default
 
+	// Read the unique ID and user signature while nothing else is using the flash controller
+	DeviceSignatureInit();
+
 	// Initialize Analog Controller
 	AnalogInInit();
 
@@ -70,6 +70,17 @@ extern "C"{
 static const uint8_t APINS_Serial0 = 137;
 static const uint8_t APINS_Serial1 = 138;
 
+// TWI Interfaces
+#define WIRE_INTERFACES_COUNT 1
+
+static const uint8_t APINS_WIRE = 139;
+
+#define WIRE_INTERFACE		TWIHS0
+#define WIRE_INTERFACE_ID	ID_TWIHS0
+#define WIRE_ISR_HANDLER	TWIHS0_Handler
+#define WIRE_ISR_ID			TWIHS0_IRQn
+#define WIRE_XDMAC_CHANNEL	1				// XDMAC channel 0 is used by HSMCI
+
 #ifdef SAME70XPLD
 
 // No USB_VBUS_PIN on the XPLD
@@ -148,6 +159,36 @@ extern UARTClass Serial1;
 
 extern void ConfigurePin(const PinDescription& pinDesc);
 
+// PIO port and bit of each pin in g_APinDescription, encoded as (port number * 32 + bit number), or NoPioBit if it is not a single PIO pin.
+// This lets PinT<N> access a pin at compile time. It must be kept in step with the pin table in variant.cpp.
+static constexpr uint8_t PinPioBits[] =
+{
+	0, 1, 2, 3, 4, 5, 6, 7,		// 0-7
+	8, 9, 10, 11, 12, 13, 14, 15,		// 8-15
+	NoPioBit, 17, 18, 19, 20, 21, 22, 23,		// 16-23
+	24, NoPioBit, NoPioBit, NoPioBit, NoPioBit, 29, NoPioBit, NoPioBit,		// 24-31
+	32, 33, 34, 35, 36, 37, 38, 39,		// 32-39
+	NoPioBit, NoPioBit, NoPioBit, NoPioBit, NoPioBit, 45, NoPioBit, NoPioBit,		// 40-47
+	NoPioBit, NoPioBit, NoPioBit, NoPioBit, NoPioBit, NoPioBit, NoPioBit, NoPioBit,		// 48-55
+	NoPioBit, NoPioBit, NoPioBit, NoPioBit, NoPioBit, NoPioBit, NoPioBit, NoPioBit,		// 56-63
+	64, 65, 66, 67, 68, 69, 70, 71,		// 64-71
+	72, 73, 74, 75, 76, 77, 78, 79,		// 72-79
+	80, 81, 82, 83, 84, 85, 86, 87,		// 80-87
+	88, 89, 90, 91, 92, 93, 94, 95,		// 88-95
+	NoPioBit, NoPioBit, NoPioBit, NoPioBit, NoPioBit, NoPioBit, NoPioBit, NoPioBit,		// 96-103
+	NoPioBit, NoPioBit, 106, 107, 108, 109, 110, 111,		// 104-111
+	112, 113, 114, 115, 116, 117, 118, NoPioBit,		// 112-119
+	120, 121, 122, 123, 124, NoPioBit, 126, 127,		// 120-127
+	128, 129, 130, 131, 132, 133		// 128-133
+};
+
+static_assert(sizeof(PinPioBits) == MaxPinNumber + 1, "PinPioBits has the wrong number of entries");
+
+template<Pin N> static inline constexpr uint8_t GetPinPioBit()
+{
+	return (N <= MaxPinNumber) ? PinPioBits[N] : NoPioBit;
+}
+
 #endif
 
 #endif /* _VARIANT_SAME70_H */